@@ -75,6 +75,9 @@ extern "C" void app_main(void) {
     void* ptr = &intValue1;
     Log.infoln("Pointer value: %p", ptr);
 
+    // Compile-time checked format
+    Log.infoln(THORLOG_FMT("Checked at compile time: %d, %s"), intValue1, stringValue);
+
     // Different log levels
     Log.fatalln("This is a FATAL message");
     Log.errorln("This is an ERROR message");
@@ -0,0 +1,92 @@
+/*
+  _____ _   _  ___  ____  _     ___   ____
+ |_   _| | | |/ _ \|  _ \| |   / _ \ / ___|
+   | | | |_| | | | | |_) | |  | | | | |  _
+   | | |  _  | |_| |  _ <| |__| |_| | |_| |
+   |_| |_| |_|\___/|_| \_\_____\___/ \____|
+
+ ThorLog ESP-IDF Benchmark
+ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+ Prints the cycles and bytes per log call for the cases in
+ tools/thorlog_bench.h, then for each sink type. The sinks wrap null
+ outputs, so they show the cost a log call pays, not the speed of the
+ medium behind them.
+*/
+
+#include "thorlog.h"
+#include "thorlog_espidf.h"
+#include "thorlog_async_espidf.h"
+#include "thorlog_isr_espidf.h"
+#include "thorlog_rtc_espidf.h"
+#include "thorlog_bench.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+RTC_NOINIT_ATTR static ThorRtcBuffer<4096> rtcBuffer;
+
+// Sink cases: a logger per sink, each ending in its own null output
+static void benchSinks(ThorBench& bench) {
+    static ThorNullPrint sink;
+    static ThorLogging log;
+    static ThorLockedPrint locked(&sink);
+    static ThorAsyncPrint<32> async(&sink, THORLOG_ASYNC_DROP_NEWEST);
+    static ThorIsrPrint<32> isr(&sink);
+    static ThorRtcPrint<4096> rtc(&rtcBuffer);
+
+    // The drain tasks run on the other core where there is one, as they
+    // would in an application that keeps logging off the main core
+    BaseType_t core = (portNUM_PROCESSORS > 1) ? 1 : tskNO_AFFINITY;
+    async.begin(tskIDLE_PRIORITY + 2, core);
+    isr.begin(tskIDLE_PRIORITY + 2, core);
+    rtc.begin();
+
+    bench.header("Sinks (\"v=%d\", ln)");
+    log.begin(THORLOG_LEVEL_VERBOSE, &sink);
+    bench.run("null", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.begin(THORLOG_LEVEL_VERBOSE, &locked);
+    bench.run("ThorLockedPrint", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.begin(THORLOG_LEVEL_VERBOSE, &async);
+    bench.run("ThorAsyncPrint", nullptr, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.begin(THORLOG_LEVEL_VERBOSE, &isr);
+    bench.run("ThorIsrPrint (task context)", nullptr, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.begin(THORLOG_LEVEL_VERBOSE, &rtc);
+    bench.run("ThorRtcPrint", nullptr, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    bench.skip("EspIdfPrint", "bound by the console baud rate");
+    bench.skip("ThorStoragePrint", "needs a data partition, wears flash");
+    bench.skip("ThorUdpPrint", "needs a network");
+
+    vTaskDelay(pdMS_TO_TICKS(100));
+    EspIdfOutput.print("\nDropped: async ");
+    EspIdfOutput.print(static_cast<unsigned long>(async.getDropped()));
+    EspIdfOutput.print(", isr ");
+    EspIdfOutput.print(static_cast<unsigned long>(isr.getDropped()));
+    EspIdfOutput.print("\n");
+
+    log.begin(THORLOG_LEVEL_VERBOSE, &sink);
+    log.setTimestamp(THORLOG_TIMESTAMP_CYCLES, thorlog_espidf_cycles);
+    bench.header("ESP-IDF context (\"v=%d\", ln)");
+    bench.run("cycle timestamp", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.setTimestamp(THORLOG_TIMESTAMP_NONE);
+    log.setTaskInfo(thorlog_espidf_task_name, thorlog_espidf_core_id);
+    bench.run("task and core", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.setTaskInfo(nullptr, nullptr);
+}
+
+extern "C" void app_main(void) {
+    // Let the boot messages drain first
+    vTaskDelay(pdMS_TO_TICKS(500));
+    EspIdfOutput.print("ThorLog benchmark, CPU MHz: ");
+    EspIdfOutput.print(CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+    EspIdfOutput.print("\n");
+
+    // The cycle counter is 32 bits wide
+    ThorBench bench(&EspIdfOutput, thorlog_espidf_cycles, "cycles", 32);
+    thorlog_bench_core(bench, thorlog_espidf_time_us);
+    benchSinks(bench);
+
+    EspIdfOutput.print("\nDone\n");
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(10000));
+    }
+}
@@ -0,0 +1,58 @@
+/*
+  _____ _   _  ___  ____  _     ___   ____
+ |_   _| | | |/ _ \|  _ \| |   / _ \ / ___|
+   | | | |_| | | | | |_) | |  | | | | |  _
+   | | |  _  | |_| |  _ <| |__| |_| | |_| |
+   |_| |_| |_|\___/|_| \_\_____\___/ \____|
+
+ ThorLog ESP-IDF Flash Log Example
+ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+ Keeps warnings and errors in the "thorlog" data partition (see
+ partitions.csv) and prints what the previous boots logged on startup.
+ Reset the board a few times to watch the stored log grow.
+*/
+
+#include "thorlog.h"
+#include "thorlog_espidf.h"
+#include "thorlog_async_espidf.h"
+#include "thorlog_storage_espidf.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Flush at least once a second, and at once for ERROR and FATAL records
+static ThorStoragePrint<> flashLog("thorlog", 1000, THORLOG_LEVEL_ERROR);
+
+// Flash writes stall both cores; a task does them instead of the logger
+static ThorAsyncPrint<16> asyncFlash(&flashLog, THORLOG_ASYNC_BLOCK);
+
+extern "C" void app_main(void) {
+    Log.begin(THORLOG_LEVEL_VERBOSE, &EspIdfOutput);
+
+    if (!flashLog.begin()) {
+        Log.errorln("No \"thorlog\" partition, or smaller than 8K");
+        return;
+    }
+
+    Log.noticeln("--- Stored log ---");
+    size_t bytes = flashLog.replay(&EspIdfOutput);
+    Log.noticeln("--- %u bytes, %u damaged pages ---", static_cast<unsigned>(bytes),
+                 static_cast<unsigned>(flashLog.getDamaged()));
+
+    // Only warnings and worse go to flash; the console still gets everything
+    asyncFlash.begin(tskIDLE_PRIORITY + 1);
+    Log.addOutput(&asyncFlash, THORLOG_LEVEL_WARNING);
+
+    Log.warningln("Boot, reset reason %d", static_cast<int>(esp_reset_reason()));
+    Log.infoln("This INFO message is not stored");
+
+    int counter = 0;
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(5000));
+        Log.warningln("Still running, iteration %d", ++counter);
+        if (counter % 6 == 0) {
+            Log.errorln("Periodic error %d, written to flash at once", counter / 6);
+        }
+    }
+}
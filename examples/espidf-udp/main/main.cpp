@@ -0,0 +1,57 @@
+/*
+  _____ _   _  ___  ____  _     ___   ____
+ |_   _| | | |/ _ \|  _ \| |   / _ \ / ___|
+   | | | |_| | | | | |_) | |  | | | | |  _
+   | | |  _  | |_| |  _ <| |__| |_| | |_| |
+   |_| |_| |_|\___/|_| \_\_____\___/ \____|
+
+ ThorLog ESP-IDF UDP Example
+ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+ Streams the log to a UDP collector as well as the console. Set the
+ network and the collector with idf.py menuconfig, then listen with
+ "nc -ulk 5140" on the collector.
+*/
+
+#include "thorlog.h"
+#include "thorlog_espidf.h"
+#include "thorlog_udp_espidf.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "nvs_flash.h"
+#include "protocol_examples_common.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Send at least every 250 ms, sooner for errors or when the queue fills
+static ThorUdpPrint<64> netLog(CONFIG_EXAMPLE_COLLECTOR_HOST, CONFIG_EXAMPLE_COLLECTOR_PORT, 250);
+
+extern "C" void app_main(void) {
+    Log.begin(THORLOG_LEVEL_VERBOSE, &EspIdfOutput);
+
+#if CONFIG_EXAMPLE_COLLECTOR_SYSLOG
+    netLog.setSyslog("thorlog-example", "udp");
+#endif
+    // Records are queued until the network is up, so nothing from the
+    // connection attempt is lost
+    netLog.begin(tskIDLE_PRIORITY + 1);
+    Log.addOutput(&netLog, THORLOG_LEVEL_INFO);
+
+    ESP_ERROR_CHECK(nvs_flash_init());
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    Log.infoln("Connecting...");
+    if (example_connect() != ESP_OK) {
+        Log.errorln("No network, logging to the console only");
+    }
+
+    Log.noticeln("Sending to %s:%d", CONFIG_EXAMPLE_COLLECTOR_HOST, CONFIG_EXAMPLE_COLLECTOR_PORT);
+    Log.traceln("This TRACE message stays on the console");
+
+    int counter = 0;
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        Log.infoln("Tick %d, link %T, dropped %u", ++counter, netLog.isLinkUp(),
+                   static_cast<unsigned>(netLog.getDropped()));
+    }
+}
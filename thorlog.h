@@ -16,8 +16,13 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 
 #include <inttypes.h>
 #include <stdarg.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <string_view>
+#include <type_traits>
 
 // *************************************************************************
 //  Uncomment line below to fully disable logging, and reduce project size
@@ -39,11 +44,109 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #define THORLOG_LEVEL_TRACE   5
 #define THORLOG_LEVEL_VERBOSE 6
 
+// *************************************************************************
+//  Least severe level that is compiled in. Log calls for less severe levels
+//  compile to nothing, and the runtime level only filters what remains.
+//  For example, to strip trace and verbose calls from a release build:
+//      #define THORLOG_MIN_LEVEL THORLOG_LEVEL_INFO
+//  hexdump(), printLimited() and printSampled() take their level at run
+//  time and drop the levels below it there. Only the THORLOG_<LEVEL>(),
+//  THORLOG_HEXDUMP(), THORLOG_EVERY_MS() and THORLOG_SAMPLE_*() macros at
+//  the bottom of this file skip the evaluation of arguments as well.
+// *************************************************************************
+#ifndef THORLOG_MIN_LEVEL
+#define THORLOG_MIN_LEVEL THORLOG_LEVEL_VERBOSE
+#endif
+
 #define THORLOG_CR "\r"
 #define THORLOG_LF "\n"
 #define THORLOG_NL "\r\n"
 #define THORLOG_VERSION 1_0_0
 
+// *************************************************************************
+//  Record buffer. Each log record (prefix, level tag, message, suffix) is
+//  rendered into a fixed-size stack buffer and handed to the output in a
+//  single write. Records longer than the buffer are either flushed in
+//  several writes (default) or truncated (THORLOG_OVERFLOW_TRUNCATE).
+// *************************************************************************
+#ifndef THORLOG_RECORD_SIZE
+#define THORLOG_RECORD_SIZE 128
+#endif
+
+#define THORLOG_OVERFLOW_FLUSH    0
+#define THORLOG_OVERFLOW_TRUNCATE 1
+
+#ifndef THORLOG_OVERFLOW_POLICY
+#define THORLOG_OVERFLOW_POLICY THORLOG_OVERFLOW_FLUSH
+#endif
+
+// Most return addresses captured for a record, see
+// ThorLogging::setBacktrace()
+#ifndef THORLOG_BACKTRACE_DEPTH
+#define THORLOG_BACKTRACE_DEPTH 8
+#endif
+
+// *************************************************************************
+//  Tags. Each ThorLogger registers its tag once, when it is constructed, and
+//  gets a small id; the level filter then looks the tag's level up by id.
+//  Loggers created after THORLOG_MAX_TAGS tags exist share the global level.
+// *************************************************************************
+#ifndef THORLOG_MAX_TAGS
+#define THORLOG_MAX_TAGS 16
+#endif
+
+#define THORLOG_TAG_NONE 0
+
+static_assert(THORLOG_MAX_TAGS >= 1 && THORLOG_MAX_TAGS <= 254, "THORLOG_MAX_TAGS must be between 1 and 254");
+
+// *************************************************************************
+//  Outputs. Besides the output given to begin(), up to THORLOG_MAX_SINKS - 1
+//  more can be added with addOutput(), each with its own level. A record is
+//  formatted once and written to every output whose level it passes.
+// *************************************************************************
+#ifndef THORLOG_MAX_SINKS
+#define THORLOG_MAX_SINKS 4
+#endif
+
+static_assert(THORLOG_MAX_SINKS >= 1, "THORLOG_MAX_SINKS must be at least 1");
+
+// *************************************************************************
+//  Configuration snapshots. The outputs, prefix, suffix, mode and the other
+//  settings form one block that setters never change in place: they write
+//  a changed copy into a free slot and publish it, and each log call holds
+//  the current block until it is done. THORLOG_CONFIG_SLOTS blocks are
+//  kept, so that setters rarely wait for a free one.
+// *************************************************************************
+#ifndef THORLOG_CONFIG_SLOTS
+#define THORLOG_CONFIG_SLOTS 4
+#endif
+static_assert(THORLOG_CONFIG_SLOTS >= 3 && THORLOG_CONFIG_SLOTS <= 255, "THORLOG_CONFIG_SLOTS must be 3 to 255");
+
+// *************************************************************************
+//  Statistics. Define THORLOG_STATS to count records per level, bytes per
+//  output and the cycles spent in each log call (see ThorLogging::getStats).
+//  Without it the counters and their updates are compiled out. Counters are
+//  kept per core so that cores do not contend for them.
+// *************************************************************************
+#ifndef THORLOG_STATS_CORES
+#define THORLOG_STATS_CORES 2
+#endif
+
+// The cycle histogram has power-of-two buckets: bucket 0 counts calls under
+// 2^THORLOG_STATS_SHIFT cycles, bucket n those from 2^(SHIFT+n-1) up to
+// 2^(SHIFT+n), and the last bucket everything longer
+#define THORLOG_STATS_BUCKETS 16
+#define THORLOG_STATS_SHIFT   6
+
+/**
+ * The character a log level is tagged with: F, E, W, I, T or V
+ */
+inline char thorlog_level_char(int level)
+{
+    static const char levels[] = "FEWITV";
+    return levels[level - 1];
+}
+
 /**
  * Constrain template function - replaces Arduino's constrain macro
  */
@@ -52,6 +155,330 @@ T thorlog_constrain(T val, T min, T max) {
     return (val < min) ? min : ((val > max) ? max : val);
 }
 
+// *************************************************************************
+//  Integer kernels. Each renders a 64-bit value into out, which must have
+//  room for THORLOG_NUMBER_SIZE characters, and returns the number of
+//  characters written (no terminator). ThorRecord, the formatter and the
+//  adapters all use these, so printing a number never goes through printf.
+// *************************************************************************
+#define THORLOG_NUMBER_SIZE 64
+
+/**
+ * Number of significant bits in v, 0 for v == 0
+ */
+inline unsigned thorlog_bit_width(uint64_t v)
+{
+#if defined(__GNUC__)
+    return v ? 64 - static_cast<unsigned>(__builtin_clzll(v)) : 0;
+#else
+    unsigned n = 0;
+    while (v) {
+        ++n;
+        v >>= 1;
+    }
+    return n;
+#endif
+}
+
+/**
+ * Decimal, two digits per division
+ */
+inline size_t thorlog_format_unsigned(char* out, uint64_t v)
+{
+    static const char pairs[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char buffer[20];
+    size_t pos = sizeof(buffer);
+    // 64-bit division is a library call on 32-bit targets; drop to 32-bit
+    // arithmetic as soon as the value fits
+    while (v > 0xFFFFFFFFULL) {
+        uint64_t q = v / 100;
+        pos -= 2;
+        memcpy(buffer + pos, pairs + static_cast<size_t>(v - q * 100) * 2, 2);
+        v = q;
+    }
+    uint32_t w = static_cast<uint32_t>(v);
+    while (w >= 100) {
+        uint32_t q = w / 100;
+        pos -= 2;
+        memcpy(buffer + pos, pairs + (w - q * 100) * 2, 2);
+        w = q;
+    }
+    if (w >= 10) {
+        pos -= 2;
+        memcpy(buffer + pos, pairs + w * 2, 2);
+    } else {
+        buffer[--pos] = static_cast<char>('0' + w);
+    }
+    memcpy(out, buffer + pos, sizeof(buffer) - pos);
+    return sizeof(buffer) - pos;
+}
+
+/**
+ * Signed decimal
+ */
+inline size_t thorlog_format_signed(char* out, int64_t v)
+{
+    if (v < 0) {
+        out[0] = '-';
+        // Negate in unsigned space so INT64_MIN is handled
+        return 1 + thorlog_format_unsigned(out + 1, 0 - static_cast<uint64_t>(v));
+    }
+    return thorlog_format_unsigned(out, static_cast<uint64_t>(v));
+}
+
+/**
+ * Lowercase hexadecimal, zero-padded to at least width digits
+ */
+inline size_t thorlog_format_hex(char* out, uint64_t v, size_t width = 0)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t n = (thorlog_bit_width(v) + 3) / 4;
+    n = (n > width) ? n : ((width < 16) ? width : 16);
+    n = (n > 0) ? n : 1;
+    for (size_t i = n; i-- > 0; v >>= 4) {
+        out[i] = digits[v & 0xF];
+    }
+    return n;
+}
+
+/**
+ * Binary, zero-padded to at least width digits. Emits four digits per
+ * table lookup.
+ */
+inline size_t thorlog_format_bin(char* out, uint64_t v, size_t width = 0)
+{
+    static const char nibbles[] =
+        "00000001001000110100010101100111"
+        "10001001101010111100110111101111";
+    size_t n = thorlog_bit_width(v);
+    n = (n > width) ? n : ((width < 64) ? width : 64);
+    n = (n > 0) ? n : 1;
+    size_t pos = n;
+    for (; pos >= 4; v >>= 4) {
+        pos -= 4;
+        memcpy(out + pos, nibbles + (v & 0xF) * 4, 4);
+    }
+    if (pos > 0) {
+        memcpy(out, nibbles + (v & 0xF) * 4 + (4 - pos), pos);
+    }
+    return n;
+}
+
+/**
+ * An unsigned value in base THORLOG_DEC, THORLOG_HEX or THORLOG_BIN.
+ * Other bases print as decimal.
+ */
+inline size_t thorlog_format_number(char* out, uint64_t v, int base, size_t width = 0)
+{
+    switch (base) {
+        case THORLOG_HEX: return thorlog_format_hex(out, v, width);
+        case THORLOG_BIN: return thorlog_format_bin(out, v, width);
+        default:          return thorlog_format_unsigned(out, v);
+    }
+}
+
+// *************************************************************************
+//  Hex dump kernel. Bytes are read with aligned 32-bit loads where the
+//  buffer allows, so register blocks and IRAM (which fault on byte access)
+//  can be dumped as well, and converted two characters per table lookup.
+// *************************************************************************
+#ifndef THORLOG_HEXDUMP_WIDTH
+#define THORLOG_HEXDUMP_WIDTH 16
+#endif
+
+// Most bytes in one binary hex dump record
+#ifndef THORLOG_HEXDUMP_CHUNK
+#define THORLOG_HEXDUMP_CHUNK 64
+#endif
+
+// "0000: " + 3 characters per byte + group gap + " |" + ASCII + "|"
+#define THORLOG_HEXDUMP_LINE_SIZE (8 + 2 + THORLOG_HEXDUMP_WIDTH * 4 + THORLOG_HEXDUMP_WIDTH / 8 + 3)
+
+typedef uint32_t __attribute__((__may_alias__)) thorlog_word_t;
+
+/**
+ * Copy size bytes from data to out, reading aligned words where possible.
+ */
+inline void thorlog_read_bytes(uint8_t* out, const uint8_t* data, size_t size)
+{
+    size_t i = 0;
+    for (; i < size && (reinterpret_cast<uintptr_t>(data + i) & 3) != 0; ++i) {
+        out[i] = data[i];
+    }
+    for (; i + 4 <= size; i += 4) {
+        thorlog_word_t w = *reinterpret_cast<const volatile thorlog_word_t*>(data + i);
+        memcpy(out + i, &w, 4);
+    }
+    for (; i < size; ++i) {
+        out[i] = data[i];
+    }
+}
+
+/**
+ * One line of a hex dump of up to THORLOG_HEXDUMP_WIDTH bytes:
+ *
+ *     0010: 48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 0a 00 ff  |Hello, world!...|
+ *
+ * \param out - at least THORLOG_HEXDUMP_LINE_SIZE bytes
+ * \param offset - offset printed at the start of the line
+ * \param digits - width of the offset, 4 or 8
+ * \return the number of characters written
+ */
+inline size_t thorlog_format_dump_line(char* out, size_t offset, size_t digits, const uint8_t* data, size_t size)
+{
+    static const char pairs[] =
+        "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+        "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+        "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+        "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+        "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+        "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+        "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+        "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+    uint8_t bytes[THORLOG_HEXDUMP_WIDTH];
+    size = (size < THORLOG_HEXDUMP_WIDTH) ? size : THORLOG_HEXDUMP_WIDTH;
+    thorlog_read_bytes(bytes, data, size);
+
+    size_t pos = thorlog_format_hex(out, offset, digits);
+    out[pos++] = ':';
+    out[pos++] = ' ';
+    for (size_t i = 0; i < THORLOG_HEXDUMP_WIDTH; ++i) {
+        if (i > 0 && (i & 7) == 0) {
+            out[pos++] = ' ';
+        }
+        if (i < size) {
+            memcpy(out + pos, pairs + bytes[i] * 2, 2);
+        } else {
+            out[pos] = ' ';
+            out[pos + 1] = ' ';
+        }
+        out[pos + 2] = ' ';
+        pos += 3;
+    }
+    out[pos++] = ' ';
+    out[pos++] = '|';
+    for (size_t i = 0; i < size; ++i) {
+        out[pos++] = (bytes[i] >= 0x20 && bytes[i] < 0x7F) ? static_cast<char>(bytes[i]) : '.';
+    }
+    out[pos++] = '|';
+    return pos;
+}
+
+// *************************************************************************
+//  Floating point kernels. Fixed-point rendering with 0 to
+//  THORLOG_MAX_PRECISION fraction digits, rounded half up; values too large
+//  for a 64-bit integer part are printed as d.ddde+N. The same rules as the
+//  integer kernels apply to out.
+// *************************************************************************
+#define THORLOG_MAX_PRECISION     9
+#define THORLOG_DEFAULT_PRECISION 2
+
+inline constexpr uint32_t thorlog_pow10[THORLOG_MAX_PRECISION + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/**
+ * '.' followed by frac as exactly precision digits
+ */
+inline size_t thorlog_format_fraction(char* out, uint32_t frac, unsigned precision)
+{
+    out[0] = '.';
+    for (unsigned i = precision; i > 0; --i) {
+        out[i] = static_cast<char>('0' + frac % 10);
+        frac /= 10;
+    }
+    return precision + 1;
+}
+
+inline size_t thorlog_format_double(char* out, double v, unsigned precision = THORLOG_DEFAULT_PRECISION)
+{
+    precision = (precision < THORLOG_MAX_PRECISION) ? precision : THORLOG_MAX_PRECISION;
+    size_t n = 0;
+    if (v != v) {
+        memcpy(out, "nan", 3);
+        return 3;
+    }
+    if (v < 0) {
+        out[n++] = '-';
+        v = -v;
+    }
+    if (v > 1.7976931348623157e308) {
+        memcpy(out + n, "inf", 3);
+        return n + 3;
+    }
+    unsigned exponent = 0;
+    if (v >= 1e19) {
+        while (v >= 10) {
+            v /= 10;
+            ++exponent;
+        }
+    }
+    uint64_t whole = static_cast<uint64_t>(v);
+    uint32_t scale = thorlog_pow10[precision];
+    uint32_t frac = static_cast<uint32_t>((v - static_cast<double>(whole)) * scale + 0.5);
+    if (frac >= scale) {
+        ++whole;
+        frac -= scale;
+    }
+    n += thorlog_format_unsigned(out + n, whole);
+    if (precision > 0) {
+        n += thorlog_format_fraction(out + n, frac, precision);
+    }
+    if (exponent > 0) {
+        out[n++] = 'e';
+        out[n++] = '+';
+        n += thorlog_format_unsigned(out + n, exponent);
+    }
+    return n;
+}
+
+/**
+ * Float fast path: stays in single precision, which the ESP32 FPU does in
+ * hardware while double arithmetic is emulated. Values whose integer part
+ * does not fit 32 bits, NaN and infinity go through the double kernel.
+ */
+inline size_t thorlog_format_float(char* out, float v, unsigned precision = THORLOG_DEFAULT_PRECISION)
+{
+    if (!(v < 4294967296.0f && v > -4294967296.0f)) {
+        return thorlog_format_double(out, v, precision);
+    }
+    precision = (precision < THORLOG_MAX_PRECISION) ? precision : THORLOG_MAX_PRECISION;
+    size_t n = 0;
+    if (v < 0) {
+        out[n++] = '-';
+        v = -v;
+    }
+    uint32_t whole = static_cast<uint32_t>(v);
+    uint32_t scale = thorlog_pow10[precision];
+    // Round on the exact remainder; adding 0.5f first would itself round
+    float scaled = (v - static_cast<float>(whole)) * static_cast<float>(scale);
+    uint32_t frac = static_cast<uint32_t>(scaled);
+    frac += (scaled - static_cast<float>(frac) >= 0.5f) ? 1 : 0;
+    if (frac >= scale) {
+        ++whole;
+        frac -= scale;
+    }
+    n += thorlog_format_unsigned(out + n, whole);
+    if (precision > 0) {
+        n += thorlog_format_fraction(out + n, frac, precision);
+    }
+    return n;
+}
+
+/**
+ * ThorSinkStats - What an output reports about itself for ThorLogging::getStats()
+ */
+struct ThorSinkStats {
+    uint32_t dropped;    // records the output lost (bytes for ThorStoragePrint)
+    uint32_t highWater;  // most records that were queued at once
+    uint32_t capacity;   // records that can be queued; 0 if the output has no queue
+};
+
 /**
  * ThorPrint - Abstract base class for print output
  * Replaces Arduino's Print class for ESP-IDF compatibility
@@ -66,201 +493,4629 @@ public:
     virtual size_t print(long num, int base = 10) = 0;
     virtual size_t print(unsigned long num, int base = 10) = 0;
     virtual size_t print(double num) = 0;
+
+    /**
+     * Write a block of characters. The default implementation falls back to
+     * print(char); adapters should override this with a bulk write.
+     */
+    virtual size_t write(const char* buffer, size_t size) {
+        size_t n = 0;
+        for (size_t i = 0; i < size; ++i) {
+            n += print(buffer[i]);
+        }
+        return n;
+    }
+
+    /**
+     * Write a finished log record, or one part of a record longer than
+     * THORLOG_RECORD_SIZE, together with its log level. level is
+     * THORLOG_LEVEL_SILENT when it is not known. Sinks that act on the
+     * level (sync on FATAL, drop verbose records first) override this;
+     * the default calls write().
+     */
+    virtual size_t writeRecord(const char* buffer, size_t size, int level) {
+        (void)level;
+        return write(buffer, size);
+    }
+
+    /**
+     * Report drops and queue depth. Outputs that buffer or can lose
+     * records override this; the default has nothing to report.
+     *
+     * \return false if the output keeps no statistics
+     */
+    virtual bool getStats(ThorSinkStats* stats) const {
+        (void)stats;
+        return false;
+    }
+
+    /**
+     * Write out the records the output holds back and wait until they
+     * have left it. ThorLogging calls this for records at its sync level
+     * and from flush(). Outputs that buffer override this; the default has
+     * nothing to do. Not for interrupt handlers.
+     *
+     * \return false if some records could not be written
+     */
+    virtual bool flush() {
+        return true;
+    }
 };
 
 typedef void (*printfunction)(ThorPrint*, int);
+typedef uint64_t (*timefunction)();
+typedef bool (*contextfunction)();
+typedef const char* (*taskfunction)();
+typedef int (*corefunction)();
+typedef size_t (*backtracefunction)(uintptr_t* frames, size_t max);
+typedef void (*yieldfunction)();
+
+// *************************************************************************
+//  Scoped context. ThorContext guards add key/value pairs to the calling
+//  task's context, and every text and JSON record the task logs carries
+//  them. Each pair is rendered once, when the guard is made, in both
+//  forms; a record copies the rendered bytes. Pairs that do not fit into
+//  THORLOG_CONTEXT_SIZE bytes are left out.
+// *************************************************************************
+#ifndef THORLOG_CONTEXT_SIZE
+#define THORLOG_CONTEXT_SIZE 64
+#endif
+
+static_assert(THORLOG_CONTEXT_SIZE >= 1 && THORLOG_CONTEXT_SIZE <= 65535,
+              "THORLOG_CONTEXT_SIZE must be between 1 and 65535");
+
+struct ThorTaskContext {
+    uint16_t textLen;
+    uint16_t jsonLen;
+    char text[THORLOG_CONTEXT_SIZE];  // "conn=42 "
+    char json[THORLOG_CONTEXT_SIZE];  // ",\"conn\":42"
+};
+
+// The calling task's context; with create false, nullptr if the task has
+// none yet
+typedef ThorTaskContext* (*taskcontextfunction)(bool create);
+
+// Built-in timestamp at the start of each text record, see
+// ThorLogging::setTimestamp()
+#define THORLOG_TIMESTAMP_NONE   0
+#define THORLOG_TIMESTAMP_US     1  // microseconds from the time source
+#define THORLOG_TIMESTAMP_MS     2  // milliseconds from the time source
+#define THORLOG_TIMESTAMP_CYCLES 3  // raw count from a cycle counter
 
 /**
- * ThorLogging is a minimalistic framework to help the programmer output log statements to an output of choice,
- * fashioned after extensive logging libraries such as log4cpp, log4j and log4net. In case of problems with an
- * application, it is helpful to enable logging so that the problem can be located. ThorLogging is designed so
- * that log statements can remain in the code with minimal performance cost. In order to facilitate this the
- * loglevel can be adjusted, and (if your code is completely tested) all logging code can be compiled out.
- *
- * ---- Wildcards
- *
- * %s   display as string (char*)
- * %c   display as single character
- * %C   display as single character or as hexadecimal value (prefixed by `0x`) if not a printable character
- * %d   display as integer value
- * %l   display as long value
- * %u   display as unsigned long value
- * %x   display as hexadecimal value
- * %X   display as hexadecimal value prefixed by `0x` and leading zeros
- * %b   display as binary number
- * %B   display as binary number, prefixed by `0b`
- * %t   display as boolean value "t" or "f"
- * %T   display as boolean value "true" or "false"
- * %D,%F display as double value
- * %p   display pointer address
+ * ThorRecord - Fixed-size buffer that a single log record is rendered into
  *
- * ---- Loglevels
+ * ThorRecord is itself a ThorPrint, so prefix and suffix functions write into
+ * the record rather than straight to the output. commit() hands the finished
+ * record to the output in one write() call. No memory is allocated.
  *
- * 0 - THORLOG_LEVEL_SILENT     no output
- * 1 - THORLOG_LEVEL_FATAL      fatal errors
- * 2 - THORLOG_LEVEL_ERROR      all errors
- * 3 - THORLOG_LEVEL_WARNING    errors and warnings
- * 4 - THORLOG_LEVEL_INFO       errors, warnings and notices
- * 4 - THORLOG_LEVEL_NOTICE     Same as INFO, kept for backward compatibility
- * 5 - THORLOG_LEVEL_TRACE      errors, warnings, notices, traces
- * 6 - THORLOG_LEVEL_VERBOSE    all
+ * When the buffer fills up, THORLOG_OVERFLOW_POLICY decides what happens:
+ * THORLOG_OVERFLOW_FLUSH writes the buffered part out and keeps going, so
+ * nothing is lost but the record reaches the output in several writes.
+ * THORLOG_OVERFLOW_TRUNCATE drops the rest of the record and marks the cut
+ * with a trailing '~'.
  */
-
-class ThorLogging
-{
+class ThorRecord : public ThorPrint {
 public:
     /**
-     * default Constructor
+     * \param output - where commit() sends the record
+     * \param level - log level passed on to output->writeRecord()
      */
-    ThorLogging()
-#ifndef THORLOG_DISABLE_LOGGING
-        : _level(THORLOG_LEVEL_SILENT),
-          _showLevel(true),
-          _logOutput(nullptr)
-#endif
+    explicit ThorRecord(ThorPrint* output, int level = THORLOG_LEVEL_SILENT)
+        : _output(output), _level(level), _len(0), _sent(0), _truncated(false)
     {
     }
 
-    /**
-     * Initializing, must be called as first. Note that if you use
-     * this variant of Init, you need to initialize the baud rate
-     * yourself, if printer happens to be a serial port.
-     *
-     * \param level - logging levels <= this will be logged.
-     * \param output - place that logging output will be sent to.
-     * \param showLevel - whether to show the log level prefix.
-     * \return void
-     */
-    void begin(int level, ThorPrint *output, bool showLevel = true)
-    {
-#ifndef THORLOG_DISABLE_LOGGING
-        _level = thorlog_constrain(level, THORLOG_LEVEL_SILENT, THORLOG_LEVEL_VERBOSE);
-        _showLevel = showLevel;
-        _logOutput = output;
+    size_t print(char c) override {
+        return write(&c, 1);
+    }
+
+    size_t print(const char* str) override {
+        if (str == nullptr) {
+            return 0;
+        }
+        return write(str, strlen(str));
+    }
+
+    // Negative numbers print in hex and binary as the two's complement of
+    // their own width
+    size_t print(int num, int base = THORLOG_DEC) override {
+        return (base == THORLOG_HEX || base == THORLOG_BIN) ? printUnsigned(static_cast<unsigned int>(num), base)
+                                                            : printSigned(num);
+    }
+
+    size_t print(unsigned int num, int base = THORLOG_DEC) override {
+        return printUnsigned(num, base);
+    }
+
+    size_t print(long num, int base = THORLOG_DEC) override {
+        return (base == THORLOG_HEX || base == THORLOG_BIN) ? printUnsigned(static_cast<unsigned long>(num), base)
+                                                            : printSigned(num);
+    }
+
+    size_t print(unsigned long num, int base = THORLOG_DEC) override {
+        return printUnsigned(num, base);
+    }
+
+    size_t print(double num) override {
+        return printDouble(num);
+    }
+
+    size_t write(const char* buffer, size_t size) override {
+        size_t written = 0;
+        while (size > 0) {
+            size_t room = sizeof(_buffer) - _len;
+            if (room == 0) {
+#if THORLOG_OVERFLOW_POLICY == THORLOG_OVERFLOW_TRUNCATE
+                _truncated = true;
+                return written;
+#else
+                send();
+                room = sizeof(_buffer);
 #endif
+            }
+            size_t n = (size < room) ? size : room;
+            memcpy(_buffer + _len, buffer, n);
+            _len += n;
+            buffer += n;
+            size -= n;
+            written += n;
+        }
+        return written;
     }
 
     /**
-     * Set the log level.
+     * Send the buffered record to the output.
      *
-     * \param level - The new log level.
-     * \return void
+     * \param terminator - optional line ending, kept even when the record
+     *                     was truncated.
      */
-    void setLevel(int level)
-    {
-#ifndef THORLOG_DISABLE_LOGGING
-        _level = thorlog_constrain(level, THORLOG_LEVEL_SILENT, THORLOG_LEVEL_VERBOSE);
-#endif
+    void commit(const char* terminator = nullptr) {
+        size_t termLen = (terminator != nullptr) ? strlen(terminator) : 0;
+        if (_truncated || (termLen > sizeof(_buffer) - _len && THORLOG_OVERFLOW_POLICY == THORLOG_OVERFLOW_TRUNCATE)) {
+            termLen = thorlog_constrain<size_t>(termLen, 0, sizeof(_buffer) - 1);
+            _len = sizeof(_buffer) - termLen;
+            _buffer[_len - 1] = '~';
+            if (termLen > 0) {
+                memcpy(_buffer + _len, terminator, termLen);
+                _len += termLen;
+            }
+        } else if (termLen > 0) {
+            write(terminator, termLen);
+        }
+        send();
     }
 
     /**
-     * Get the log level.
-     *
-     * \return The current log level.
+     * Append a signed 64-bit number in decimal.
      */
-    int getLevel() const
-    {
-#ifndef THORLOG_DISABLE_LOGGING
-        return _level;
-#else
-        return THORLOG_LEVEL_SILENT;
-#endif
+    size_t printSigned(int64_t num) {
+        return render([num](char* out) { return thorlog_format_signed(out, num); });
     }
 
     /**
-     * Set whether to show the log level.
+     * Append an unsigned 64-bit number.
      *
-     * \param showLevel - true if the log level should be shown for each log
-     *                    false otherwise.
-     * \return void
+     * \param base - THORLOG_DEC, THORLOG_HEX or THORLOG_BIN
+     * \param width - minimum number of digits for hex and binary; shorter
+     *                numbers are padded with zeros
      */
-    void setShowLevel(bool showLevel)
+    size_t printUnsigned(uint64_t num, int base = THORLOG_DEC, size_t width = 0) {
+        return render([num, base, width](char* out) { return thorlog_format_number(out, num, base, width); });
+    }
+
+    /**
+     * Append a double with precision fraction digits.
+     */
+    size_t printDouble(double num, unsigned precision = THORLOG_DEFAULT_PRECISION) {
+        return render([num, precision](char* out) { return thorlog_format_double(out, num, precision); });
+    }
+
+    /**
+     * Append a float with precision fraction digits, without promoting it.
+     */
+    size_t printFloat(float num, unsigned precision = THORLOG_DEFAULT_PRECISION) {
+        return render([num, precision](char* out) { return thorlog_format_float(out, num, precision); });
+    }
+
+    size_t length() const { return _len; }
+    const char* data() const { return _buffer; }
+
+    // Bytes handed to the output so far
+    size_t sent() const { return _sent; }
+
+private:
+    void send() {
+        if (_len > 0 && _output != nullptr) {
+            _output->writeRecord(_buffer, _len, _level);
+        }
+        _sent += _len;
+        _len = 0;
+    }
+
+    // Run a kernel straight into the buffer when the longest number fits,
+    // and through write() (which applies the overflow policy) otherwise
+    template <typename F>
+    size_t render(F kernel) {
+        if (sizeof(_buffer) - _len >= THORLOG_NUMBER_SIZE) {
+            size_t n = kernel(_buffer + _len);
+            _len += n;
+            return n;
+        }
+        char buffer[THORLOG_NUMBER_SIZE];
+        return write(buffer, kernel(buffer));
+    }
+
+    ThorPrint* _output;
+    int _level;
+    size_t _len;
+    size_t _sent;
+    bool _truncated;
+    char _buffer[THORLOG_RECORD_SIZE];
+};
+
+/**
+ * ThorWritePrint - Base class for outputs that only implement write()
+ *
+ * Characters and strings are passed to write() directly; numbers are
+ * rendered with ThorRecord first. Sinks that wrap other outputs (async,
+ * storage, network) derive from this.
+ */
+class ThorWritePrint : public ThorPrint {
+public:
+    size_t print(char c) override { return write(&c, 1); }
+    size_t print(const char* str) override { return (str != nullptr) ? write(str, strlen(str)) : 0; }
+    size_t print(int num, int base = THORLOG_DEC) override { return printNumber(num, base); }
+    size_t print(unsigned int num, int base = THORLOG_DEC) override { return printNumber(num, base); }
+    size_t print(long num, int base = THORLOG_DEC) override { return printNumber(num, base); }
+    size_t print(unsigned long num, int base = THORLOG_DEC) override { return printNumber(num, base); }
+    size_t print(double num) override { return printNumber(num, 0); }
+
+    size_t write(const char* buffer, size_t size) override = 0;
+
+private:
+    template <typename T>
+    size_t printNumber(T num, int base) {
+        ThorRecord record(this);
+        size_t n;
+        if constexpr (std::is_floating_point<T>::value) {
+            n = record.print(num);
+        } else {
+            n = record.print(num, base);
+        }
+        record.commit();
+        return n;
+    }
+};
+
+/**
+ * ThorArg - A log argument with its type kept
+ *
+ * The level methods capture their arguments as ThorArg values instead of
+ * passing them through C varargs, so the formatter knows the type and size
+ * of every argument and a mismatched specifier cannot read past the end of
+ * the argument list.
+ */
+struct ThorArg {
+    enum Type : uint8_t {
+        NONE,
+        INT,
+        UINT,
+        DOUBLE,
+        STRING,
+        POINTER,
+        FLOAT
+    };
+
+    // len of a STRING whose length is not known up front
+    static constexpr uint32_t NUL_TERMINATED = 0xFFFFFFFFUL;
+
+    Type type;
+    uint8_t size;  // sizeof() the original argument
+    uint32_t len;  // STRING only: number of characters, or NUL_TERMINATED
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        float f;
+        const char* s;
+        const void* p;
+    };
+
+    long toLong() const {
+        return isFloating() ? static_cast<long>(toDouble()) : static_cast<long>(i);
+    }
+
+    unsigned long toULong() const {
+        return isFloating() ? static_cast<unsigned long>(toDouble()) : static_cast<unsigned long>(u);
+    }
+
+    int64_t toInt64() const {
+        return isFloating() ? static_cast<int64_t>(toDouble()) : i;
+    }
+
+    /**
+     * The value as an unsigned number of the argument's own width, so a
+     * negative int prints as 32 bits in hex and binary, not 64.
+     */
+    uint64_t toUInt64() const {
+        if (isFloating()) return static_cast<uint64_t>(toDouble());
+        if (type == INT && size < sizeof(uint64_t)) return u & ((static_cast<uint64_t>(1) << (size * 8)) - 1);
+        return u;
+    }
+
+    bool isFloating() const {
+        return type == DOUBLE || type == FLOAT;
+    }
+
+    double toDouble() const {
+        if (type == DOUBLE) return d;
+        if (type == FLOAT) return f;
+        return (type == INT) ? static_cast<double>(i) : static_cast<double>(u);
+    }
+
+    const char* toString() const {
+        return (type == STRING) ? s : nullptr;
+    }
+};
+
+template <typename>
+struct thorlog_dependent_false : std::false_type {};
+
+/**
+ * The ThorArg type an argument of type T is stored as.
+ */
+template <typename T>
+constexpr ThorArg::Type thorlog_arg_type()
+{
+    typedef typename std::decay<T>::type U;
+    if constexpr (std::is_enum<U>::value) {
+        return thorlog_arg_type<typename std::underlying_type<U>::type>();
+    } else if constexpr (std::is_same<U, bool>::value) {
+        return ThorArg::UINT;
+    } else if constexpr (std::is_integral<U>::value) {
+        return std::is_signed<U>::value ? ThorArg::INT : ThorArg::UINT;
+    } else if constexpr (std::is_same<U, float>::value) {
+        return ThorArg::FLOAT;
+    } else if constexpr (std::is_floating_point<U>::value) {
+        return ThorArg::DOUBLE;
+    } else if constexpr (std::is_same<U, char*>::value || std::is_same<U, const char*>::value ||
+                         std::is_same<U, std::string_view>::value) {
+        return ThorArg::STRING;
+    } else if constexpr (std::is_pointer<U>::value || std::is_same<U, std::nullptr_t>::value) {
+        return ThorArg::POINTER;
+    } else {
+        static_assert(thorlog_dependent_false<T>::value, "ThorLog: unsupported argument type");
+        return ThorArg::NONE;
+    }
+}
+
+template <typename T>
+inline ThorArg thorlog_make_arg(T value)
+{
+    typedef typename std::decay<T>::type U;
+    ThorArg arg;
+    arg.type = thorlog_arg_type<T>();
+    arg.size = static_cast<uint8_t>(sizeof(U));
+    arg.len = ThorArg::NUL_TERMINATED;
+    arg.u = 0;
+    if constexpr (std::is_enum<U>::value) {
+        return thorlog_make_arg(static_cast<typename std::underlying_type<U>::type>(value));
+    } else if constexpr (std::is_integral<U>::value) {
+        if (arg.type == ThorArg::INT) {
+            arg.i = static_cast<int64_t>(value);
+        } else {
+            arg.u = static_cast<uint64_t>(value);
+        }
+    } else if constexpr (std::is_same<U, float>::value) {
+        arg.f = value;
+    } else if constexpr (std::is_floating_point<U>::value) {
+        arg.d = static_cast<double>(value);
+    } else if constexpr (std::is_same<U, std::nullptr_t>::value) {
+        arg.p = nullptr;
+    } else if constexpr (std::is_same<U, char*>::value || std::is_same<U, const char*>::value) {
+        arg.s = value;
+    } else if constexpr (std::is_same<U, std::string_view>::value) {
+        // Referenced, not copied: the characters are written straight from
+        // the caller's buffer, and need no NUL
+        arg.s = value.data();
+        arg.len = (value.size() < ThorArg::NUL_TERMINATED) ? static_cast<uint32_t>(value.size())
+                                                           : ThorArg::NUL_TERMINATED - 1;
+    } else {
+        arg.p = static_cast<const void*>(value);
+    }
+    return arg;
+}
+
+/**
+ * A %s argument for size characters at data, which need not be
+ * NUL-terminated, such as a slice of a receive buffer:
+ *
+ *     ThorLog.traceln("cmd=%s", thorlog_str(rx + start, len));
+ *
+ * std::string_view arguments are taken as they are.
+ */
+inline std::string_view thorlog_str(const char* data, size_t size)
+{
+    return std::string_view(data, size);
+}
+
+inline std::string_view thorlog_str(const uint8_t* data, size_t size)
+{
+    return std::string_view(reinterpret_cast<const char*>(data), size);
+}
+
+// *************************************************************************
+//  Compile-time format strings
+//
+//  THORLOG_FMT("...") wraps a string literal in a type that carries the
+//  literal, so the level methods can split it into literal runs and
+//  conversions at compile time, check each conversion against its
+//  argument, and emit straight-line code without scanning the format:
+//
+//      ThorLog.infoln(THORLOG_FMT("rpm=%d temp=%D"), rpm, temp);
+// *************************************************************************
+
+struct ThorFormatString {};
+
+#define THORLOG_FMT(str) \
+    ([] { \
+        THORLOG_INTERN_ENTRY(str); \
+        struct ThorFmt : ThorFormatString { \
+            static constexpr const char* c_str() { return str; } \
+            static constexpr size_t size() { return sizeof(str) - 1; } \
+        }; \
+        return ThorFmt{}; \
+    }())
+
+// *************************************************************************
+//  Interned format strings
+//
+//  With THORLOG_INTERN set to THORLOG_INTERN_ID, each THORLOG_FMT literal
+//  gets a numeric ID: a FNV-1a hash of its text, folded to
+//  THORLOG_INTERN_BITS bits, so it stays the same from build to build for
+//  as long as the text does. Binary records carry the ID
+//  (THORLOG_BINARY_FLAG_ID) instead of the literal's address. The literal is
+//  also copied into the THORLOG_INTERN_SECTION ELF section, which is not
+//  loaded onto the device; tools/thorlog_decode looks the IDs up there, or
+//  in the dictionary file it writes with --dict.
+//
+//  THORLOG_INTERN_STRIP goes further and leaves the literals out of the
+//  firmware image. Text mode, and records formatted on the device
+//  (ThorIsrPrint, ThorRtcPrint), then show the ID and the arguments:
+//  "I: #3f09c2 12 sensor".
+//
+//  With interning on, the THORLOG_INFO() ... macros wrap their format in
+//  THORLOG_FMT(), so it must be a string literal there. Other calls are
+//  interned where they use THORLOG_FMT(). Structured (kv) records keep the
+//  event name's address.
+// *************************************************************************
+
+#define THORLOG_INTERN_OFF   0
+#define THORLOG_INTERN_ID    1
+#define THORLOG_INTERN_STRIP 2
+
+#ifndef THORLOG_INTERN
+#define THORLOG_INTERN THORLOG_INTERN_OFF
+#endif
+
+// IDs are written as varints; 24 bits take at most 4 bytes against 5 for a
+// flash address, and collisions (which the decoder reports) stay unlikely
+// for a few thousand strings
+#ifndef THORLOG_INTERN_BITS
+#define THORLOG_INTERN_BITS 24
+#endif
+
+static_assert(THORLOG_INTERN_BITS >= 16 && THORLOG_INTERN_BITS <= 32, "THORLOG_INTERN_BITS must be between 16 and 32");
+
+// The section has no flags, so it is not allocated and stays out of the
+// image. Each entry is a byte holding THORLOG_INTERN_BITS followed by the
+// NUL-terminated text; the same literal may appear more than once.
+#ifndef THORLOG_INTERN_SECTION
+#define THORLOG_INTERN_SECTION ".thorlog_dict,\"\""
+#endif
+
+#define THORLOG_STRINGIFY_(x) #x
+#define THORLOG_STRINGIFY(x)  THORLOG_STRINGIFY_(x)
+
+// Emitted with asm because GCC ignores the section attribute on variables
+// in templates; stringizing escapes the literal for the assembler
+#if THORLOG_INTERN != THORLOG_INTERN_OFF
+#define THORLOG_INTERN_ENTRY(str) \
+    __asm__ __volatile__(".pushsection " THORLOG_INTERN_SECTION "\n" \
+                         ".byte " THORLOG_STRINGIFY(THORLOG_INTERN_BITS) "\n" \
+                         ".asciz " THORLOG_STRINGIFY(str) "\n" \
+                         ".popsection")
+#else
+#define THORLOG_INTERN_ENTRY(str)
+#endif
+
+// FNV-1a, also used to hash arguments for rate limiting
+#define THORLOG_FNV_OFFSET 2166136261UL
+#define THORLOG_FNV_PRIME  16777619UL
+
+/**
+ * ID of an interned format string: FNV-1a of its text, xor-folded to
+ * THORLOG_INTERN_BITS bits.
+ */
+constexpr uint32_t thorlog_intern_id(const char* text, size_t size, unsigned bits = THORLOG_INTERN_BITS)
+{
+    uint32_t hash = THORLOG_FNV_OFFSET;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(text[i])) * THORLOG_FNV_PRIME;
+    }
+    return (bits < 32) ? (hash >> bits) ^ (hash & ((1UL << bits) - 1)) : hash;
+}
+
+/**
+ * Result of checking a compile-time format string against its arguments.
+ */
+enum ThorFormatCheck {
+    THORLOG_FORMAT_OK,
+    THORLOG_FORMAT_TOO_FEW_ARGS,
+    THORLOG_FORMAT_TOO_MANY_ARGS,
+    THORLOG_FORMAT_UNKNOWN_SPECIFIER,
+    THORLOG_FORMAT_TYPE_MISMATCH
+};
+
+/**
+ * Index of the next '%' in format at or after pos, or size if none.
+ */
+constexpr size_t thorlog_next_specifier(const char* format, size_t size, size_t pos)
+{
+    while (pos < size && format[pos] != '%') {
+        ++pos;
+    }
+    return pos;
+}
+
+/**
+ * Index of the conversion character of the specifier whose '%' is at pos,
+ * skipping an optional ".precision".
+ */
+constexpr size_t thorlog_specifier_conversion(const char* format, size_t size, size_t pos)
+{
+    ++pos;
+    if (pos < size && format[pos] == '.') {
+        ++pos;
+        while (pos < size && format[pos] >= '0' && format[pos] <= '9') {
+            ++pos;
+        }
+    }
+    return pos;
+}
+
+/**
+ * Precision of the specifier whose '%' is at pos, or -1 if it has none.
+ */
+constexpr int thorlog_specifier_precision(const char* format, size_t size, size_t pos)
+{
+    if (pos + 1 >= size || format[pos + 1] != '.') {
+        return -1;
+    }
+    int precision = 0;
+    for (pos += 2; pos < size && format[pos] >= '0' && format[pos] <= '9'; ++pos) {
+        if (precision <= THORLOG_MAX_PRECISION) {
+            precision = precision * 10 + (format[pos] - '0');
+        }
+    }
+    return precision;
+}
+
+/**
+ * Whether an argument of the given type and size may be used with spec.
+ */
+constexpr ThorFormatCheck thorlog_check_specifier(char spec, ThorArg::Type type, size_t size)
+{
+    const bool integral = (type == ThorArg::INT || type == ThorArg::UINT);
+    switch (spec) {
+        case 's':
+            return (type == ThorArg::STRING) ? THORLOG_FORMAT_OK : THORLOG_FORMAT_TYPE_MISMATCH;
+        case 'c': case 'C': case 'd': case 'i': case 't': case 'T':
+            return (integral && size <= sizeof(int)) ? THORLOG_FORMAT_OK : THORLOG_FORMAT_TYPE_MISMATCH;
+        case 'l': case 'u': case 'x': case 'X': case 'b': case 'B':
+            return (integral && size <= sizeof(uint64_t)) ? THORLOG_FORMAT_OK : THORLOG_FORMAT_TYPE_MISMATCH;
+        case 'D': case 'F':
+            return (type == ThorArg::DOUBLE || type == ThorArg::FLOAT) ? THORLOG_FORMAT_OK : THORLOG_FORMAT_TYPE_MISMATCH;
+        case 'p':
+            return (type == ThorArg::POINTER || type == ThorArg::STRING) ? THORLOG_FORMAT_OK : THORLOG_FORMAT_TYPE_MISMATCH;
+        default:
+            return THORLOG_FORMAT_UNKNOWN_SPECIFIER;
+    }
+}
+
+template <class F, typename... Args>
+constexpr ThorFormatCheck thorlog_check_format()
+{
+    constexpr ThorArg::Type types[] = { thorlog_arg_type<Args>()..., ThorArg::NONE };
+    constexpr size_t sizes[] = { sizeof(typename std::decay<Args>::type)..., 0 };
+    const char* format = F::c_str();
+    size_t arg = 0;
+    for (size_t pos = thorlog_next_specifier(format, F::size(), 0); pos < F::size();
+         pos = thorlog_next_specifier(format, F::size(), thorlog_specifier_conversion(format, F::size(), pos) + 1)) {
+        size_t conversion = thorlog_specifier_conversion(format, F::size(), pos);
+        if (conversion >= F::size()) {
+            return THORLOG_FORMAT_UNKNOWN_SPECIFIER;
+        }
+        char spec = format[conversion];
+        // A precision is only meaningful for %D and %F
+        if (thorlog_specifier_precision(format, F::size(), pos) >= 0 && spec != 'D' && spec != 'F') {
+            return THORLOG_FORMAT_UNKNOWN_SPECIFIER;
+        }
+        if (spec == '%') {
+            continue;
+        }
+        if (arg >= sizeof...(Args)) {
+            return THORLOG_FORMAT_TOO_FEW_ARGS;
+        }
+        ThorFormatCheck check = thorlog_check_specifier(spec, types[arg], sizes[arg]);
+        if (check != THORLOG_FORMAT_OK) {
+            return check;
+        }
+        ++arg;
+    }
+    return (arg == sizeof...(Args)) ? THORLOG_FORMAT_OK : THORLOG_FORMAT_TOO_MANY_ARGS;
+}
+
+// *************************************************************************
+//  Binary records
+//
+//  In THORLOG_MODE_BINARY each log call is written as a compact binary
+//  record instead of text. Only the address of the format string and the
+//  raw arguments are sent; tools/thorlog_decode rebuilds the text on the
+//  host from the firmware ELF. All multi-byte fields are little-endian.
+//
+//      byte 0      THORLOG_BINARY_SYNC
+//      byte 1      level (bits 0-2) | THORLOG_BINARY_FLAG_* (bits 3-7)
+//      bytes 2-3   length of the body that follows
+//      body        varint timestamp (microseconds, see setTimeSource)
+//                  varint format string address, or with
+//                      THORLOG_BINARY_FLAG_ID its THORLOG_INTERN ID
+//                  varint tag name address (only with THORLOG_BINARY_FLAG_TAG)
+//                  THORLOG_BINARY_SAMPLE, then the varint number of calls
+//                      skipped (only for sampled records that skipped any)
+//                  THORLOG_BINARY_BACKTRACE, then the varint number of
+//                      return addresses and each address as a varint
+//                      (only with ThorLogging::setBacktrace())
+//                  one entry per argument:
+//                      tag byte: ThorArg::Type << 4 | sizeof(argument)
+//                      INT      zigzag varint
+//                      UINT     varint
+//                      DOUBLE   8 byte IEEE 754
+//                      FLOAT    4 byte IEEE 754
+//                      STRING   varint length, then the characters
+//                      POINTER  varint address
+//
+//  Structured records (THORLOG_BINARY_FLAG_FIELDS) carry the event name in
+//  place of the format string and, instead of the arguments, an
+//  indefinite-length CBOR map (RFC 8949) whose keys are the addresses of
+//  the key strings, as CBOR unsigned integers.
+//
+//  Strings are copied into the record. Arguments that do not fit into
+//  THORLOG_RECORD_SIZE are dropped and THORLOG_BINARY_FLAG_TRUNCATED is set.
+// *************************************************************************
+
+#define THORLOG_MODE_TEXT   0
+#define THORLOG_MODE_BINARY 1
+
+#define THORLOG_BINARY_SYNC           0xA5
+#define THORLOG_BINARY_HEADER_SIZE    4
+#define THORLOG_BINARY_LEVEL_MASK     0x07
+#define THORLOG_BINARY_FLAG_CR        0x08
+#define THORLOG_BINARY_FLAG_TRUNCATED 0x10
+#define THORLOG_BINARY_FLAG_TAG       0x20
+#define THORLOG_BINARY_FLAG_FIELDS    0x40
+#define THORLOG_BINARY_FLAG_ID        0x80
+
+// Not ThorArg::Type entries, nor the start of a CBOR map
+#define THORLOG_BINARY_SAMPLE         0xF0
+#define THORLOG_BINARY_BACKTRACE      0xF1
+
+// Most arguments decoded from one binary record on the device
+#ifndef THORLOG_BINARY_MAX_ARGS
+#define THORLOG_BINARY_MAX_ARGS 16
+#endif
+
+static_assert(THORLOG_RECORD_SIZE >= 32, "THORLOG_RECORD_SIZE is too small for binary records");
+
+/**
+ * Write v as an unsigned LEB128 varint. Returns the number of bytes used,
+ * or 0 if it does not fit into size bytes.
+ */
+inline size_t thorlog_put_varint(uint8_t* out, size_t size, uint64_t v)
+{
+    size_t n = 0;
+    do {
+        if (n >= size) {
+            return 0;
+        }
+        uint8_t byte = static_cast<uint8_t>(v & 0x7F);
+        v >>= 7;
+        out[n++] = static_cast<uint8_t>(byte | (v ? 0x80 : 0));
+    } while (v);
+    return n;
+}
+
+/**
+ * Read an unsigned LEB128 varint. Returns the number of bytes consumed, or 0
+ * if the data ends before the varint does.
+ */
+inline size_t thorlog_get_varint(const uint8_t* in, size_t size, uint64_t* v)
+{
+    uint64_t result = 0;
+    for (size_t n = 0; n < size && n < 10; ++n) {
+        result |= static_cast<uint64_t>(in[n] & 0x7F) << (7 * n);
+        if ((in[n] & 0x80) == 0) {
+            *v = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Write a CBOR initial byte for major type major and argument v. Returns the
+ * number of bytes used, or 0 if it does not fit into size bytes.
+ */
+inline size_t thorlog_put_cbor_head(uint8_t* out, size_t size, uint8_t major, uint64_t v)
+{
+    size_t extra = (v < 24) ? 0 : (v <= 0xFF) ? 1 : (v <= 0xFFFF) ? 2 : (v <= 0xFFFFFFFFULL) ? 4 : 8;
+    if (size < extra + 1) {
+        return 0;
+    }
+    static const uint8_t info[9] = {0, 24, 25, 0, 26, 0, 0, 0, 27};
+    out[0] = static_cast<uint8_t>((major << 5) | ((extra == 0) ? v : info[extra]));
+    for (size_t i = 0; i < extra; ++i) {
+        out[1 + i] = static_cast<uint8_t>(v >> (8 * (extra - 1 - i)));
+    }
+    return extra + 1;
+}
+
+/**
+ * Read a CBOR initial byte and its argument. Returns the number of bytes
+ * consumed, or 0 if the data ends early or uses an indefinite length.
+ */
+inline size_t thorlog_get_cbor_head(const uint8_t* in, size_t size, uint8_t* major, uint64_t* v)
+{
+    if (size == 0) {
+        return 0;
+    }
+    *major = in[0] >> 5;
+    uint8_t info = in[0] & 0x1F;
+    if (info < 24) {
+        *v = info;
+        return 1;
+    }
+    if (info > 27) {
+        return 0;
+    }
+    size_t extra = static_cast<size_t>(1) << (info - 24);
+    if (size < extra + 1) {
+        return 0;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < extra; ++i) {
+        value = (value << 8) | in[1 + i];
+    }
+    *v = value;
+    return extra + 1;
+}
+
+/**
+ * ThorFormatId - Interned format string ID, written in place of the
+ * format string address (see THORLOG_INTERN)
+ */
+struct ThorFormatId {
+    uint32_t value;
+};
+
+/**
+ * ThorBinaryRecord - Encoder for a single binary record
+ */
+class ThorBinaryRecord {
+public:
+    ThorBinaryRecord(int level, bool cr, uint64_t timestamp, const void* format, const char* tag = nullptr)
+        : _len(THORLOG_BINARY_HEADER_SIZE), _truncated(false), _fields(false)
+    {
+        putHeader(level, cr, timestamp, reinterpret_cast<uintptr_t>(format), 0, tag);
+    }
+
+    ThorBinaryRecord(int level, bool cr, uint64_t timestamp, ThorFormatId format, const char* tag = nullptr)
+        : _len(THORLOG_BINARY_HEADER_SIZE), _truncated(false), _fields(false)
+    {
+        putHeader(level, cr, timestamp, format.value, THORLOG_BINARY_FLAG_ID, tag);
+    }
+
+    /**
+     * Append one argument. Returns false once the record is full; any
+     * further arguments are dropped.
+     */
+    bool add(const ThorArg& arg) {
+        if (_truncated) {
+            return false;
+        }
+        size_t start = _len;
+        if (!putByte(static_cast<uint8_t>((arg.type << 4) | (arg.size & 0x0F)))) {
+            return truncate(start);
+        }
+        bool ok = true;
+        switch (arg.type) {
+            case ThorArg::INT:
+                ok = putVarint((static_cast<uint64_t>(arg.i) << 1) ^ static_cast<uint64_t>(arg.i >> 63));
+                break;
+            case ThorArg::UINT:
+                ok = putVarint(arg.u);
+                break;
+            case ThorArg::DOUBLE:
+                ok = putBytes(&arg.d, sizeof(arg.d));
+                break;
+            case ThorArg::FLOAT:
+                ok = putBytes(&arg.f, sizeof(arg.f));
+                break;
+            case ThorArg::STRING: {
+                // Copy as much of the string as fits; the length is known
+                // only after the copy, so reserve room for a 2 byte varint
+                size_t n = 0;
+                if (arg.s != nullptr) {
+                    size_t room = (sizeof(_buffer) > _len + 2) ? sizeof(_buffer) - _len - 2 : 0;
+                    room = (room > 0x3FFF) ? 0x3FFF : room;
+                    if (arg.len != ThorArg::NUL_TERMINATED) {
+                        n = arg.len;
+                    } else {
+                        while (n <= room && arg.s[n] != '\0') {
+                            ++n;
+                        }
+                    }
+                    if (n > room) {
+                        n = room;
+                        _truncated = true;
+                    }
+                }
+                ok = putVarint(n) && putBytes(arg.s, n);
+                break;
+            }
+            case ThorArg::POINTER:
+                ok = putVarint(reinterpret_cast<uintptr_t>(arg.p));
+                break;
+            default:
+                break;
+        }
+        if (!ok) {
+            return truncate(start);
+        }
+        if (_truncated) {
+            _buffer[1] |= THORLOG_BINARY_FLAG_TRUNCATED;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Record the number of calls a sampled call site skipped before this
+     * one; call before add() or beginFields().
+     */
+    void addSkipped(uint32_t skipped) {
+        size_t start = _len;
+        if (!putByte(THORLOG_BINARY_SAMPLE) || !putVarint(skipped)) {
+            truncate(start);
+        }
+    }
+
+    /**
+     * Record the return addresses of a backtrace; call after addSkipped()
+     * and before add() or beginFields().
+     */
+    void addBacktrace(const uintptr_t* frames, size_t depth) {
+        size_t start = _len;
+        bool ok = putByte(THORLOG_BINARY_BACKTRACE) && putVarint(depth);
+        for (size_t i = 0; ok && i < depth; ++i) {
+            ok = putVarint(frames[i]);
+        }
+        if (!ok) {
+            truncate(start);
+        }
+    }
+
+    /**
+     * Turn the record into a structured one; call before addField().
+     */
+    void beginFields() {
+        if (_len + 2 > sizeof(_buffer)) {
+            truncate(_len);
+            return;
+        }
+        _buffer[1] |= THORLOG_BINARY_FLAG_FIELDS;
+        _buffer[_len++] = 0xBF;  // indefinite-length map
+        _fields = true;
+    }
+
+    /**
+     * Append one key/value pair to a structured record. Returns false once
+     * the record is full; any further fields are dropped.
+     *
+     * \param key - key string; only its address is stored
+     * \param value - the value
+     * \param isBool - true to encode a UINT value as a CBOR boolean
+     */
+    bool addField(const char* key, const ThorArg& value, bool isBool) {
+        if (_truncated || !_fields) {
+            return false;
+        }
+        size_t start = _len;
+        bool ok = putCbor(0, reinterpret_cast<uintptr_t>(key));
+        switch (value.type) {
+            case ThorArg::INT:
+                ok = ok && ((value.i < 0) ? putCbor(1, static_cast<uint64_t>(-(value.i + 1)))
+                                          : putCbor(0, static_cast<uint64_t>(value.i)));
+                break;
+            case ThorArg::UINT:
+                ok = ok && (isBool ? putByte(value.u ? 0xF5 : 0xF4) : putCbor(0, value.u));
+                break;
+            case ThorArg::DOUBLE: {
+                uint64_t bits;
+                memcpy(&bits, &value.d, sizeof(bits));
+                ok = ok && putByte(0xFB) && putBigEndian(bits, 8);
+                break;
+            }
+            case ThorArg::FLOAT: {
+                uint32_t bits;
+                memcpy(&bits, &value.f, sizeof(bits));
+                ok = ok && putByte(0xFA) && putBigEndian(bits, 4);
+                break;
+            }
+            case ThorArg::STRING: {
+                if (value.s == nullptr) {
+                    ok = ok && putByte(0xF6);
+                    break;
+                }
+                size_t n = 0;
+                if (value.len != ThorArg::NUL_TERMINATED) {
+                    n = value.len;
+                } else {
+                    while (value.s[n] != '\0' && n < THORLOG_RECORD_SIZE) {
+                        ++n;
+                    }
+                }
+                ok = ok && putCbor(3, n) && putBytes(value.s, n);
+                break;
+            }
+            case ThorArg::POINTER:
+                ok = ok && putCbor(0, reinterpret_cast<uintptr_t>(value.p));
+                break;
+            default:
+                ok = ok && putByte(0xF6);
+                break;
+        }
+        return ok ? true : truncate(start);
+    }
+
+    /**
+     * Append a CBOR byte string field to a structured record, reading the
+     * bytes with thorlog_read_bytes(). Returns false if it does not fit.
+     */
+    bool addBytesField(const char* key, const void* data, size_t size) {
+        if (_truncated || !_fields) {
+            return false;
+        }
+        size_t start = _len;
+        if (!putCbor(0, reinterpret_cast<uintptr_t>(key)) || !putCbor(2, size) || size > capacity() - _len) {
+            return truncate(start);
+        }
+        thorlog_read_bytes(_buffer + _len, static_cast<const uint8_t*>(data), size);
+        _len += size;
+        return true;
+    }
+
+    /**
+     * Finish the record and return its encoded bytes.
+     */
+    const char* data() {
+        if (_fields) {
+            // Room for the break byte is held back by capacity()
+            _buffer[_len++] = 0xFF;
+            _fields = false;
+        }
+        size_t body = _len - THORLOG_BINARY_HEADER_SIZE;
+        _buffer[2] = static_cast<uint8_t>(body & 0xFF);
+        _buffer[3] = static_cast<uint8_t>(body >> 8);
+        return reinterpret_cast<const char*>(_buffer);
+    }
+
+    size_t size() const { return _len; }
+
+private:
+    void putHeader(int level, bool cr, uint64_t timestamp, uint64_t format, uint8_t flags, const char* tag) {
+        _buffer[0] = THORLOG_BINARY_SYNC;
+        _buffer[1] = static_cast<uint8_t>((level & THORLOG_BINARY_LEVEL_MASK) | (cr ? THORLOG_BINARY_FLAG_CR : 0) |
+                                          (tag != nullptr ? THORLOG_BINARY_FLAG_TAG : 0) | flags);
+        putVarint(timestamp);
+        putVarint(format);
+        if (tag != nullptr) {
+            putVarint(reinterpret_cast<uintptr_t>(tag));
+        }
+    }
+
+    bool truncate(size_t start) {
+        _len = start;
+        _truncated = true;
+        _buffer[1] |= THORLOG_BINARY_FLAG_TRUNCATED;
+        return false;
+    }
+
+    size_t capacity() const { return sizeof(_buffer) - (_fields ? 1 : 0); }
+
+    bool putByte(uint8_t b) {
+        if (_len >= capacity()) {
+            return false;
+        }
+        _buffer[_len++] = b;
+        return true;
+    }
+
+    bool putBytes(const void* data, size_t size) {
+        if (size > capacity() - _len) {
+            return false;
+        }
+        memcpy(_buffer + _len, data, size);
+        _len += size;
+        return true;
+    }
+
+    bool putVarint(uint64_t v) {
+        size_t n = thorlog_put_varint(_buffer + _len, capacity() - _len, v);
+        _len += n;
+        return n > 0;
+    }
+
+    bool putCbor(uint8_t major, uint64_t v) {
+        size_t n = thorlog_put_cbor_head(_buffer + _len, capacity() - _len, major, v);
+        _len += n;
+        return n > 0;
+    }
+
+    bool putBigEndian(uint64_t v, size_t size) {
+        if (size > capacity() - _len) {
+            return false;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            _buffer[_len++] = static_cast<uint8_t>(v >> (8 * (size - 1 - i)));
+        }
+        return true;
+    }
+
+    size_t _len;
+    bool _truncated;
+    bool _fields;
+    uint8_t _buffer[THORLOG_RECORD_SIZE];
+};
+
+/**
+ * Fields of a decoded binary record.
+ */
+struct ThorBinaryRecordInfo {
+    int level;
+    bool cr;
+    bool truncated;
+    uint64_t timestamp;
+    uint64_t format;    // format string address, or its ID if interned
+    bool interned;      // THORLOG_BINARY_FLAG_ID
+    uint64_t tag;       // tag name address, 0 for untagged records
+    uint64_t skipped;   // calls a sampled call site skipped before this one
+    const uint8_t* backtrace;  // varint return addresses, see thorlog_get_backtrace()
+    size_t depth;              // number of return addresses
+    size_t argc;
+    const uint8_t* fields;  // CBOR map of a structured record, else nullptr
+    size_t fieldsSize;
+};
+
+/**
+ * Decode one binary record from data. Up to maxArgs arguments are stored in
+ * args; STRING arguments point into data and carry their length.
+ *
+ * \return the size of the record, 0 if more data is needed to decode it,
+ *         or -1 if data does not start with a valid record.
+ */
+inline long thorlog_decode_binary(const uint8_t* data, size_t size, ThorBinaryRecordInfo* info, ThorArg* args, size_t maxArgs)
+{
+    if (size < THORLOG_BINARY_HEADER_SIZE) {
+        return (size > 0 && data[0] != THORLOG_BINARY_SYNC) ? -1 : 0;
+    }
+    if (data[0] != THORLOG_BINARY_SYNC) {
+        return -1;
+    }
+    size_t total = THORLOG_BINARY_HEADER_SIZE + (data[2] | (static_cast<size_t>(data[3]) << 8));
+    if (size < total) {
+        return 0;
+    }
+    info->level = data[1] & THORLOG_BINARY_LEVEL_MASK;
+    info->cr = (data[1] & THORLOG_BINARY_FLAG_CR) != 0;
+    info->truncated = (data[1] & THORLOG_BINARY_FLAG_TRUNCATED) != 0;
+    info->interned = (data[1] & THORLOG_BINARY_FLAG_ID) != 0;
+    info->argc = 0;
+    info->fields = nullptr;
+    info->fieldsSize = 0;
+
+    size_t pos = THORLOG_BINARY_HEADER_SIZE;
+    size_t n = thorlog_get_varint(data + pos, total - pos, &info->timestamp);
+    if (n == 0) return -1;
+    pos += n;
+    n = thorlog_get_varint(data + pos, total - pos, &info->format);
+    if (n == 0) return -1;
+    pos += n;
+    info->tag = 0;
+    if (data[1] & THORLOG_BINARY_FLAG_TAG) {
+        n = thorlog_get_varint(data + pos, total - pos, &info->tag);
+        if (n == 0) return -1;
+        pos += n;
+    }
+    info->skipped = 0;
+    if (pos < total && data[pos] == THORLOG_BINARY_SAMPLE) {
+        n = thorlog_get_varint(data + pos + 1, total - pos - 1, &info->skipped);
+        if (n == 0) return -1;
+        pos += n + 1;
+    }
+    info->backtrace = nullptr;
+    info->depth = 0;
+    if (pos < total && data[pos] == THORLOG_BINARY_BACKTRACE) {
+        uint64_t depth = 0;
+        n = thorlog_get_varint(data + pos + 1, total - pos - 1, &depth);
+        if (n == 0) return -1;
+        pos += n + 1;
+        info->backtrace = data + pos;
+        for (uint64_t i = 0; i < depth; ++i) {
+            uint64_t frame;
+            n = thorlog_get_varint(data + pos, total - pos, &frame);
+            if (n == 0) return -1;
+            pos += n;
+        }
+        info->depth = static_cast<size_t>(depth);
+    }
+    if (data[1] & THORLOG_BINARY_FLAG_FIELDS) {
+        // Checked by thorlog_print_fields() as it is walked
+        info->fields = data + pos;
+        info->fieldsSize = total - pos;
+        return static_cast<long>(total);
+    }
+
+    while (pos < total) {
+        ThorArg arg;
+        arg.type = static_cast<ThorArg::Type>(data[pos] >> 4);
+        arg.size = data[pos] & 0x0F;
+        arg.len = ThorArg::NUL_TERMINATED;
+        arg.u = 0;
+        ++pos;
+        uint64_t v = 0;
+        switch (arg.type) {
+            case ThorArg::INT:
+            case ThorArg::UINT:
+            case ThorArg::POINTER:
+                n = thorlog_get_varint(data + pos, total - pos, &v);
+                if (n == 0) return -1;
+                pos += n;
+                if (arg.type == ThorArg::INT) {
+                    arg.i = static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+                } else {
+                    arg.u = v;
+                }
+                break;
+            case ThorArg::DOUBLE:
+                if (total - pos < sizeof(arg.d)) return -1;
+                memcpy(&arg.d, data + pos, sizeof(arg.d));
+                pos += sizeof(arg.d);
+                break;
+            case ThorArg::FLOAT:
+                if (total - pos < sizeof(arg.f)) return -1;
+                memcpy(&arg.f, data + pos, sizeof(arg.f));
+                pos += sizeof(arg.f);
+                break;
+            case ThorArg::STRING:
+                n = thorlog_get_varint(data + pos, total - pos, &v);
+                if (n == 0 || v > total - pos - n) return -1;
+                pos += n;
+                arg.s = reinterpret_cast<const char*>(data + pos);
+                arg.len = static_cast<uint32_t>(v);
+                pos += static_cast<size_t>(v);
+                break;
+            default:
+                return -1;
+        }
+        if (info->argc < maxArgs) {
+            args[info->argc] = arg;
+        }
+        ++info->argc;
+    }
+    return static_cast<long>(total);
+}
+
+/**
+ * The return addresses of a record decoded by thorlog_decode_binary(); up
+ * to max of them are stored in frames. Returns how many were stored.
+ */
+inline size_t thorlog_get_backtrace(const ThorBinaryRecordInfo* info, uint64_t* frames, size_t max)
+{
+    const uint8_t* pos = info->backtrace;
+    size_t count = (info->depth < max) ? info->depth : max;
+    for (size_t i = 0; i < count; ++i) {
+        // Validated by thorlog_decode_binary(); 10 bytes is the longest varint
+        pos += thorlog_get_varint(pos, 10, &frames[i]);
+    }
+    return count;
+}
+
+// *************************************************************************
+//  Structured records. Passing thorlog_kv() fields instead of format
+//  arguments logs typed key/value pairs: a JSON line in text mode, a CBOR
+//  map in binary mode. Keys must be string literals (or otherwise live as
+//  long as the program); only their address is stored.
+//
+//      ThorLog.infoln("motor", thorlog_kv("rpm", rpm), thorlog_kv("temp", temp));
+//      {"ts":1234567,"level":"info","msg":"motor","rpm":1200,"temp":21.500}
+// *************************************************************************
+
+// Decimals of floating-point values in JSON
+#ifndef THORLOG_KV_PRECISION
+#define THORLOG_KV_PRECISION 3
+#endif
+
+template <typename T>
+struct ThorField {
+    const char* key;
+    T value;
+};
+
+template <typename T>
+constexpr ThorField<T> thorlog_kv(const char* key, T value)
+{
+    return ThorField<T>{key, value};
+}
+
+// Short name for thorlog_kv(), for code that defines THORLOG_SHORT_KV
+// before including this header
+#ifdef THORLOG_SHORT_KV
+template <typename T>
+constexpr ThorField<T> kv(const char* key, T value)
+{
+    return ThorField<T>{key, value};
+}
+#endif
+
+template <typename T>
+struct thorlog_is_field : std::false_type {};
+
+template <typename T>
+struct thorlog_is_field<ThorField<T>> : std::true_type {};
+
+/**
+ * The value a format argument or field is described by, e.g. for hashing.
+ */
+template <typename T>
+inline ThorArg thorlog_value_arg(T value)
+{
+    return thorlog_make_arg(value);
+}
+
+template <typename T>
+inline ThorArg thorlog_value_arg(const ThorField<T>& field)
+{
+    return thorlog_make_arg(field.value);
+}
+
+template <typename T>
+inline bool thorlog_add_field(ThorBinaryRecord& record, const ThorField<T>& field)
+{
+    return record.addField(field.key, thorlog_make_arg(field.value), std::is_same<T, bool>::value);
+}
+
+/**
+ * Write len characters of s as a quoted JSON string.
+ */
+inline void thorlog_print_json_string(ThorRecord& out, const char* s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    out.print('"');
+    size_t run = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.write(s + run, i - run);
+        run = i + 1;
+        char escape[6] = {'\\', static_cast<char>(c), 0, 0, 0, 0};
+        size_t n = 2;
+        if (c == '\n') {
+            escape[1] = 'n';
+        } else if (c == '\r') {
+            escape[1] = 'r';
+        } else if (c == '\t') {
+            escape[1] = 't';
+        } else if (c < 0x20) {
+            escape[1] = 'u';
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 0x0F];
+            n = 6;
+        }
+        out.write(escape, n);
+    }
+    out.write(s + run, len - run);
+    out.print('"');
+}
+
+/**
+ * Write a value as JSON; non-finite numbers and null strings become null.
+ */
+inline void thorlog_print_json_value(ThorRecord& out, const ThorArg& arg, bool isBool)
+{
+    switch (arg.type) {
+        case ThorArg::INT:
+            out.printSigned(arg.i);
+            break;
+        case ThorArg::UINT:
+            if (isBool) {
+                out.print(arg.u ? "true" : "false");
+            } else {
+                out.printUnsigned(arg.u);
+            }
+            break;
+        case ThorArg::DOUBLE:
+        case ThorArg::FLOAT: {
+            double d = arg.toDouble();
+            if (d != d || d > 1.7976931348623157e308 || d < -1.7976931348623157e308) {
+                out.print("null");
+            } else if (arg.type == ThorArg::FLOAT) {
+                out.printFloat(arg.f, THORLOG_KV_PRECISION);
+            } else {
+                out.printDouble(d, THORLOG_KV_PRECISION);
+            }
+            break;
+        }
+        case ThorArg::STRING:
+            if (arg.s == nullptr) {
+                out.print("null");
+            } else {
+                thorlog_print_json_string(out, arg.s, (arg.len != ThorArg::NUL_TERMINATED) ? arg.len : strlen(arg.s));
+            }
+            break;
+        case ThorArg::POINTER:
+            out.printUnsigned(reinterpret_cast<uintptr_t>(arg.p));
+            break;
+        default:
+            out.print("null");
+            break;
+    }
+}
+
+/**
+ * Write the members every structured record starts with, up to and
+ * including the message; the caller adds the fields and the closing brace.
+ */
+inline void thorlog_print_json_header(ThorRecord& out, bool hasTimestamp, uint64_t timestamp, int level,
+                                      const char* tag, const char* msg)
+{
+    static const char* const names[] = {"silent", "fatal", "error", "warning", "info", "trace", "verbose"};
+    out.print('{');
+    if (hasTimestamp) {
+        out.print("\"ts\":");
+        out.printUnsigned(timestamp);
+        out.print(',');
+    }
+    out.print("\"level\":\"");
+    out.print(names[(level >= 0 && level <= THORLOG_LEVEL_VERBOSE) ? level : 0]);
+    out.print('"');
+    if (tag != nullptr) {
+        out.print(",\"tag\":");
+        thorlog_print_json_string(out, tag, strlen(tag));
+    }
+    out.print(",\"msg\":");
+    thorlog_print_json_string(out, (msg != nullptr) ? msg : "", (msg != nullptr) ? strlen(msg) : 0);
+}
+
+template <typename T>
+inline void thorlog_print_json_field(ThorRecord& out, const ThorField<T>& field)
+{
+    out.print(',');
+    thorlog_print_json_string(out, field.key, strlen(field.key));
+    out.print(':');
+    thorlog_print_json_value(out, thorlog_make_arg(field.value), std::is_same<T, bool>::value);
+}
+
+/**
+ * Write the CBOR map of a decoded structured record as JSON members
+ * (",\"key\":value" each). keyName(address) returns the key string at an
+ * address, or nullptr if it is unknown.
+ *
+ * \return false if the map is damaged; the members before the damage have
+ *         been written.
+ */
+template <class KeyName>
+inline bool thorlog_print_fields(ThorRecord& out, const uint8_t* data, size_t size, KeyName keyName)
+{
+    if (size == 0 || data[0] != 0xBF) {
+        return false;
+    }
+    size_t pos = 1;
+    while (pos < size && data[pos] != 0xFF) {
+        uint8_t major;
+        uint64_t v;
+        size_t n = thorlog_get_cbor_head(data + pos, size - pos, &major, &v);
+        if (n == 0 || major != 0) {
+            return false;
+        }
+        pos += n;
+        const char* key = keyName(v);
+        out.print(',');
+        thorlog_print_json_string(out, (key != nullptr) ? key : "?", (key != nullptr) ? strlen(key) : 1);
+        out.print(':');
+
+        if (pos >= size) {
+            return false;
+        }
+        ThorArg arg;
+        arg.type = ThorArg::NONE;
+        arg.size = 0;
+        arg.len = ThorArg::NUL_TERMINATED;
+        arg.u = 0;
+        bool isBool = false;
+        uint8_t initial = data[pos];
+        if (initial == 0xF4 || initial == 0xF5) {
+            arg.type = ThorArg::UINT;
+            arg.u = (initial == 0xF5);
+            isBool = true;
+            ++pos;
+        } else if (initial == 0xF6) {
+            ++pos;
+        } else if (initial == 0xFA || initial == 0xFB) {
+            size_t bytes = (initial == 0xFA) ? 4 : 8;
+            if (size - pos < bytes + 1) {
+                return false;
+            }
+            uint64_t bits = 0;
+            for (size_t i = 0; i < bytes; ++i) {
+                bits = (bits << 8) | data[pos + 1 + i];
+            }
+            if (initial == 0xFA) {
+                uint32_t bits32 = static_cast<uint32_t>(bits);
+                arg.type = ThorArg::FLOAT;
+                memcpy(&arg.f, &bits32, sizeof(arg.f));
+            } else {
+                arg.type = ThorArg::DOUBLE;
+                memcpy(&arg.d, &bits, sizeof(arg.d));
+            }
+            pos += bytes + 1;
+        } else {
+            n = thorlog_get_cbor_head(data + pos, size - pos, &major, &v);
+            if (n == 0) {
+                return false;
+            }
+            pos += n;
+            if (major == 0) {
+                arg.type = ThorArg::UINT;
+                arg.u = v;
+            } else if (major == 1) {
+                arg.type = ThorArg::INT;
+                arg.i = -1 - static_cast<int64_t>(v);
+            } else if (major == 3 && v <= size - pos) {
+                arg.type = ThorArg::STRING;
+                arg.s = reinterpret_cast<const char*>(data + pos);
+                arg.len = static_cast<uint32_t>(v);
+                pos += static_cast<size_t>(v);
+            } else if (major == 2 && v <= size - pos) {
+                // Byte strings (hex dumps) print as a hex string
+                out.print('"');
+                for (size_t i = 0; i < v; ++i) {
+                    char hex[2];
+                    thorlog_format_hex(hex, data[pos + i], 2);
+                    out.write(hex, 2);
+                }
+                out.print('"');
+                pos += static_cast<size_t>(v);
+                continue;
+            } else {
+                return false;
+            }
+        }
+        thorlog_print_json_value(out, arg, isBool);
+    }
+    return pos < size;
+}
+
+// *************************************************************************
+//  Call-site rate limiting. A ThorLogLimit is declared static next to a log
+//  call (the THORLOG_EVERY_MS and THORLOG_COLLAPSE macros do this) and is
+//  checked right after the level, before anything is formatted, so a
+//  suppressed record costs a time read and a compare:
+//
+//      THORLOG_EVERY_MS(ThorLog, 1000, THORLOG_LEVEL_WARNING, "Sensor %d timeout", id);
+//      THORLOG_COLLAPSE(wifiLog, THORLOG_LEVEL_INFO, "state=%s", stateName());
+//
+//  Suppressed records are counted and reported with the next one that gets
+//  through. Rate limiting needs a time source (setTimeSource()).
+// *************************************************************************
+
+#ifndef THORLOG_HASH_STRING_MAX
+#define THORLOG_HASH_STRING_MAX 32
+#endif
+
+/**
+ * 32-bit FNV-1a hash of size bytes, continuing from hash.
+ */
+inline uint32_t thorlog_fnv1a(uint32_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * THORLOG_FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * Hash of argument values, used to spot repeated records without formatting
+ * them. Strings are hashed by their first THORLOG_HASH_STRING_MAX characters.
+ */
+inline uint32_t thorlog_hash_args(uint32_t hash, const ThorArg* args, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const ThorArg& arg = args[i];
+        if (arg.type == ThorArg::STRING) {
+            size_t len = 0;
+            if (arg.s != nullptr) {
+                while (len < THORLOG_HASH_STRING_MAX && len < arg.len && arg.s[len] != '\0') {
+                    ++len;
+                }
+                hash = thorlog_fnv1a(hash, arg.s, len);
+            }
+            hash = thorlog_fnv1a(hash, &len, sizeof(len));
+        } else if (arg.type == ThorArg::POINTER) {
+            uintptr_t p = reinterpret_cast<uintptr_t>(arg.p);
+            hash = thorlog_fnv1a(hash, &p, sizeof(p));
+        } else if (arg.type == ThorArg::FLOAT) {
+            hash = thorlog_fnv1a(hash, &arg.f, sizeof(arg.f));
+        } else {
+            hash = thorlog_fnv1a(hash, &arg.u, sizeof(arg.u));
+        }
+    }
+    return hash;
+}
+
+/**
+ * ThorLogLimit - State of one rate-limited or collapsing call site
+ *
+ * With an interval, at most one record per interval gets through. With
+ * collapse, a record whose arguments equal the previous one's from the same
+ * site is suppressed until the arguments change, and the interval (if any)
+ * only sets how often "last message repeated N times" is reported.
+ */
+class ThorLogLimit
+{
+public:
+    constexpr ThorLogLimit(uint32_t intervalMs, bool collapse = false)
+        : _intervalMs(intervalMs), _collapse(collapse)
+    {
+    }
+
+    ThorLogLimit(const ThorLogLimit&) = delete;
+    ThorLogLimit& operator=(const ThorLogLimit&) = delete;
+
+    /**
+     * Records suppressed since the last one that got through.
+     */
+    uint32_t getSuppressed() const { return _suppressed.load(std::memory_order_relaxed); }
+
+private:
+    friend class ThorLogging;
+
+    const uint32_t _intervalMs;
+    const bool _collapse;
+    // Races between tasks may let an extra record through, never lose one
+    // from the count
+    std::atomic<bool> _armed{false};
+    std::atomic<uint32_t> _deadline{0};
+    std::atomic<uint32_t> _hash{0};
+    std::atomic<uint32_t> _suppressed{0};
+};
+
+/**
+ * ThorLogSample - State of one sampled call site
+ *
+ * Lets one call in every N through, or each call with probability p,
+ * decided by a xorshift generator per site. Each record that gets through
+ * carries the number of calls skipped since the previous one, so counts
+ * can be scaled back up: the record stands for skipped + 1 calls.
+ */
+class ThorLogSample
+{
+public:
+    /**
+     * One call in every n; 0 and 1 let every call through.
+     */
+    static constexpr ThorLogSample every(uint32_t n)
+    {
+        return ThorLogSample((n > 1) ? n : 1, 0, 0);
+    }
+
+    /**
+     * Each call with probability p. seed must differ between call sites
+     * that should not skip in step; the macros use the line number.
+     */
+    static constexpr ThorLogSample chance(double p, uint32_t seed = 1)
+    {
+        return (p >= 1.0) ? ThorLogSample(1, 0, 0)
+                          : ThorLogSample(0, (p > 0.0) ? static_cast<uint32_t>(p * 4294967296.0) : 0,
+                                          seed * 2654435761UL + 1);
+    }
+
+    ThorLogSample(const ThorLogSample&) = delete;
+    ThorLogSample& operator=(const ThorLogSample&) = delete;
+
+    /**
+     * Calls skipped since the last one that got through.
+     */
+    uint32_t getSkipped() const { return _pending.load(std::memory_order_relaxed); }
+
+private:
+    friend class ThorLogging;
+
+    constexpr ThorLogSample(uint32_t every, uint32_t threshold, uint32_t seed)
+        : _every(every), _threshold(threshold), _state(seed != 0 ? seed : 1)
+    {
+    }
+
+    // Whether this call gets through; if so, skipped is set to the calls
+    // skipped before it. Races between tasks may skip a call, or reuse a
+    // random number, but never lose one from the count.
+    bool take(uint32_t &skipped)
+    {
+        uint32_t pending = _pending.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (_every != 0)
+        {
+            if (pending < _every)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            uint32_t x = _state.load(std::memory_order_relaxed);
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            _state.store(x, std::memory_order_relaxed);
+            if (x >= _threshold)
+            {
+                return false;
+            }
+        }
+        pending = _pending.exchange(0, std::memory_order_relaxed);
+        if (pending == 0)
+        {
+            return false;
+        }
+        skipped = pending - 1;
+        return true;
+    }
+
+    const uint32_t _every;      // 0 for a random sample
+    const uint32_t _threshold;  // p * 2^32
+    std::atomic<uint32_t> _state;
+    std::atomic<uint32_t> _pending{0};
+};
+
+/**
+ * ThorLogStats - Snapshot of the counters kept with THORLOG_STATS
+ *
+ * Counters are 32 bits and wrap; compare two snapshots to get rates.
+ */
+struct ThorLogStats {
+    uint32_t emitted[THORLOG_LEVEL_VERBOSE + 1];   // records written, per level
+    uint32_t filtered[THORLOG_LEVEL_VERBOSE + 1];  // calls below the level, per level
+    uint32_t limited;                              // records held back by rate limiting or sampling
+    uint32_t isr;                                  // records from interrupt handlers
+    uint32_t bytes[THORLOG_MAX_SINKS];             // bytes written to each output
+    ThorSinkStats sinks[THORLOG_MAX_SINKS];        // from each output's getStats()
+    ThorSinkStats isrSink;                         // from the ISR output's getStats()
+    uint32_t cycles[THORLOG_STATS_BUCKETS];        // histogram of cycles per call
+    uint32_t maxCycles;                            // longest call
+};
+
+/**
+ * ThorLogging is a minimalistic framework to help the programmer output log statements to an output of choice,
+ * fashioned after extensive logging libraries such as log4cpp, log4j and log4net. In case of problems with an
+ * application, it is helpful to enable logging so that the problem can be located. ThorLogging is designed so
+ * that log statements can remain in the code with minimal performance cost. In order to facilitate this the
+ * loglevel can be adjusted, and (if your code is completely tested) all logging code can be compiled out.
+ *
+ * ---- Wildcards
+ *
+ * %s   display as string (char*)
+ * %c   display as single character
+ * %C   display as single character or as hexadecimal value (prefixed by `0x`) if not a printable character
+ * %d   display as integer value
+ * %l   display as long value (up to 64 bits)
+ * %u   display as unsigned long value (up to 64 bits)
+ * %x   display as hexadecimal value
+ * %X   display as hexadecimal value prefixed by `0x` and leading zeros
+ *      (8 digits, or 16 for 64-bit values)
+ * %b   display as binary number
+ * %B   display as binary number, prefixed by `0b`
+ * %t   display as boolean value "t" or "f"
+ * %T   display as boolean value "true" or "false"
+ * %D,%F display as double value, with 2 decimals or as many as given
+ *      by a precision such as %.4F (0 to 9)
+ * %p   display pointer address
+ *
+ * Arguments keep their type on the way to the formatter, so a conversion is
+ * always applied to the value that was passed (an int given to %D prints as
+ * a double, and a float is formatted without being promoted to double).
+ *
+ * Wrapping a string literal in THORLOG_FMT() moves the parsing to compile
+ * time and rejects unknown conversions, missing or extra arguments, and
+ * arguments that do not fit their conversion (e.g. a 64-bit value for %d).
+ *
+ * ---- Loglevels
+ *
+ * 0 - THORLOG_LEVEL_SILENT     no output
+ * 1 - THORLOG_LEVEL_FATAL      fatal errors
+ * 2 - THORLOG_LEVEL_ERROR      all errors
+ * 3 - THORLOG_LEVEL_WARNING    errors and warnings
+ * 4 - THORLOG_LEVEL_INFO       errors, warnings and notices
+ * 4 - THORLOG_LEVEL_NOTICE     Same as INFO, kept for backward compatibility
+ * 5 - THORLOG_LEVEL_TRACE      errors, warnings, notices, traces
+ * 6 - THORLOG_LEVEL_VERBOSE    all
+ *
+ * ---- Thread safety
+ *
+ * Any task on any core may log at any time. Each record is rendered into a
+ * buffer on the calling task's stack and reaches the output in one write(),
+ * so records from different tasks do not interleave as long as the output's
+ * write() is atomic (EspIdfPrint and the sinks shipped with ThorLog are; use
+ * ThorLockedPrint for outputs that are not). The level filter reads atomics
+ * and takes no lock. Records longer than THORLOG_RECORD_SIZE are written in
+ * several parts unless THORLOG_OVERFLOW_TRUNCATE is selected.
+ */
+
+class ThorLogging
+{
+public:
+    /**
+     * default Constructor
+     */
+    // constexpr so that ThorLog is initialized before any constructor runs,
+    // which lets ThorLoggers with static storage register their tags safely
+    constexpr ThorLogging()
+    {
+    }
+
+    /**
+     * Initializing, must be called as first. Note that if you use
+     * this variant of Init, you need to initialize the baud rate
+     * yourself, if printer happens to be a serial port.
+     *
+     * \param level - logging levels <= this will be logged.
+     * \param output - place that logging output will be sent to.
+     * \param showLevel - whether to show the log level prefix.
+     * \return void
+     */
+    void begin(int level, ThorPrint *output, bool showLevel = true)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([output, showLevel](Config &config)
+        {
+            config.showLevel = showLevel;
+            config.outputs[0] = output;
+            config.outputLevels[0] = THORLOG_LEVEL_VERBOSE;
+        });
+        // Only now, so that every record let through by the new level
+        // goes to the new output with the new showLevel
+        setLevel(level);
+#else
+        (void)level;
+        (void)output;
+        (void)showLevel;
+#endif
+    }
+
+    /**
+     * Send records to one more output. The global and tag levels decide
+     * which records are logged at all; level then picks which of those
+     * this output receives. Wrap slow outputs in a ThorAsyncPrint so they
+     * have their own buffer and do not hold up the others.
+     *
+     * \param output - the output to add; adding it again updates its level
+     * \param level - most verbose level written to this output
+     * \return false if THORLOG_MAX_SINKS outputs are in use
+     */
+    bool addOutput(ThorPrint *output, int level = THORLOG_LEVEL_VERBOSE)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (output == nullptr)
+        {
+            return false;
+        }
+        bool added = false;
+        configure([output, level, &added](Config &config)
+        {
+            size_t slot = config.find(output);
+            for (size_t i = 1; slot == THORLOG_MAX_SINKS && i < THORLOG_MAX_SINKS; ++i)
+            {
+                if (config.outputs[i] == nullptr)
+                {
+                    slot = i;
+                    config.outputs[i] = output;
+                    ++config.extraOutputs;
+                }
+            }
+            added = (slot < THORLOG_MAX_SINKS);
+            if (added)
+            {
+                config.outputLevels[slot] = static_cast<uint8_t>(thorlog_constrain(level, THORLOG_LEVEL_SILENT, THORLOG_LEVEL_VERBOSE));
+            }
+        });
+        return added;
+#else
+        (void)output;
+        (void)level;
+#endif
+        return false;
+    }
+
+    /**
+     * Stop sending records to an output added with addOutput(), or to the
+     * output given to begin(). A record being written at the same time may
+     * still reach it; call synchronize() before destroying the output.
+     *
+     * \param output - the output to remove
+     * \return false if output was not registered
+     */
+    bool removeOutput(ThorPrint *output)
+    {
+        return replaceOutput(output, nullptr);
+    }
+
+    /**
+     * Swap one output for another in a single step, keeping its level,
+     * e.g. to move from the USB console to flash when USB disconnects.
+     * Every record goes wholly to the old output or wholly to the new one;
+     * records that started before the swap may still reach the old output,
+     * so call synchronize() before destroying it.
+     *
+     * \param output - the registered output to replace
+     * \param replacement - its successor; nullptr removes output
+     * \return false if output was not registered, or if replacement
+     *         already is another output
+     */
+    bool replaceOutput(ThorPrint *output, ThorPrint *replacement)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (output == nullptr)
+        {
+            return false;
+        }
+        bool found = false;
+        configure([output, replacement, &found](Config &config)
+        {
+            size_t slot = config.find(output);
+            found = (slot < THORLOG_MAX_SINKS);
+            // One output in two slots would get every record twice
+            if (found && replacement != nullptr && replacement != output)
+            {
+                found = (config.find(replacement) == THORLOG_MAX_SINKS);
+            }
+            if (found)
+            {
+                config.outputs[slot] = replacement;
+                if (slot > 0 && replacement == nullptr)
+                {
+                    --config.extraOutputs;
+                }
+            }
+        });
+        return found;
+#else
+        (void)output;
+        (void)replacement;
+        return false;
+#endif
+    }
+
+    /**
+     * Change the level of a registered output.
+     *
+     * \param output - the output
+     * \param level - most verbose level written to this output
+     * \return false if output is not registered
+     */
+    bool setOutputLevel(ThorPrint *output, int level)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (output == nullptr)
+        {
+            return false;
+        }
+        bool found = false;
+        configure([output, level, &found](Config &config)
+        {
+            size_t slot = config.find(output);
+            found = (slot < THORLOG_MAX_SINKS);
+            if (found)
+            {
+                config.outputLevels[slot] = static_cast<uint8_t>(thorlog_constrain(level, THORLOG_LEVEL_SILENT, THORLOG_LEVEL_VERBOSE));
+            }
+        });
+        return found;
+#else
+        (void)output;
+        (void)level;
+#endif
+        return false;
+    }
+
+    /**
+     * Waits until every log call that started before this one is done,
+     * so that an output taken out by removeOutput() or replaceOutput()
+     * can be destroyed. Log calls that start meanwhile are not waited
+     * for. Not for interrupt handlers.
+     *
+     * \param yield - called while waiting, e.g. thorlog_espidf_yield, so
+     *                that lower priority tasks can finish their records;
+     *                nullptr spins
+     * \return void
+     */
+    void synchronize(yieldfunction yield = nullptr) const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        // Each log call holds the slot current when it started. Slots
+        // that are not current are no longer taken, so once every one of
+        // them is let go, all earlier log calls are done.
+        for (size_t i = 0; i < THORLOG_CONFIG_SLOTS; ++i)
+        {
+            while (_configs[i].readers.load(std::memory_order_acquire) != 0 &&
+                   (_config.load(std::memory_order_seq_cst) & 0xFF) != i)
+            {
+                if (yield != nullptr)
+                {
+                    yield();
+                }
+            }
+        }
+#else
+        (void)yield;
+#endif
+    }
+
+    /**
+     * Set the log level. Tags without a level of their own follow it.
+     *
+     * \param level - The new log level.
+     * \return void
+     */
+    void setLevel(int level)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        uint8_t value = static_cast<uint8_t>(thorlog_constrain(level, THORLOG_LEVEL_SILENT, THORLOG_LEVEL_VERBOSE));
+        // Release, so that records let through find the configuration
+        // published before, see ConfigLock
+        _levels[THORLOG_TAG_NONE].store(value, std::memory_order_release);
+        size_t count = _tagCount.load(std::memory_order_acquire);
+        for (size_t id = 1; id <= count; ++id)
+        {
+            if (!_tagOverride[id].load(std::memory_order_relaxed))
+            {
+                _levels[id].store(value, std::memory_order_release);
+            }
+        }
+#else
+        (void)level;
+#endif
+    }
+
+    /**
+     * Get the log level.
+     *
+     * \return The current log level.
+     */
+    int getLevel() const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        return _levels[THORLOG_TAG_NONE].load(std::memory_order_relaxed);
+#else
+        return THORLOG_LEVEL_SILENT;
+#endif
+    }
+
+    /**
+     * Set whether to show the log level.
+     *
+     * \param showLevel - true if the log level should be shown for each log
+     *                    false otherwise.
+     * \return void
+     */
+    void setShowLevel(bool showLevel)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([showLevel](Config &config) { config.showLevel = showLevel; });
+#else
+        (void)showLevel;
+#endif
+    }
+
+    /**
+     * Get whether the log level is shown during logging
+     *
+     * \return true if the log level is be shown for each log
+     *         false otherwise.
+     */
+    bool getShowLevel() const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        return ConfigLock(this).config().showLevel;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * Register a tag, or look up the id of one registered before.
+     * ThorLogger does this when it is constructed; a new tag starts out
+     * following the global level. Tag names are compared with strcmp here
+     * only, never while logging, and must stay valid (e.g. a literal).
+     *
+     * \param name - The tag name.
+     * \return the tag id, or THORLOG_TAG_NONE if all THORLOG_MAX_TAGS ids
+     *         are taken.
+     */
+    uint8_t registerTag(const char *name)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (name == nullptr)
+        {
+            return THORLOG_TAG_NONE;
+        }
+        // The name is claimed into the next free slot before the count
+        // takes it in, so findTag() sees every counted tag with its name
+        // and two registrations of one tag always meet in one slot
+        for (;;)
+        {
+            uint8_t count = _tagCount.load(std::memory_order_acquire);
+            uint8_t id = findTag(name, count);
+            if (id != THORLOG_TAG_NONE)
+            {
+                return id;
+            }
+            if (count >= THORLOG_MAX_TAGS)
+            {
+                return THORLOG_TAG_NONE;
+            }
+            id = static_cast<uint8_t>(count + 1);
+            // The level goes in before the name is published, so nobody
+            // finds the tag with a stale level or has a setTagLevel()
+            // overwritten; a racing registration stores the same value
+            const char *expected = _tagNames[id].load(std::memory_order_acquire);
+            if (expected == nullptr)
+            {
+                _levels[id].store(_levels[THORLOG_TAG_NONE].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                _tagNames[id].compare_exchange_strong(expected, name, std::memory_order_acq_rel);
+            }
+            // Whoever claimed the slot, it is counted before looking again,
+            // so a registration stalled after its claim holds nobody up
+            _tagCount.compare_exchange_strong(count, id, std::memory_order_acq_rel);
+            if (expected == nullptr || strcmp(expected, name) == 0)
+            {
+                return id;
+            }
+        }
+#else
+        (void)name;
+        return THORLOG_TAG_NONE;
+#endif
+    }
+
+    /**
+     * Find a registered tag by name.
+     *
+     * \param name - The tag name.
+     * \return the tag id, or THORLOG_TAG_NONE if no such tag is registered.
+     */
+    uint8_t findTag(const char *name) const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (name == nullptr)
+        {
+            return THORLOG_TAG_NONE;
+        }
+        return findTag(name, _tagCount.load(std::memory_order_acquire));
+#else
+        (void)name;
+        return THORLOG_TAG_NONE;
+#endif
+    }
+
+    /**
+     * Set the log level of one tag, e.g. from a console command. The tag
+     * keeps this level when the global level changes, until clearTagLevel().
+     *
+     * \param tag - The tag name.
+     * \param level - The new log level for that tag.
+     * \return true if the tag is registered.
+     */
+    bool setTagLevel(const char *tag, int level)
+    {
+        uint8_t id = findTag(tag);
+        if (id == THORLOG_TAG_NONE)
+        {
+            return false;
+        }
+        setTagLevel(id, level);
+        return true;
+    }
+
+    /**
+     * Get the log level of one tag.
+     *
+     * \param tag - The tag name.
+     * \return the tag's level, or the global level if the tag is not registered.
+     */
+    int getTagLevel(const char *tag) const
+    {
+        return getTagLevel(findTag(tag));
+    }
+
+    /**
+     * Make a tag follow the global level again.
+     *
+     * \param tag - The tag name.
+     * \return true if the tag is registered.
+     */
+    bool clearTagLevel(const char *tag)
+    {
+        uint8_t id = findTag(tag);
+        if (id == THORLOG_TAG_NONE)
+        {
+            return false;
+        }
+        clearTagLevel(id);
+        return true;
+    }
+
+    /**
+     * Number of registered tags. Their ids are 1 to getTagCount().
+     */
+    size_t getTagCount() const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        return _tagCount.load(std::memory_order_acquire);
+#else
+        return 0;
+#endif
+    }
+
+    /**
+     * Name of a registered tag.
+     *
+     * \param id - The tag id.
+     * \return the tag name, or nullptr for THORLOG_TAG_NONE and unknown ids.
+     */
+    const char *getTagName(uint8_t id) const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (id <= THORLOG_MAX_TAGS)
+        {
+            return _tagNames[id].load(std::memory_order_acquire);
+        }
+#else
+        (void)id;
+#endif
+        return nullptr;
+    }
+
+    /**
+     * Sets a function to be called before each log command.
+     *
+     * \param f - The function to be called
+     * \return void
+     */
+    void setPrefix(printfunction f)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([f](Config &config) { config.prefix = f; });
+#else
+        (void)f;
+#endif
+    }
+
+    /**
+     * clears prefix.
+     *
+     * \return void
+     */
+    void clearPrefix()
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([](Config &config) { config.prefix = nullptr; });
+#endif
+    }
+
+    /**
+     * Sets a function to be called after each log command.
+     *
+     * \param f - The function to be called
+     * \return void
+     */
+    void setSuffix(printfunction f)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([f](Config &config) { config.suffix = f; });
+#else
+        (void)f;
+#endif
+    }
+
+    /**
+     * clears suffix.
+     *
+     * \return void
+     */
+    void clearSuffix()
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([](Config &config) { config.suffix = nullptr; });
+#endif
+    }
+
+    /**
+     * Set the output mode.
+     *
+     * \param mode - THORLOG_MODE_TEXT (default) formats records on the device,
+     *               THORLOG_MODE_BINARY writes compact binary records that
+     *               are formatted on the host by tools/thorlog_decode.
+     * \return void
+     */
+    void setMode(int mode)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        uint8_t value = (mode == THORLOG_MODE_BINARY) ? THORLOG_MODE_BINARY : THORLOG_MODE_TEXT;
+        configure([value](Config &config) { config.mode = value; });
+#else
+        (void)mode;
+#endif
+    }
+
+    /**
+     * Get the output mode.
+     *
+     * \return THORLOG_MODE_TEXT or THORLOG_MODE_BINARY.
+     */
+    int getMode() const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        return ConfigLock(this).config().mode;
+#else
+        return THORLOG_MODE_TEXT;
+#endif
+    }
+
+    /**
+     * Sets the function used to timestamp binary records.
+     *
+     * \param f - Function returning the time in microseconds, e.g.
+     *            thorlog_espidf_time_us. nullptr records a timestamp of 0.
+     * \return void
+     */
+    void setTimeSource(timefunction f)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([f](Config &config) { config.timeSource = f; });
+#else
+        (void)f;
+#endif
+    }
+
+    /**
+     * Starts each text record with a timestamp, rendered straight into the
+     * record buffer ("123456 I: msg"). Cheaper than doing the same in a
+     * prefix function.
+     *
+     * \param mode - THORLOG_TIMESTAMP_US, _MS or _CYCLES, or
+     *               THORLOG_TIMESTAMP_NONE to turn the timestamp off
+     * \param source - Clock to read; nullptr uses the time source set with
+     *                 setTimeSource(). Required for _CYCLES, e.g.
+     *                 thorlog_espidf_cycles.
+     * \return void
+     */
+    void setTimestamp(int mode, timefunction source = nullptr)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([mode, source](Config &config)
+        {
+            config.timestampMode = static_cast<uint8_t>(mode);
+            config.timestampSource = source;
+        });
+#else
+        (void)mode;
+        (void)source;
+#endif
+    }
+
+    /**
+     * Adds the running task and core to each text record, after the
+     * timestamp ("123456 [main/0] I: msg").
+     *
+     * \param taskName - Function returning the name of the calling task,
+     *                   e.g. thorlog_espidf_task_name, or nullptr
+     * \param coreId - Function returning the calling core, e.g.
+     *                 thorlog_espidf_core_id, or nullptr
+     * \return void
+     */
+    void setTaskInfo(taskfunction taskName, corefunction coreId)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([taskName, coreId](Config &config)
+        {
+            config.taskName = taskName;
+            config.coreId = coreId;
+        });
+#else
+        (void)taskName;
+        (void)coreId;
+#endif
+    }
+
+    /**
+     * Sets where the per-task context of ThorContext guards is kept, and
+     * adds it to each text record after the level and tag ("I: conn=42
+     * msg") and to each JSON record as members. A record copies the bytes
+     * the guards rendered; binary records leave the context out.
+     *
+     * \param source - Function returning the calling task's context, e.g.
+     *                 thorlog_espidf_context, or nullptr
+     * \return void
+     */
+    void setContextSource(taskcontextfunction source)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([source](Config &config)
+        {
+            config.context = source;
+        });
+#else
+        (void)source;
+#endif
+    }
+
+    /**
+     * Get the function set with setContextSource().
+     */
+    taskcontextfunction getContextSource() const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        return ConfigLock(this).config().context;
+#else
+        return nullptr;
+#endif
+    }
+
+    /**
+     * Attaches the caller's return addresses to records at level or more
+     * severe. Only the raw addresses are recorded; they are symbolized on
+     * the host against the ELF (thorlog_decode for binary records, or
+     * addr2line). Less severe records pay one compare. Records from
+     * interrupt handlers never carry a backtrace.
+     *
+     * \param capture - Fills frames with up to max return addresses and
+     *                  returns how many, e.g. thorlog_espidf_backtrace;
+     *                  nullptr turns capture off
+     * \param level - Least severe level that gets one; THORLOG_LEVEL_ERROR
+     *                by default, THORLOG_LEVEL_FATAL for fatal records only
+     * \return void
+     */
+    void setBacktrace(backtracefunction capture, int level = THORLOG_LEVEL_ERROR)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        uint8_t value = (capture != nullptr) ? static_cast<uint8_t>(thorlog_constrain(level, THORLOG_LEVEL_SILENT, THORLOG_LEVEL_VERBOSE))
+                                             : static_cast<uint8_t>(THORLOG_LEVEL_SILENT);
+        configure([capture, value](Config &config)
+        {
+            config.backtrace = capture;
+            config.backtraceLevel = value;
+        });
+#else
+        (void)capture;
+        (void)level;
+#endif
+    }
+
+    /**
+     * Sets where records logged from interrupt handlers go.
+     *
+     * When inIsr() returns true, a log call neither calls the prefix or
+     * suffix functions nor touches the normal output. The record is encoded
+     * in binary (strings are copied) and written to output, which must be
+     * safe to call from an interrupt, such as ThorIsrPrint. With output set
+     * to nullptr such records are dropped.
+     *
+     * \param output - ISR-safe output, e.g. a ThorIsrPrint
+     * \param inIsr - Function telling whether the caller is an interrupt
+     *                handler, e.g. thorlog_espidf_in_isr
+     * \return void
+     */
+    void setIsrOutput(ThorPrint *output, contextfunction inIsr)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        configure([output, inIsr](Config &config)
+        {
+            config.isrOutput = output;
+            config.inIsr = inIsr;
+        });
+#else
+        (void)output;
+        (void)inIsr;
+#endif
+    }
+
+    /**
+     * Records at level or more severe are flushed out of every output
+     * they went to before the log call returns, together with whatever
+     * those outputs held back before them. Records from interrupt
+     * handlers are never flushed.
+     *
+     * \param level - THORLOG_LEVEL_FATAL by default; THORLOG_LEVEL_SILENT
+     *                never flushes
+     * \return void
+     */
+    void setSyncLevel(int level)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        uint8_t value = static_cast<uint8_t>(thorlog_constrain(level, THORLOG_LEVEL_SILENT, THORLOG_LEVEL_VERBOSE));
+        configure([value](Config &config)
+        {
+            config.syncLevel = value;
+        });
+#else
+        (void)level;
+#endif
+    }
+
+    /**
+     * Flushes all outputs once bytes have been logged since the last
+     * flush, or with the first record logged intervalMs or more after it.
+     * Both are checked as records are written, so a quiet system keeps
+     * what its outputs buffer until the next record; the outputs with a
+     * task of their own (ThorStoragePrint, ThorUdpPrint) also flush on
+     * their interval.
+     *
+     * \param bytes - Bytes of records between flushes, 0 for no limit
+     * \param intervalMs - Longest time between flushes, 0 for no limit;
+     *                     needs setTimeSource()
+     * \return void
+     */
+    void setAutoFlush(size_t bytes, uint32_t intervalMs = 0)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        uint32_t limit = static_cast<uint32_t>((bytes < UINT32_MAX) ? bytes : UINT32_MAX);
+        configure([limit, intervalMs](Config &config)
+        {
+            config.flushBytes = limit;
+            config.flushIntervalMs = intervalMs;
+        });
+#else
+        (void)bytes;
+        (void)intervalMs;
+#endif
+    }
+
+    /**
+     * Flushes every output and the ISR output, waiting until they have
+     * written what they held back. Call before a deliberate reset, e.g.
+     * from a shutdown handler (thorlog_espidf_flush_on_restart()). Not for
+     * interrupt handlers.
+     *
+     * \return false if an output could not write everything
+     */
+    bool flush()
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        const ConfigLock lock(this);
+        return flushAll(lock.config());
+#else
+        return true;
+#endif
+    }
+
+    /**
+     * Sets where the THORLOG_STATS counters get the cycle count and core
+     * of a log call from. Has no effect without THORLOG_STATS.
+     *
+     * \param cycles - Cycle counter for the histogram, e.g.
+     *                 thorlog_espidf_cycles; nullptr leaves it empty
+     * \param coreId - Function returning the calling core, e.g.
+     *                 thorlog_espidf_core_id; nullptr keeps a single set
+     *                 of counters
+     * \return void
+     */
+    void setStatsSource(timefunction cycles, corefunction coreId)
+    {
+#if defined(THORLOG_STATS) && !defined(THORLOG_DISABLE_LOGGING)
+        configure([cycles, coreId](Config &config)
+        {
+            config.statsCycles = cycles;
+            config.statsCore = coreId;
+        });
+#else
+        (void)cycles;
+        (void)coreId;
+#endif
+    }
+
+    /**
+     * Adds up the counters of all cores and asks every output for its
+     * own statistics. Counters are only kept with THORLOG_STATS and are
+     * zero without it; the outputs' statistics are always filled in.
+     *
+     * \param stats - where the snapshot is stored
+     * \return void
+     */
+    void getStats(ThorLogStats *stats) const
+    {
+        memset(stats, 0, sizeof(*stats));
+#ifndef THORLOG_DISABLE_LOGGING
+#ifdef THORLOG_STATS
+        for (const StatsSlot &slot : _stats)
+        {
+            for (size_t i = 0; i <= THORLOG_LEVEL_VERBOSE; ++i)
+            {
+                stats->emitted[i] += slot.emitted[i].load(std::memory_order_relaxed);
+                stats->filtered[i] += slot.filtered[i].load(std::memory_order_relaxed);
+            }
+            stats->limited += slot.limited.load(std::memory_order_relaxed);
+            stats->isr += slot.isr.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < THORLOG_MAX_SINKS; ++i)
+            {
+                stats->bytes[i] += slot.bytes[i].load(std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < THORLOG_STATS_BUCKETS; ++i)
+            {
+                stats->cycles[i] += slot.cycles[i].load(std::memory_order_relaxed);
+            }
+            uint32_t longest = slot.maxCycles.load(std::memory_order_relaxed);
+            stats->maxCycles = (longest > stats->maxCycles) ? longest : stats->maxCycles;
+        }
+#endif
+        const ConfigLock lock(this);
+        const Config &config = lock.config();
+        for (size_t i = 0; i < THORLOG_MAX_SINKS; ++i)
+        {
+            ThorPrint *output = config.outputs[i];
+            if (output != nullptr)
+            {
+                output->getStats(&stats->sinks[i]);
+            }
+        }
+        if (config.isrOutput != nullptr)
+        {
+            config.isrOutput->getStats(&stats->isrSink);
+        }
+#endif
+    }
+
+    /**
+     * Sets the THORLOG_STATS counters back to zero. Calls logging at the
+     * same time may be counted before or after the reset.
+     *
+     * \return void
+     */
+    void resetStats()
+    {
+#if defined(THORLOG_STATS) && !defined(THORLOG_DISABLE_LOGGING)
+        for (StatsSlot &slot : _stats)
+        {
+            for (size_t i = 0; i <= THORLOG_LEVEL_VERBOSE; ++i)
+            {
+                slot.emitted[i].store(0, std::memory_order_relaxed);
+                slot.filtered[i].store(0, std::memory_order_relaxed);
+            }
+            slot.limited.store(0, std::memory_order_relaxed);
+            slot.isr.store(0, std::memory_order_relaxed);
+            for (std::atomic<uint32_t> &bytes : slot.bytes)
+            {
+                bytes.store(0, std::memory_order_relaxed);
+            }
+            for (std::atomic<uint32_t> &bucket : slot.cycles)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            slot.maxCycles.store(0, std::memory_order_relaxed);
+        }
+#endif
+    }
+
+    /**
+     * Writes the statistics to an output as text, one record per line,
+     * e.g. from a console command:
+     *
+     *     stats: emitted -=0 F=0 E=2 W=5 I=130 T=0 V=0
+     *     stats: output 1: 5210 bytes, dropped 3, queued 12/16
+     *     stats: cycles <128:12 <256:118 <1024:4, max 8790
+     *
+     * \param output - where the text goes; not through the log, so it is
+     *                 written whatever the level
+     * \return void
+     */
+    void printStats(ThorPrint *output) const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        ThorLogStats stats;
+        getStats(&stats);
+        static const char levels[] = "-FEWITV";
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            const uint32_t *counts = (pass == 0) ? stats.emitted : stats.filtered;
+            ThorRecord record(output);
+            record.print((pass == 0) ? "stats: emitted" : "stats: filtered");
+            for (size_t i = 0; i <= THORLOG_LEVEL_VERBOSE; ++i)
+            {
+                record.print(' ');
+                record.print(levels[i]);
+                record.print('=');
+                record.printUnsigned(counts[i]);
+            }
+            record.commit(THORLOG_CR);
+        }
+        {
+            ThorRecord record(output);
+            record.print("stats: limited ");
+            record.printUnsigned(stats.limited);
+            record.print(", isr ");
+            record.printUnsigned(stats.isr);
+            printSinkStats(record, stats.isrSink);
+            record.commit(THORLOG_CR);
+        }
+        const ConfigLock lock(this);
+        const Config &config = lock.config();
+        for (size_t i = 0; i < THORLOG_MAX_SINKS; ++i)
+        {
+            if (config.outputs[i] == nullptr)
+            {
+                continue;
+            }
+            ThorRecord record(output);
+            record.print("stats: output ");
+            record.printUnsigned(i);
+            record.print(": ");
+            record.printUnsigned(stats.bytes[i]);
+            record.print(" bytes");
+            printSinkStats(record, stats.sinks[i]);
+            record.commit(THORLOG_CR);
+        }
+        ThorRecord record(output);
+        record.print("stats: cycles");
+        for (size_t i = 0; i < THORLOG_STATS_BUCKETS; ++i)
+        {
+            if (stats.cycles[i] == 0)
+            {
+                continue;
+            }
+            bool last = (i == THORLOG_STATS_BUCKETS - 1);
+            record.print(last ? " >=" : " <");
+            record.printUnsigned(1ULL << (THORLOG_STATS_SHIFT + i - (last ? 1 : 0)));
+            record.print(':');
+            record.printUnsigned(stats.cycles[i]);
+        }
+        record.print(", max ");
+        record.printUnsigned(stats.maxCycles);
+        record.commit(THORLOG_CR);
+#else
+        (void)output;
+#endif
+    }
+
+    /**
+     * Format a binary record produced on this device back into text. The
+     * format string address in the record must be valid in this image;
+     * records with an interned ID show the ID and the arguments.
+     *
+     * \param out - record to render into
+     * \param data - binary record
+     * \param size - size of the binary record
+     * \param showLevel - whether to prefix the level tag
+     * \return the size of the binary record, or 0 if it is not valid
+     */
+    static size_t formatBinary(ThorRecord &out, const char *data, size_t size, bool showLevel = true)
+    {
+        return formatBinary(out, data, size, showLevel, [](uint64_t address) {
+            return reinterpret_cast<const char *>(static_cast<uintptr_t>(address));
+        });
+    }
+
+    /**
+     * Format a binary record whose addresses may not be valid, e.g. one
+     * left in RAM by the previous boot. stringAt(address) returns the
+     * string at an address, or nullptr if there is none; keys it does not
+     * know show as "?".
+     *
+     * \param out - record to render into
+     * \param data - binary record
+     * \param size - size of the binary record
+     * \param showLevel - whether to prefix the level tag
+     * \param stringAt - looks up the format, tag and key strings
+     * \return the size of the binary record, or 0 if it is not valid or
+     *         its format or tag is unknown; nothing is written then
+     */
+    template <class StringAt>
+    static size_t formatBinary(ThorRecord &out, const char *data, size_t size, bool showLevel, StringAt stringAt)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        ThorBinaryRecordInfo info;
+        ThorArg args[THORLOG_BINARY_MAX_ARGS];
+        long used = thorlog_decode_binary(reinterpret_cast<const uint8_t *>(data), size, &info, args, THORLOG_BINARY_MAX_ARGS);
+        if (used <= 0)
+        {
+            return 0;
+        }
+        const char *tag = (info.tag != 0) ? stringAt(info.tag) : nullptr;
+        const char *format = !info.interned ? stringAt(info.format) : nullptr;
+        if ((info.tag != 0 && tag == nullptr) || (!info.interned && format == nullptr))
+        {
+            return 0;
+        }
+        if (info.fields != nullptr)
+        {
+            thorlog_print_json_header(out, info.timestamp != 0, info.timestamp, info.level, tag, format);
+            thorlog_print_fields(out, info.fields, info.fieldsSize, stringAt);
+            printSkipped(out, info.skipped, true);
+            uint64_t frames[THORLOG_BACKTRACE_DEPTH];
+            printBacktrace(out, frames, thorlog_get_backtrace(&info, frames, THORLOG_BACKTRACE_DEPTH), true);
+            out.print('}');
+            if (info.cr)
+            {
+                out.print(THORLOG_CR);
+            }
+            return static_cast<size_t>(used);
+        }
+        if (showLevel && info.level >= THORLOG_LEVEL_FATAL && info.level <= THORLOG_LEVEL_VERBOSE)
+        {
+            out.print(thorlog_level_char(info.level));
+            out.print(": ");
+        }
+        if (tag != nullptr)
+        {
+            out.print(tag);
+            out.print(": ");
+        }
+        size_t argc = (info.argc < THORLOG_BINARY_MAX_ARGS) ? info.argc : THORLOG_BINARY_MAX_ARGS;
+        if (info.interned)
+        {
+            printInterned(out, static_cast<uint32_t>(info.format), args, argc);
+        }
+        else
+        {
+            print(out, format, args, argc);
+        }
+        printSkipped(out, info.skipped, false);
+        uint64_t frames[THORLOG_BACKTRACE_DEPTH];
+        printBacktrace(out, frames, thorlog_get_backtrace(&info, frames, THORLOG_BACKTRACE_DEPTH), false);
+        if (info.truncated)
+        {
+            out.print('~');
+        }
+        if (info.cr)
+        {
+            out.print(THORLOG_CR);
+        }
+        return static_cast<size_t>(used);
+#else
+        (void)out;
+        (void)data;
+        (void)size;
+        (void)showLevel;
+        (void)stringAt;
+        return 0;
+#endif
+    }
+
+    /**
+     * Format a message into a record without any level, prefix or suffix.
+     * Used to turn decoded binary records back into text.
+     *
+     * \param out - record to render into
+     * \param format - format string
+     * \param args - arguments
+     * \param argc - number of arguments
+     * \return void
+     */
+    static void format(ThorRecord &out, const char *format, const ThorArg *args, size_t argc)
+    {
+        print(out, format, args, argc);
+    }
+
+    /**
+     * Output a fatal error message. Output message contains
+     * F: followed by original message
+     * Fatal error messages are printed out at
+     * loglevels >= THORLOG_LEVEL_FATAL
+     *
+     * \param msg format string to output
+     * \param ... any number of variables
+     * \return void
+     */
+    template <class T, typename... Args>
+    void fatal(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_FATAL <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_FATAL, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    template <class T, typename... Args>
+    void fatalln(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_FATAL <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_FATAL, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    /**
+     * Output an error message. Output message contains
+     * E: followed by original message
+     * Error messages are printed out at
+     * loglevels >= THORLOG_LEVEL_ERROR
+     *
+     * \param msg format string to output
+     * \param ... any number of variables
+     * \return void
+     */
+    template <class T, typename... Args>
+    void error(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_ERROR <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_ERROR, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    template <class T, typename... Args>
+    void errorln(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_ERROR <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_ERROR, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    /**
+     * Output a warning message. Output message contains
+     * W: followed by original message
+     * Warning messages are printed out at
+     * loglevels >= THORLOG_LEVEL_WARNING
+     *
+     * \param msg format string to output
+     * \param ... any number of variables
+     * \return void
+     */
+    template <class T, typename... Args>
+    void warning(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_WARNING <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_WARNING, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    template <class T, typename... Args>
+    void warningln(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_WARNING <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_WARNING, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    /**
+     * Output a notice message. Output message contains
+     * N: followed by original message
+     * Notice messages are printed out at
+     * loglevels >= THORLOG_LEVEL_NOTICE
+     *
+     * \param msg format string to output
+     * \param ... any number of variables
+     * \return void
+     */
+    template <class T, typename... Args>
+    void notice(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_NOTICE <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_NOTICE, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    template <class T, typename... Args>
+    void noticeln(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_NOTICE <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_NOTICE, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    /**
+     * Output an info message. Output message contains
+     * I: followed by original message
+     * Info messages are printed out at
+     * loglevels >= THORLOG_LEVEL_INFO
+     *
+     * \param msg format string to output
+     * \param ... any number of variables
+     * \return void
+     */
+    template <class T, typename... Args>
+    void info(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_INFO <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_INFO, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    template <class T, typename... Args>
+    void infoln(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_INFO <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_INFO, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    /**
+     * Output a trace message. Output message contains
+     * T: followed by original message
+     * Trace messages are printed out at
+     * loglevels >= THORLOG_LEVEL_TRACE
+     *
+     * \param msg format string to output
+     * \param ... any number of variables
+     * \return void
+     */
+    template <class T, typename... Args>
+    void trace(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_TRACE <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_TRACE, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    template <class T, typename... Args>
+    void traceln(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_TRACE <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_TRACE, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    /**
+     * Output a verbose message. Output message contains
+     * V: followed by original message
+     * Verbose messages are printed out at
+     * loglevels >= THORLOG_LEVEL_VERBOSE
+     *
+     * \param msg format string to output
+     * \param ... any number of variables
+     * \return void
+     */
+    template <class T, typename... Args>
+    void verbose(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_VERBOSE <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_VERBOSE, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    template <class T, typename... Args>
+    void verboseln(T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (THORLOG_LEVEL_VERBOSE <= THORLOG_MIN_LEVEL)
+        {
+            printLevel(THORLOG_TAG_NONE, THORLOG_LEVEL_VERBOSE, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    /**
+     * Output a record through a rate limit; see THORLOG_EVERY_MS and
+     * THORLOG_COLLAPSE, which declare the limit for the call site.
+     *
+     * \param limit - state of the call site, usually a static ThorLogLimit
+     * \param level - level of the record
+     * \param cr - true to end the record with a newline
+     * \param msg format string to output
+     * \param ... any number of variables
+     * \return void
+     */
+    template <class T, typename... Args>
+    void printLimited(ThorLogLimit &limit, int level, bool cr, T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        printLevelLimited(limit, THORLOG_TAG_NONE, level, cr, msg, args...);
+#else
+        (void)limit;
+        (void)level;
+        (void)cr;
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    /**
+     * Output a message through a sampled call site; usually called
+     * through THORLOG_SAMPLE_EVERY() or THORLOG_SAMPLE_CHANCE(). Records
+     * that get through note the calls skipped before them.
+     *
+     * \param sample - state of the call site
+     * \param level - level of the record
+     * \param cr - whether to end the line
+     * \param msg format string to output
+     * \param ... any number of variables
+     * \return void
+     */
+    template <class T, typename... Args>
+    void printSampled(ThorLogSample &sample, int level, bool cr, T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        printLevelSampled(sample, THORLOG_TAG_NONE, level, cr, msg, args...);
+#else
+        (void)sample;
+        (void)level;
+        (void)cr;
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    /**
+     * Output a hex dump of a buffer, one record per line of
+     * THORLOG_HEXDUMP_WIDTH bytes, so any size can be dumped without a
+     * large buffer. In binary mode the bytes are sent raw, in structured
+     * records of up to THORLOG_HEXDUMP_CHUNK bytes each.
+     *
+     * \param level - level of the records
+     * \param data - bytes to dump; read in aligned words where possible
+     * \param size - number of bytes
+     * \param label - optional title; must be a string literal in binary mode
+     * \return void
+     */
+    void hexdump(int level, const void *data, size_t size, const char *label = nullptr)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        printDump(THORLOG_TAG_NONE, level, data, size, label);
+#else
+        (void)level;
+        (void)data;
+        (void)size;
+        (void)label;
+#endif
+    }
+
+private:
+    friend class ThorLogger;
+
+    // What a record carries besides its message: the calls a sampled call
+    // site skipped before it, and the backtrace of FATAL/ERROR records
+    struct RecordMeta
+    {
+        uint32_t skipped;
+        size_t depth;
+        uintptr_t frames[THORLOG_BACKTRACE_DEPTH];
+    };
+
+    // Every setting a record reads besides the levels. Published as a
+    // whole, see THORLOG_CONFIG_SLOTS.
+    struct Config
+    {
+        // outputs[0] is the output given to begin(), the rest are added
+        // with addOutput(); extraOutputs counts those
+        ThorPrint *outputs[THORLOG_MAX_SINKS] = {};
+        uint8_t outputLevels[THORLOG_MAX_SINKS] = {};
+        uint8_t extraOutputs = 0;
+        bool showLevel = true;
+        uint8_t mode = THORLOG_MODE_TEXT;
+        uint8_t timestampMode = THORLOG_TIMESTAMP_NONE;
+        // THORLOG_LEVEL_SILENT while no capture function is set
+        uint8_t backtraceLevel = THORLOG_LEVEL_SILENT;
+        uint8_t syncLevel = THORLOG_LEVEL_FATAL;
+        // 0 when the trigger is off
+        uint32_t flushBytes = 0;
+        uint32_t flushIntervalMs = 0;
+        printfunction prefix = nullptr;
+        printfunction suffix = nullptr;
+        timefunction timeSource = nullptr;
+        timefunction timestampSource = nullptr;
+        taskfunction taskName = nullptr;
+        corefunction coreId = nullptr;
+        taskcontextfunction context = nullptr;
+        backtracefunction backtrace = nullptr;
+        ThorPrint *isrOutput = nullptr;
+        contextfunction inIsr = nullptr;
+#ifdef THORLOG_STATS
+        timefunction statsCycles = nullptr;
+        corefunction statsCore = nullptr;
+#endif
+
+        // Index of output in outputs, THORLOG_MAX_SINKS if it is not there
+        size_t find(const ThorPrint *output) const
+        {
+            size_t i = 0;
+            while (i < THORLOG_MAX_SINKS && outputs[i] != output)
+            {
+                ++i;
+            }
+            return i;
+        }
+    };
+
+    struct ConfigSlot
+    {
+        // Log calls holding the slot, see ConfigLock
+        mutable std::atomic<uint32_t> readers{0};
+        std::atomic<bool> claimed{false};  // by a setter, until it is published
+        Config config;
+    };
+
+#ifndef THORLOG_DISABLE_LOGGING
+    /**
+     * Holds on to the current configuration while it lives, so that it
+     * is read in place: setters only write into slots that are neither
+     * current nor held. Neither side waits for the other; if a setter
+     * publishes between finding the slot and holding it, the hold is let
+     * go and taken again on the new one.
+     */
+    class ConfigLock
+    {
+    public:
+        explicit ConfigLock(const ThorLogging *log, uint32_t *published = nullptr)
+        {
+            // Pairs with the release store of the levels, so that a record
+            // let through by a new level finds the configuration set with it
+            std::atomic_thread_fence(std::memory_order_acquire);
+            for (;;)
+            {
+                uint32_t current = log->_config.load(std::memory_order_seq_cst);
+                _slot = &log->_configs[current & 0xFF];
+                _slot->readers.fetch_add(1, std::memory_order_seq_cst);
+                // A setter checks the current slot before the readers, so
+                // either it sees this hold or this sees its change
+                if (log->_config.load(std::memory_order_seq_cst) == current)
+                {
+                    if (published != nullptr)
+                    {
+                        *published = current;
+                    }
+                    return;
+                }
+                _slot->readers.fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        ~ConfigLock()
+        {
+            _slot->readers.fetch_sub(1, std::memory_order_release);
+        }
+
+        ConfigLock(const ConfigLock &) = delete;
+        ConfigLock &operator=(const ConfigLock &) = delete;
+
+        const Config &config() const
+        {
+            return _slot->config;
+        }
+
+    private:
+        const ConfigSlot *_slot;
+    };
+
+    /**
+     * Apply change to a copy of the current configuration and publish it.
+     * change may run more than once if other setters publish meanwhile.
+     * Setters only wait when THORLOG_CONFIG_SLOTS - 1 slots are taken by
+     * other setters or still held by log calls that started before them.
+     */
+    template <typename F>
+    void configure(F change)
+    {
+        ConfigSlot *slot = nullptr;
+        uint8_t index = 0;
+        while (slot == nullptr)
+        {
+            index = static_cast<uint8_t>(_configNext.fetch_add(1, std::memory_order_relaxed) % THORLOG_CONFIG_SLOTS);
+            bool expected = false;
+            if (_configs[index].claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            {
+                // Neither the current slot nor one still held is written
+                // over; the order of the two checks matters, see ConfigLock
+                if ((_config.load(std::memory_order_seq_cst) & 0xFF) != index &&
+                    _configs[index].readers.load(std::memory_order_seq_cst) == 0)
+                {
+                    slot = &_configs[index];
+                }
+                else
+                {
+                    _configs[index].claimed.store(false, std::memory_order_release);
+                }
+            }
+        }
+        for (;;)
+        {
+            uint32_t current;
+            {
+                const ConfigLock lock(this, &current);
+                slot->config = lock.config();
+            }
+            change(slot->config);
+            // The count in the upper bits tells a republished slot from
+            // the one this change was based on
+            uint32_t next = (current & ~static_cast<uint32_t>(0xFF)) + 0x100 + index;
+            if (_config.compare_exchange_strong(current, next, std::memory_order_seq_cst))
+            {
+                break;
+            }
+        }
+        slot->claimed.store(false, std::memory_order_release);
+    }
+
+    /**
+     * Writes each part of one record to every output whose level passes,
+     * so the record is formatted only once however many outputs there are.
+     */
+    class Fanout : public ThorWritePrint {
+    public:
+        Fanout(const ThorLogging *log, const Config &config, int level) : _log(log), _config(config), _level(level) {}
+
+        size_t write(const char *buffer, size_t size) override
+        {
+            return writeRecord(buffer, size, _level);
+        }
+
+        size_t writeRecord(const char *buffer, size_t size, int level) override
+        {
+            for (size_t i = 0; i < THORLOG_MAX_SINKS; ++i)
+            {
+                ThorPrint *output = _config.outputs[i];
+                if (output != nullptr && _level <= _config.outputLevels[i])
+                {
+                    output->writeRecord(buffer, size, level);
+                    _log->countBytes(_config, i, size);
+                }
+            }
+            return size;
+        }
+
+        bool flush() override
+        {
+            bool ok = true;
+            for (size_t i = 0; i < THORLOG_MAX_SINKS; ++i)
+            {
+                ThorPrint *output = _config.outputs[i];
+                if (output != nullptr && _level <= _config.outputLevels[i])
+                {
+                    ok = output->flush() && ok;
+                }
+            }
+            return ok;
+        }
+
+        bool empty() const
+        {
+            for (size_t i = 0; i < THORLOG_MAX_SINKS; ++i)
+            {
+                if (_config.outputs[i] != nullptr && _level <= _config.outputLevels[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        const ThorLogging *_log;
+        const Config &_config;
+        int _level;
+    };
+
+    // Adds the cycles between its construction and destruction to the
+    // histogram; empty without THORLOG_STATS
+    class StatsTimer
+    {
+    public:
+#ifdef THORLOG_STATS
+        StatsTimer(const ThorLogging *log, const Config &config)
+            : _log(log), _config(config),
+              _start((config.statsCycles != nullptr) ? static_cast<uint32_t>(config.statsCycles()) : 0)
+        {
+        }
+
+        ~StatsTimer()
+        {
+            if (_config.statsCycles != nullptr)
+            {
+                _log->countCycles(_config, static_cast<uint32_t>(_config.statsCycles()) - _start);
+            }
+        }
+
+    private:
+        const ThorLogging *_log;
+        const Config &_config;
+        uint32_t _start;
+#else
+        StatsTimer(const ThorLogging *, const Config &) {}
+#endif
+    };
+
+#ifdef THORLOG_STATS
+    // One per core, so that the cores do not write the same cache lines
+    struct alignas(16) StatsSlot
+    {
+        std::atomic<uint32_t> emitted[THORLOG_LEVEL_VERBOSE + 1];
+        std::atomic<uint32_t> filtered[THORLOG_LEVEL_VERBOSE + 1];
+        std::atomic<uint32_t> limited;
+        std::atomic<uint32_t> isr;
+        std::atomic<uint32_t> bytes[THORLOG_MAX_SINKS];
+        std::atomic<uint32_t> cycles[THORLOG_STATS_BUCKETS];
+        std::atomic<uint32_t> maxCycles;
+    };
+
+    StatsSlot &statsSlot(const Config &config) const
+    {
+        corefunction coreId = config.statsCore;
+        return _stats[(coreId != nullptr) ? static_cast<unsigned>(coreId()) % THORLOG_STATS_CORES : 0];
+    }
+
+    static size_t statsLevel(int level)
+    {
+        return static_cast<size_t>(thorlog_constrain(level, THORLOG_LEVEL_SILENT, THORLOG_LEVEL_VERBOSE));
+    }
+#endif
+
+    // Counter updates, compiled out without THORLOG_STATS. Relaxed atomic
+    // adds: tasks on the same core may still preempt each other. Filtered
+    // and limited calls hold no configuration yet and take one for this.
+    void countFiltered(int level) const
+    {
+#ifdef THORLOG_STATS
+        statsSlot(ConfigLock(this).config()).filtered[statsLevel(level)].fetch_add(1, std::memory_order_relaxed);
+#else
+        (void)level;
+#endif
+    }
+
+    void countEmitted(const Config &config, int level, bool isr) const
+    {
+#ifdef THORLOG_STATS
+        StatsSlot &slot = statsSlot(config);
+        slot.emitted[statsLevel(level)].fetch_add(1, std::memory_order_relaxed);
+        if (isr)
+        {
+            slot.isr.fetch_add(1, std::memory_order_relaxed);
+        }
+#else
+        (void)config;
+        (void)level;
+        (void)isr;
+#endif
+    }
+
+    void countLimited() const
+    {
+#ifdef THORLOG_STATS
+        countLimited(ConfigLock(this).config());
+#endif
+    }
+
+    void countLimited(const Config &config) const
+    {
+#ifdef THORLOG_STATS
+        statsSlot(config).limited.fetch_add(1, std::memory_order_relaxed);
+#else
+        (void)config;
+#endif
+    }
+
+    void countBytes(const Config &config, size_t output, size_t size) const
+    {
+#ifdef THORLOG_STATS
+        statsSlot(config).bytes[output].fetch_add(static_cast<uint32_t>(size), std::memory_order_relaxed);
+#else
+        (void)config;
+        (void)output;
+        (void)size;
+#endif
+    }
+
+#ifdef THORLOG_STATS
+    void countCycles(const Config &config, uint32_t cycles) const
+    {
+        size_t bucket = 0;
+        if (cycles >= (1UL << THORLOG_STATS_SHIFT))
+        {
+            bucket = static_cast<size_t>(31 - __builtin_clz(cycles)) - THORLOG_STATS_SHIFT + 1;
+            bucket = (bucket < THORLOG_STATS_BUCKETS) ? bucket : THORLOG_STATS_BUCKETS - 1;
+        }
+        StatsSlot &slot = statsSlot(config);
+        slot.cycles[bucket].fetch_add(1, std::memory_order_relaxed);
+        uint32_t longest = slot.maxCycles.load(std::memory_order_relaxed);
+        while (cycles > longest && !slot.maxCycles.compare_exchange_weak(longest, cycles, std::memory_order_relaxed))
+        {
+        }
+    }
+#endif
+
+    static void printSinkStats(ThorRecord &record, const ThorSinkStats &stats)
+    {
+        if (stats.dropped > 0 || stats.capacity > 0)
+        {
+            record.print(", dropped ");
+            record.printUnsigned(stats.dropped);
+        }
+        if (stats.capacity > 0)
+        {
+            record.print(", queued ");
+            record.printUnsigned(stats.highWater);
+            record.print('/');
+            record.printUnsigned(stats.capacity);
+        }
+    }
+
+    // Id of name among the first count tags, THORLOG_TAG_NONE if it is
+    // not there
+    uint8_t findTag(const char *name, uint8_t count) const
+    {
+        for (uint8_t id = 1; id <= count; ++id)
+        {
+            const char *tag = _tagNames[id].load(std::memory_order_acquire);
+            if (tag != nullptr && strcmp(tag, name) == 0)
+            {
+                return id;
+            }
+        }
+        return THORLOG_TAG_NONE;
+    }
+#endif
+
+    void setTagLevel(uint8_t id, int level)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (id == THORLOG_TAG_NONE || id > THORLOG_MAX_TAGS)
+        {
+            return;
+        }
+        _tagOverride[id].store(true, std::memory_order_relaxed);
+        _levels[id].store(static_cast<uint8_t>(thorlog_constrain(level, THORLOG_LEVEL_SILENT, THORLOG_LEVEL_VERBOSE)),
+                          std::memory_order_relaxed);
+#else
+        (void)id;
+        (void)level;
+#endif
+    }
+
+    int getTagLevel(uint8_t id) const
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        return _levels[(id <= THORLOG_MAX_TAGS) ? id : THORLOG_TAG_NONE].load(std::memory_order_relaxed);
+#else
+        (void)id;
+        return THORLOG_LEVEL_SILENT;
+#endif
+    }
+
+    void clearTagLevel(uint8_t id)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (id == THORLOG_TAG_NONE || id > THORLOG_MAX_TAGS)
+        {
+            return;
+        }
+        _tagOverride[id].store(false, std::memory_order_relaxed);
+        _levels[id].store(_levels[THORLOG_TAG_NONE].load(std::memory_order_relaxed), std::memory_order_relaxed);
+#else
+        (void)id;
+#endif
+    }
+
+    static void print(ThorRecord &out, const char *format, const ThorArg *args, size_t argc)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        size_t next = 0;
+        while (*format != '\0')
+        {
+            if (*format == '%')
+            {
+                const char *conversion = format + thorlog_specifier_conversion(format, SIZE_MAX, 0);
+                if (*conversion == '\0')
+                    break;
+                printFormat(out, *conversion, args, argc, &next, thorlog_specifier_precision(format, SIZE_MAX, 0));
+                format = conversion + 1;
+            }
+            else
+            {
+                // Copy the literal run up to the next specifier in one go
+                const char *run = format;
+                while (*format != '\0' && *format != '%')
+                {
+                    ++format;
+                }
+                out.write(run, static_cast<size_t>(format - run));
+            }
+        }
+#else
+        (void)out;
+        (void)format;
+        (void)args;
+        (void)argc;
+#endif
+    }
+
+    static void printFormat(ThorRecord &out, const char format, const ThorArg *args, size_t argc, size_t *next,
+                            int precision)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (format == '%')
+        {
+            out.print('%');
+            return;
+        }
+        if (thorlog_check_specifier(format, ThorArg::NONE, 0) == THORLOG_FORMAT_UNKNOWN_SPECIFIER)
+        {
+            return;
+        }
+        if (*next >= argc)
+        {
+            // More specifiers than arguments
+            return;
+        }
+        const ThorArg &arg = args[(*next)++];
+        switch (format)
+        {
+            case 's': printSpec<'s'>(out, arg); break;
+            case 'c': printSpec<'c'>(out, arg); break;
+            case 'C': printSpec<'C'>(out, arg); break;
+            case 'd': printSpec<'d'>(out, arg); break;
+            case 'i': printSpec<'i'>(out, arg); break;
+            case 'l': printSpec<'l'>(out, arg); break;
+            case 'u': printSpec<'u'>(out, arg); break;
+            case 'x': printSpec<'x'>(out, arg); break;
+            case 'X': printSpec<'X'>(out, arg); break;
+            case 'b': printSpec<'b'>(out, arg); break;
+            case 'B': printSpec<'B'>(out, arg); break;
+            case 't': printSpec<'t'>(out, arg); break;
+            case 'T': printSpec<'T'>(out, arg); break;
+            case 'D': printSpec<'D'>(out, arg, precision); break;
+            case 'F': printSpec<'F'>(out, arg, precision); break;
+            case 'p': printSpec<'p'>(out, arg); break;
+        }
+#else
+        (void)out;
+        (void)format;
+        (void)args;
+        (void)argc;
+        (void)next;
+        (void)precision;
+#endif
+    }
+
+    /**
+     * Render one conversion. Shared by the runtime formatter and the
+     * compile-time emitter, which instantiates it directly for each
+     * conversion in a THORLOG_FMT string. precision is the number of
+     * fraction digits for %D and %F, -1 for the default.
+     */
+    template <char Spec>
+    static void printSpec(ThorRecord &out, const ThorArg &arg, int precision = -1)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if constexpr (Spec == 's')
+        {
+            if (arg.type == ThorArg::STRING && arg.len != ThorArg::NUL_TERMINATED)
+            {
+                out.write(arg.s, arg.len);
+            }
+            else
+            {
+                out.print(arg.toString());
+            }
+        }
+        else if constexpr (Spec == 'c')
+        {
+            out.print(static_cast<char>(arg.toLong()));
+        }
+        else if constexpr (Spec == 'C')
+        {
+            int c = static_cast<int>(arg.toLong());
+            if (c >= 0x20 && c < 0x7F)
+            {
+                out.print(static_cast<char>(c));
+            }
+            else
+            {
+                out.print("0x");
+                out.printUnsigned(static_cast<unsigned int>(c), THORLOG_HEX, 2);
+            }
+        }
+        else if constexpr (Spec == 'd' || Spec == 'i')
+        {
+            out.printSigned(static_cast<int>(arg.toLong()));
+        }
+        else if constexpr (Spec == 'l')
+        {
+            out.printSigned(arg.toInt64());
+        }
+        else if constexpr (Spec == 'u')
+        {
+            out.printUnsigned(arg.toUInt64());
+        }
+        else if constexpr (Spec == 'x')
+        {
+            out.printUnsigned(arg.toUInt64(), THORLOG_HEX);
+        }
+        else if constexpr (Spec == 'X')
+        {
+            // Zero-padded to the width of the argument: 8 digits, or 16 for
+            // 64-bit values
+            out.print("0x");
+            out.printUnsigned(arg.toUInt64(), THORLOG_HEX, (arg.size > 4) ? 16 : 8);
+        }
+        else if constexpr (Spec == 'b')
+        {
+            out.printUnsigned(arg.toUInt64(), THORLOG_BIN);
+        }
+        else if constexpr (Spec == 'B')
+        {
+            out.print("0b");
+            out.printUnsigned(arg.toUInt64(), THORLOG_BIN);
+        }
+        else if constexpr (Spec == 't')
+        {
+            out.print(arg.u ? "t" : "f");
+        }
+        else if constexpr (Spec == 'T')
+        {
+            out.print(arg.u ? "true" : "false");
+        }
+        else if constexpr (Spec == 'D' || Spec == 'F')
+        {
+            unsigned digits = (precision >= 0) ? static_cast<unsigned>(precision) : THORLOG_DEFAULT_PRECISION;
+            if (arg.type == ThorArg::FLOAT)
+            {
+                out.printFloat(arg.f, digits);
+            }
+            else
+            {
+                out.printDouble(arg.toDouble(), digits);
+            }
+        }
+        else if constexpr (Spec == 'p')
+        {
+            out.print("0x");
+            out.printUnsigned(reinterpret_cast<uintptr_t>(arg.p), THORLOG_HEX);
+        }
+#else
+        (void)out;
+        (void)arg;
+        (void)precision;
+#endif
+    }
+
+    /**
+     * Append a backtrace: " bt: 0x400d1234 0x400d5678", or a "backtrace"
+     * array of hex strings in JSON lines.
+     */
+    template <typename Frame>
+    static void printBacktrace(ThorRecord &out, const Frame *frames, size_t depth, bool json)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (depth == 0)
+        {
+            return;
+        }
+        out.print(json ? ",\"backtrace\":[" : " bt:");
+        for (size_t i = 0; i < depth; ++i)
+        {
+            out.print(json ? ((i > 0) ? ",\"0x" : "\"0x") : " 0x");
+            out.printUnsigned(static_cast<uint64_t>(frames[i]), THORLOG_HEX);
+            if (json)
+            {
+                out.print('"');
+            }
+        }
+        if (json)
+        {
+            out.print(']');
+        }
+#else
+        (void)out;
+        (void)frames;
+        (void)depth;
+        (void)json;
+#endif
+    }
+
+    /**
+     * Note the calls a sampled call site skipped before this record:
+     * " (12 skipped)", or a "skipped" member in JSON lines.
+     */
+    static void printSkipped(ThorRecord &out, uint64_t skipped, bool json)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (skipped != 0)
+        {
+            out.print(json ? ",\"skipped\":" : " (");
+            out.printUnsigned(skipped);
+            if (!json)
+            {
+                out.print(" skipped)");
+            }
+        }
+#else
+        (void)out;
+        (void)skipped;
+        (void)json;
+#endif
+    }
+
+    /**
+     * Render a record whose format string is not in the image: the
+     * interned ID, then each argument in its default form.
+     */
+    static void printInterned(ThorRecord &out, uint32_t id, const ThorArg *args, size_t argc)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        out.print('#');
+        out.printUnsigned(id, THORLOG_HEX);
+        for (size_t i = 0; i < argc; ++i)
+        {
+            out.print(' ');
+            switch (args[i].type)
+            {
+            case ThorArg::INT: printSpec<'l'>(out, args[i]); break;
+            case ThorArg::UINT: printSpec<'u'>(out, args[i]); break;
+            case ThorArg::DOUBLE:
+            case ThorArg::FLOAT: printSpec<'D'>(out, args[i]); break;
+            case ThorArg::STRING: printSpec<'s'>(out, args[i]); break;
+            case ThorArg::POINTER: printSpec<'p'>(out, args[i]); break;
+            default: break;
+            }
+        }
+#else
+        (void)out;
+        (void)id;
+        (void)args;
+        (void)argc;
+#endif
+    }
+
+    /**
+     * Compile-time emitter for THORLOG_FMT strings. Each instantiation
+     * writes the literal run starting at Pos, renders the conversion that
+     * ends it with the first remaining argument, and recurses on the rest.
+     */
+    template <class F, size_t Pos>
+    static void printStatic(ThorRecord &out)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        constexpr size_t spec = thorlog_next_specifier(F::c_str(), F::size(), Pos);
+        if constexpr (spec > Pos)
+        {
+            out.write(F::c_str() + Pos, spec - Pos);
+        }
+        if constexpr (spec + 1 < F::size())
+        {
+            // Only %% can be left once the arguments run out
+            out.print('%');
+            printStatic<F, spec + 2>(out);
+        }
+#else
+        (void)out;
+#endif
+    }
+
+    template <class F, size_t Pos, typename A, typename... Rest>
+    static void printStatic(ThorRecord &out, const A &arg, const Rest &...rest)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        constexpr size_t spec = thorlog_next_specifier(F::c_str(), F::size(), Pos);
+        if constexpr (spec > Pos)
+        {
+            out.write(F::c_str() + Pos, spec - Pos);
+        }
+        constexpr size_t end = thorlog_specifier_conversion(F::c_str(), F::size(), spec);
+        if constexpr (end < F::size())
+        {
+            constexpr char conversion = F::c_str()[end];
+            if constexpr (conversion == '%')
+            {
+                out.print('%');
+                printStatic<F, end + 1>(out, arg, rest...);
+            }
+            else
+            {
+                constexpr int precision = thorlog_specifier_precision(F::c_str(), F::size(), spec);
+                printSpec<conversion>(out, thorlog_make_arg(arg), precision);
+                printStatic<F, end + 1>(out, rest...);
+            }
+        }
+#else
+        (void)out;
+        (void)arg;
+        ((void)rest, ...);
+#endif
+    }
+
+    // Both return the bytes written
+    template <typename Format, typename... Args>
+    size_t printBinary(const Config &config, ThorPrint *output, int level, bool cr, const RecordMeta &meta, Format format,
+                       const char *tag, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        ThorBinaryRecord record(level, cr, (config.timeSource != nullptr) ? config.timeSource() : 0, format, tag);
+        if (meta.skipped != 0)
+        {
+            record.addSkipped(meta.skipped);
+        }
+        if (meta.depth != 0)
+        {
+            record.addBacktrace(meta.frames, meta.depth);
+        }
+        if constexpr (sizeof...(Args) > 0 && (thorlog_is_field<Args>::value && ...))
+        {
+            record.beginFields();
+            (void)(thorlog_add_field(record, args) && ...);
+        }
+        else
+        {
+            (void)(record.add(thorlog_make_arg(args)) && ...);
+        }
+        const char *data = record.data();
+        output->writeRecord(data, record.size(), level);
+        return record.size();
+#else
+        return 0;
+#endif
+    }
+
+    // Structured records are JSON lines; prefix, suffix and task info are
+    // left out so that every line parses, the scoped context is added as
+    // members
+    template <typename... Fields>
+    size_t printFields(const Config &config, ThorPrint *output, int level, bool cr, const RecordMeta &meta,
+                       const char *tagName, const char *msg, Fields... fields)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        ThorRecord record(output, level);
+        timefunction timeSource = config.timeSource;
+        thorlog_print_json_header(record, timeSource != nullptr, (timeSource != nullptr) ? timeSource() : 0, level,
+                                  tagName, msg);
+        (thorlog_print_json_field(record, fields), ...);
+        const ThorTaskContext *context = (config.context != nullptr) ? config.context(false) : nullptr;
+        if (context != nullptr)
+        {
+            record.write(context->json, context->jsonLen);
+        }
+        printSkipped(record, meta.skipped, true);
+        printBacktrace(record, meta.frames, meta.depth, true);
+        record.print('}');
+        record.commit(cr ? THORLOG_CR : nullptr);
+        return record.sent();
+#else
+        return 0;
+#endif
+    }
+
+    // With a single output the record goes to it directly; with more, it
+    // goes through the fan-out, which skips outputs set to a lower level.
+    // nullptr if no output takes the level. With THORLOG_STATS records
+    // always go through the fan-out, which counts the bytes per output.
+#ifndef THORLOG_DISABLE_LOGGING
+    static ThorPrint *pickOutput(const Config &config, Fanout &fanout, int level)
+    {
+#ifndef THORLOG_STATS
+        if (config.extraOutputs == 0)
+        {
+            ThorPrint *output = config.outputs[0];
+            if (output == nullptr || level > config.outputLevels[0])
+            {
+                return nullptr;
+            }
+            return output;
+        }
+#else
+        (void)config;
+        (void)level;
+#endif
+        return fanout.empty() ? nullptr : &fanout;
+    }
+
+    // Drains the ISR output first, as it writes into the other outputs
+    bool flushAll(const Config &config)
+    {
+        _unflushed.store(0, std::memory_order_relaxed);
+        if (config.timeSource != nullptr)
+        {
+            _lastFlush.store(static_cast<uint32_t>(config.timeSource() / 1000), std::memory_order_relaxed);
+        }
+        bool ok = (config.isrOutput == nullptr) || config.isrOutput->flush();
+        for (size_t i = 0; i < THORLOG_MAX_SINKS; ++i)
+        {
+            if (config.outputs[i] != nullptr)
+            {
+                ok = config.outputs[i]->flush() && ok;
+            }
+        }
+        return ok;
+    }
+
+    // After a record of size bytes went to output: flushes that output at
+    // the sync level, and all of them when an auto-flush limit is reached
+    void finishRecord(const Config &config, ThorPrint *output, int level, size_t size)
+    {
+        if (level != THORLOG_LEVEL_SILENT && level <= config.syncLevel)
+        {
+            output->flush();
+        }
+        if (config.flushBytes == 0 && config.flushIntervalMs == 0)
+        {
+            return;
+        }
+        bool due = false;
+        if (config.flushBytes != 0)
+        {
+            uint32_t added = static_cast<uint32_t>(size);
+            due = _unflushed.fetch_add(added, std::memory_order_relaxed) + added >= config.flushBytes;
+        }
+        if (!due && config.flushIntervalMs != 0 && config.timeSource != nullptr)
+        {
+            // Milliseconds in 32 bits, compared by difference
+            uint32_t now = static_cast<uint32_t>(config.timeSource() / 1000);
+            due = now - _lastFlush.load(std::memory_order_relaxed) >= config.flushIntervalMs;
+        }
+        if (due)
+        {
+            flushAll(config);
+        }
+    }
+#endif
+
+    // Everything a text record starts with: context, prefix, level and tag
+    static void printHead(const Config &config, ThorRecord &record, int level, const char *tagName)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        _showLevel = showLevel;
+        printContext(config, record);
+
+        if (config.prefix != nullptr)
+        {
+            config.prefix(&record, level);
+        }
+
+        if (config.showLevel)
+        {
+            record.print(thorlog_level_char(level));
+            record.print(": ");
+        }
+
+        if (tagName != nullptr)
+        {
+            record.print(tagName);
+            record.print(": ");
+        }
+
+        const ThorTaskContext *context = (config.context != nullptr) ? config.context(false) : nullptr;
+        if (context != nullptr)
+        {
+            record.write(context->text, context->textLen);
+        }
+#else
+        (void)config;
+        (void)record;
+        (void)level;
+        (void)tagName;
 #endif
     }
 
-    /**
-     * Get whether the log level is shown during logging
-     *
-     * \return true if the log level is be shown for each log
-     *         false otherwise.
-     */
-    bool getShowLevel() const
+    static void printContext(const Config &config, ThorRecord &record)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        return _showLevel;
+        uint8_t mode = config.timestampMode;
+        if (mode != THORLOG_TIMESTAMP_NONE)
+        {
+            timefunction source = (config.timestampSource != nullptr) ? config.timestampSource : config.timeSource;
+            if (source != nullptr)
+            {
+                uint64_t stamp = source();
+                record.printUnsigned((mode == THORLOG_TIMESTAMP_MS) ? stamp / 1000 : stamp);
+                record.print(' ');
+            }
+        }
+
+        taskfunction taskName = config.taskName;
+        corefunction coreId = config.coreId;
+        if (taskName != nullptr || coreId != nullptr)
+        {
+            record.print('[');
+            if (taskName != nullptr)
+            {
+                const char *name = taskName();
+                record.print((name != nullptr) ? name : "?");
+            }
+            if (coreId != nullptr)
+            {
+                if (taskName != nullptr)
+                {
+                    record.print('/');
+                }
+                record.printSigned(coreId());
+            }
+            record.print("] ");
+        }
 #else
-        return false;
+        (void)config;
+        (void)record;
 #endif
     }
 
-    /**
-     * Sets a function to be called before each log command.
-     *
-     * \param f - The function to be called
-     * \return void
-     */
-    void setPrefix(printfunction f)
+    void printDump(uint8_t tag, int level, const void *data, size_t size, const char *label)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (level > THORLOG_MIN_LEVEL)
+        {
+            return;
+        }
+        if (level > _levels[tag].load(std::memory_order_relaxed) || data == nullptr)
+        {
+            countFiltered(level);
+            return;
+        }
+        if (level < THORLOG_LEVEL_SILENT)
+        {
+            level = THORLOG_LEVEL_SILENT;
+        }
+        const ConfigLock lock(this);
+        const Config &config = lock.config();
+        StatsTimer timer(this, config);
+        const char *tagName = (tag != THORLOG_TAG_NONE) ? _tagNames[tag].load(std::memory_order_relaxed) : nullptr;
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+        ThorPrint *output = nullptr;
+        Fanout fanout(this, config, level);
+        bool binary = true;
+        bool isr = (config.inIsr != nullptr && config.inIsr());
+        if (isr)
+        {
+            output = config.isrOutput;
+        }
+        else
+        {
+            output = pickOutput(config, fanout, level);
+            binary = (config.mode == THORLOG_MODE_BINARY);
+        }
+        if (output == nullptr)
+        {
+            return;
+        }
+        countEmitted(config, level, isr);
+
+        size_t sent = 0;
+        if (binary)
+        {
+            // Half a record leaves room for the header and the keys
+            constexpr size_t chunk = (THORLOG_HEXDUMP_CHUNK < THORLOG_RECORD_SIZE / 2) ? THORLOG_HEXDUMP_CHUNK
+                                                                                       : THORLOG_RECORD_SIZE / 2;
+            timefunction timeSource = config.timeSource;
+            for (size_t offset = 0; offset < size || offset == 0; offset += chunk)
+            {
+                size_t n = (size - offset < chunk) ? size - offset : chunk;
+                ThorBinaryRecord record(level, true, (timeSource != nullptr) ? timeSource() : 0,
+                                        (label != nullptr) ? label : "hexdump", tagName);
+                record.beginFields();
+                record.addField("offset", thorlog_make_arg(offset), false);
+                record.addBytesField("data", bytes + offset, n);
+                const char *encoded = record.data();
+                output->writeRecord(encoded, record.size(), level);
+                sent += record.size();
+                if (size == 0)
+                {
+                    break;
+                }
+            }
+            if (!isr)
+            {
+                finishRecord(config, output, level, sent);
+            }
+            return;
+        }
+
+        if (label != nullptr)
+        {
+            ThorRecord record(output, level);
+            printHead(config, record, level, tagName);
+            record.print(label);
+            record.print(" (");
+            record.printUnsigned(size);
+            record.print(" bytes)");
+            record.commit(THORLOG_CR);
+            sent += record.sent();
+        }
+        size_t digits = (size > 0x10000) ? 8 : 4;
+        char line[THORLOG_HEXDUMP_LINE_SIZE];
+        for (size_t offset = 0; offset < size; offset += THORLOG_HEXDUMP_WIDTH)
+        {
+            size_t n = (size - offset < THORLOG_HEXDUMP_WIDTH) ? size - offset : THORLOG_HEXDUMP_WIDTH;
+            ThorRecord record(output, level);
+            printHead(config, record, level, tagName);
+            record.write(line, thorlog_format_dump_line(line, offset, digits, bytes + offset, n));
+            record.commit(THORLOG_CR);
+            sent += record.sent();
+        }
+        finishRecord(config, output, level, sent);
+#else
+        (void)tag;
+        (void)level;
+        (void)data;
+        (void)size;
+        (void)label;
+#endif
+    }
+
+#ifndef THORLOG_DISABLE_LOGGING
+    // Structured call sites report in kind, so their output stays JSON lines
+    template <class T, typename... Args>
+    void printSuppressed(const Config &config, uint8_t tag, int level, bool repeated, uint32_t count)
+    {
+        if constexpr (sizeof...(Args) > 0 && (thorlog_is_field<Args>::value && ...))
+        {
+            printRecord(config, tag, level, true, 0, repeated ? "repeated" : "suppressed", thorlog_kv("count", count));
+        }
+        else
+        {
+            printRecord(config, tag, level, true, 0,
+                        repeated ? "last message repeated %u times" : "%u similar messages suppressed", count);
+        }
+    }
+#endif
+
+    template <class T, typename... Args>
+    void printLevelLimited(ThorLogLimit &limit, uint8_t tag, int level, bool cr, T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (level > THORLOG_MIN_LEVEL)
+        {
+            return;
+        }
+        if (level > _levels[tag].load(std::memory_order_relaxed))
+        {
+            countFiltered(level);
+            return;
+        }
+
+        // One configuration for the time source and the records that follow
+        const ConfigLock lock(this);
+        const Config &config = lock.config();
+
+        // Milliseconds in 32 bits; deadlines are compared by difference so
+        // the wrap after 49 days does not matter
+        uint32_t now = (config.timeSource != nullptr) ? static_cast<uint32_t>(config.timeSource() / 1000) : 0;
+        bool armed = limit._armed.load(std::memory_order_relaxed);
+        bool timed = limit._intervalMs != 0 && config.timeSource != nullptr;
+        uint32_t deadline = limit._deadline.load(std::memory_order_relaxed);
+        bool due = !armed || !timed || static_cast<int32_t>(now - deadline) >= 0;
+        // Of the tasks that find the interval over, only the one that moves
+        // the deadline on gets to emit
+        bool claimed = due && (!timed || limit._deadline.compare_exchange_strong(deadline, now + limit._intervalMs,
+                                                                                 std::memory_order_relaxed));
+
+        if (limit._collapse)
+        {
+            const ThorArg argv[sizeof...(Args) + 1] = { thorlog_value_arg(args)..., ThorArg() };
+            uint32_t hash = thorlog_hash_args(THORLOG_FNV_OFFSET, argv, sizeof...(Args));
+            if (limit._hash.exchange(hash, std::memory_order_relaxed) == hash && armed)
+            {
+                limit._suppressed.fetch_add(1, std::memory_order_relaxed);
+                countLimited(config);
+                if (!claimed || limit._intervalMs == 0)
+                {
+                    return;
+                }
+                uint32_t repeated = limit._suppressed.exchange(0, std::memory_order_relaxed);
+                printSuppressed<T, Args...>(config, tag, level, true, repeated);
+                return;
+            }
+            // A new message always goes out and starts the interval again
+            if (!claimed)
+            {
+                limit._deadline.store(now + limit._intervalMs, std::memory_order_relaxed);
+            }
+        }
+        else if (!claimed)
+        {
+            limit._suppressed.fetch_add(1, std::memory_order_relaxed);
+            countLimited(config);
+            return;
+        }
+
+        limit._armed.store(true, std::memory_order_relaxed);
+        uint32_t suppressed = limit._suppressed.exchange(0, std::memory_order_relaxed);
+        if (suppressed > 0)
+        {
+            printSuppressed<T, Args...>(config, tag, level, limit._collapse, suppressed);
+        }
+        printRecord(config, tag, level, cr, 0, msg, args...);
+#else
+        (void)limit;
+        (void)tag;
+        (void)level;
+        (void)cr;
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    // The sampling decision is taken after the level check and before
+    // anything is formatted
+    template <class T, typename... Args>
+    void printLevelSampled(ThorLogSample &sample, uint8_t tag, int level, bool cr, T msg, Args... args)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        if (level > THORLOG_MIN_LEVEL)
+        {
+            return;
+        }
+        if (level > _levels[tag].load(std::memory_order_relaxed))
+        {
+            countFiltered(level);
+            return;
+        }
+        uint32_t skipped = 0;
+        if (!sample.take(skipped))
+        {
+            countLimited();
+            return;
+        }
+        printMessage(tag, level, cr, skipped, msg, args...);
+#else
+        (void)sample;
+        (void)tag;
+        (void)level;
+        (void)cr;
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    template <class T, typename... Args>
+    void printLevel(uint8_t tag, int level, bool cr, T msg, Args... args)
+    {
+        printMessage(tag, level, cr, 0, msg, args...);
+    }
+
+    // skipped is non-zero only for sampled records
+    template <class T, typename... Args>
+    void printMessage(uint8_t tag, int level, bool cr, uint32_t skipped, T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        _prefix = f;
+        // The global level sits in slot THORLOG_TAG_NONE, so tagged and
+        // untagged calls alike are filtered by one byte load and compare
+        if (level > _levels[tag].load(std::memory_order_relaxed))
+        {
+            countFiltered(level);
+            return;
+        }
+        // The whole record is written with this one configuration, however
+        // the settings change meanwhile
+        const ConfigLock lock(this);
+        printRecord(lock.config(), tag, level, cr, skipped, msg, args...);
+#else
+        (void)tag;
+        (void)level;
+        (void)cr;
+        (void)skipped;
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
+#ifndef THORLOG_DISABLE_LOGGING
+    // Writes a record that passed the level check with the configuration
+    // held by the caller
+    template <class T, typename... Args>
+    void printRecord(const Config &config, uint8_t tag, int level, bool cr, uint32_t skipped, T msg, Args... args)
+    {
+        constexpr bool staticFormat = std::is_base_of<ThorFormatString, T>::value;
+        constexpr bool structured = sizeof...(Args) > 0 && (thorlog_is_field<Args>::value && ...);
+        static_assert(structured || !(thorlog_is_field<Args>::value || ...),
+                      "ThorLog: thorlog_kv() fields can not be mixed with format arguments");
+        if constexpr (staticFormat && !structured)
+        {
+            constexpr ThorFormatCheck check = thorlog_check_format<T, Args...>();
+            static_assert(check != THORLOG_FORMAT_TOO_FEW_ARGS, "ThorLog: format string has more conversions than arguments");
+            static_assert(check != THORLOG_FORMAT_TOO_MANY_ARGS, "ThorLog: format string has fewer conversions than arguments");
+            static_assert(check != THORLOG_FORMAT_UNKNOWN_SPECIFIER, "ThorLog: unknown conversion in format string");
+            static_assert(check != THORLOG_FORMAT_TYPE_MISMATCH, "ThorLog: argument type does not match its conversion");
+        }
+
+        if (level < THORLOG_LEVEL_SILENT)
+        {
+            level = THORLOG_LEVEL_SILENT;
+        }
+        StatsTimer timer(this, config);
+
+        // Interned formats go out as their ID; stripped ones are never
+        // referenced at run time, so the literal is left out of the image
+        constexpr bool interned = THORLOG_INTERN != THORLOG_INTERN_OFF && staticFormat && !structured;
+        constexpr bool stripped = interned && THORLOG_INTERN == THORLOG_INTERN_STRIP;
+        const void *formatAddress = nullptr;
+        if constexpr (staticFormat && !stripped)
+        {
+            formatAddress = T::c_str();
+        }
+        else if constexpr (!staticFormat)
+        {
+            formatAddress = msg;
+        }
+        ThorFormatId formatId{0};
+        if constexpr (interned)
+        {
+            constexpr uint32_t id = thorlog_intern_id(T::c_str(), T::size());
+            formatId.value = id;
+        }
+        const char *tagName = (tag != THORLOG_TAG_NONE) ? _tagNames[tag].load(std::memory_order_relaxed) : nullptr;
+        RecordMeta meta;
+        meta.skipped = skipped;
+        meta.depth = 0;
+
+        // Interrupt handlers never reach the normal output: their records
+        // are encoded in binary and left to the ISR output to drain
+        if (config.inIsr != nullptr && config.inIsr())
+        {
+            if (config.isrOutput != nullptr)
+            {
+                if constexpr (stripped)
+                {
+                    printBinary(config, config.isrOutput, level, cr, meta, formatId, tagName, args...);
+                }
+                else
+                {
+                    printBinary(config, config.isrOutput, level, cr, meta, formatAddress, tagName, args...);
+                }
+                countEmitted(config, level, true);
+            }
+            return;
+        }
+
+        Fanout fanout(this, config, level);
+        ThorPrint *output = pickOutput(config, fanout, level);
+        if (output == nullptr)
+        {
+            return;
+        }
+        countEmitted(config, level, false);
+
+        if (level <= config.backtraceLevel && config.backtrace != nullptr)
+        {
+            meta.depth = config.backtrace(meta.frames, THORLOG_BACKTRACE_DEPTH);
+        }
+
+        if (config.mode == THORLOG_MODE_BINARY)
+        {
+            size_t size;
+            if constexpr (interned)
+            {
+                size = printBinary(config, output, level, cr, meta, formatId, tagName, args...);
+            }
+            else
+            {
+                size = printBinary(config, output, level, cr, meta, formatAddress, tagName, args...);
+            }
+            finishRecord(config, output, level, size);
+            return;
+        }
+
+        if constexpr (structured)
+        {
+            size_t size = printFields(config, output, level, cr, meta, tagName, static_cast<const char *>(formatAddress),
+                                      args...);
+            finishRecord(config, output, level, size);
+            return;
+        }
+
+        ThorRecord record(output, level);
+        printHead(config, record, level, tagName);
+
+        if constexpr (stripped)
+        {
+            const ThorArg argv[sizeof...(Args) + 1] = { thorlog_make_arg(args)..., ThorArg() };
+            printInterned(record, formatId.value, argv, sizeof...(Args));
+        }
+        else if constexpr (staticFormat && !structured)
+        {
+            printStatic<T, 0>(record, args...);
+        }
+        else if constexpr (!structured)
+        {
+            const ThorArg argv[sizeof...(Args) + 1] = { thorlog_make_arg(args)..., ThorArg() };
+            print(record, msg, argv, sizeof...(Args));
+        }
+        printSkipped(record, meta.skipped, false);
+        printBacktrace(record, meta.frames, meta.depth, false);
+
+        if (config.suffix != nullptr)
+        {
+            config.suffix(&record, level);
+        }
+
+        record.commit(cr ? THORLOG_CR : nullptr);
+        finishRecord(config, output, level, record.sent());
+    }
+#endif
+
+#ifndef THORLOG_DISABLE_LOGGING
+    // Read on every log call from any task or core; single-word atomics
+    // so that no lock is needed. _levels[THORLOG_TAG_NONE] is the global
+    // level, _levels[id] the level of each registered tag.
+    std::atomic<uint8_t> _levels[THORLOG_MAX_TAGS + 1] = {};
+
+    std::atomic<const char*> _tagNames[THORLOG_MAX_TAGS + 1] = {};
+    std::atomic<bool> _tagOverride[THORLOG_MAX_TAGS + 1] = {};
+    std::atomic<uint8_t> _tagCount{0};
+
+    // The low byte of _config indexes the current configuration, the rest
+    // counts changes. The other slots are free for the next setter, or
+    // still held by log calls that started before the last change.
+    ConfigSlot _configs[THORLOG_CONFIG_SLOTS] = {};
+    std::atomic<uint32_t> _config{0};
+    std::atomic<uint8_t> _configNext{1};
+
+    // Bytes logged and time in milliseconds since the last flushAll(),
+    // for setAutoFlush()
+    std::atomic<uint32_t> _unflushed{0};
+    std::atomic<uint32_t> _lastFlush{0};
+
+#ifdef THORLOG_STATS
+    // Updated from const paths (the fan-out) as well
+    mutable StatsSlot _stats[THORLOG_STATS_CORES] = {};
+#endif
+#endif
+};
+
+inline ThorLogging ThorLog;
+
+/**
+ * ThorLogger - Tagged handle on a ThorLogging instance
+ *
+ * A logger shares the output, prefix, suffix and mode of its ThorLogging,
+ * tags each record with its name ("I: wifi: connected") and has a level of
+ * its own, so one subsystem can be traced without turning up the rest:
+ *
+ *     static ThorLogger wifiLog("wifi");
+ *
+ *     wifiLog.setLevel(THORLOG_LEVEL_VERBOSE);     // or, from a console:
+ *     ThorLog.setTagLevel("wifi", THORLOG_LEVEL_VERBOSE);
+ *     wifiLog.traceln("rssi=%d", rssi);
+ *
+ * Until a level is set, the logger follows the global level. The tag is
+ * registered when the logger is constructed; loggers with the same name
+ * share one tag. A logger is two words and may be freely copied.
+ */
+class ThorLogger {
+public:
     /**
-     * clears prefix.
-     *
-     * \return void
+     * \param tag - tag name; must stay valid for the life of the program
+     * \param log - the ThorLogging instance to log through
      */
-    void clearPrefix()
+    explicit ThorLogger(const char *tag, ThorLogging &log = ThorLog)
+        : _log(&log), _tag(log.registerTag(tag))
     {
-#ifndef THORLOG_DISABLE_LOGGING
-        _prefix = nullptr;
-#endif
     }
 
     /**
-     * Sets a function to be called after each log command.
-     *
-     * \param f - The function to be called
-     * \return void
+     * Set the level of this logger's tag.
      */
-    void setSuffix(printfunction f)
-    {
-#ifndef THORLOG_DISABLE_LOGGING
-        _suffix = f;
-#endif
-    }
+    void setLevel(int level) { _log->setTagLevel(_tag, level); }
 
     /**
-     * clears suffix.
-     *
-     * \return void
+     * Get the level of this logger's tag.
      */
-    void clearSuffix()
-    {
-#ifndef THORLOG_DISABLE_LOGGING
-        _suffix = nullptr;
-#endif
-    }
+    int getLevel() const { return _log->getTagLevel(_tag); }
 
     /**
-     * Output a fatal error message. Output message contains
-     * F: followed by original message
-     * Fatal error messages are printed out at
-     * loglevels >= THORLOG_LEVEL_FATAL
-     *
-     * \param msg format string to output
-     * \param ... any number of variables
-     * \return void
+     * Make this logger's tag follow the global level again.
+     */
+    void clearLevel() { _log->clearTagLevel(_tag); }
+
+    /**
+     * The tag id, or THORLOG_TAG_NONE if the tag table was full.
      */
+    uint8_t getTag() const { return _tag; }
+
     template <class T, typename... Args>
     void fatal(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_FATAL, false, msg, args...);
+        if constexpr (THORLOG_LEVEL_FATAL <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_FATAL, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
@@ -268,25 +5123,27 @@ public:
     void fatalln(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_FATAL, true, msg, args...);
+        if constexpr (THORLOG_LEVEL_FATAL <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_FATAL, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
-    /**
-     * Output an error message. Output message contains
-     * E: followed by original message
-     * Error messages are printed out at
-     * loglevels >= THORLOG_LEVEL_ERROR
-     *
-     * \param msg format string to output
-     * \param ... any number of variables
-     * \return void
-     */
     template <class T, typename... Args>
     void error(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_ERROR, false, msg, args...);
+        if constexpr (THORLOG_LEVEL_ERROR <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_ERROR, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
@@ -294,25 +5151,27 @@ public:
     void errorln(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_ERROR, true, msg, args...);
+        if constexpr (THORLOG_LEVEL_ERROR <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_ERROR, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
-    /**
-     * Output a warning message. Output message contains
-     * W: followed by original message
-     * Warning messages are printed out at
-     * loglevels >= THORLOG_LEVEL_WARNING
-     *
-     * \param msg format string to output
-     * \param ... any number of variables
-     * \return void
-     */
     template <class T, typename... Args>
     void warning(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_WARNING, false, msg, args...);
+        if constexpr (THORLOG_LEVEL_WARNING <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_WARNING, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
@@ -320,25 +5179,27 @@ public:
     void warningln(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_WARNING, true, msg, args...);
+        if constexpr (THORLOG_LEVEL_WARNING <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_WARNING, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
-    /**
-     * Output a notice message. Output message contains
-     * N: followed by original message
-     * Notice messages are printed out at
-     * loglevels >= THORLOG_LEVEL_NOTICE
-     *
-     * \param msg format string to output
-     * \param ... any number of variables
-     * \return void
-     */
     template <class T, typename... Args>
     void notice(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_NOTICE, false, msg, args...);
+        if constexpr (THORLOG_LEVEL_NOTICE <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_NOTICE, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
@@ -346,25 +5207,27 @@ public:
     void noticeln(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_NOTICE, true, msg, args...);
+        if constexpr (THORLOG_LEVEL_NOTICE <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_NOTICE, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
-    /**
-     * Output an info message. Output message contains
-     * I: followed by original message
-     * Info messages are printed out at
-     * loglevels >= THORLOG_LEVEL_INFO
-     *
-     * \param msg format string to output
-     * \param ... any number of variables
-     * \return void
-     */
     template <class T, typename... Args>
     void info(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_INFO, false, msg, args...);
+        if constexpr (THORLOG_LEVEL_INFO <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_INFO, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
@@ -372,25 +5235,27 @@ public:
     void infoln(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_INFO, true, msg, args...);
+        if constexpr (THORLOG_LEVEL_INFO <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_INFO, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
-    /**
-     * Output a trace message. Output message contains
-     * T: followed by original message
-     * Trace messages are printed out at
-     * loglevels >= THORLOG_LEVEL_TRACE
-     *
-     * \param msg format string to output
-     * \param ... any number of variables
-     * \return void
-     */
     template <class T, typename... Args>
     void trace(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_TRACE, false, msg, args...);
+        if constexpr (THORLOG_LEVEL_TRACE <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_TRACE, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
@@ -398,25 +5263,27 @@ public:
     void traceln(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_TRACE, true, msg, args...);
+        if constexpr (THORLOG_LEVEL_TRACE <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_TRACE, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
-    /**
-     * Output a verbose message. Output message contains
-     * V: followed by original message
-     * Verbose messages are printed out at
-     * loglevels >= THORLOG_LEVEL_VERBOSE
-     *
-     * \param msg format string to output
-     * \param ... any number of variables
-     * \return void
-     */
     template <class T, typename... Args>
     void verbose(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_VERBOSE, false, msg, args...);
+        if constexpr (THORLOG_LEVEL_VERBOSE <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_VERBOSE, false, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
@@ -424,189 +5291,274 @@ public:
     void verboseln(T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        printLevel(THORLOG_LEVEL_VERBOSE, true, msg, args...);
+        if constexpr (THORLOG_LEVEL_VERBOSE <= THORLOG_MIN_LEVEL)
+        {
+            _log->printLevel(_tag, THORLOG_LEVEL_VERBOSE, true, msg, args...);
+        }
+#else
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
-private:
-    void print(const char *format, va_list args)
+    template <class T, typename... Args>
+    void printLimited(ThorLogLimit &limit, int level, bool cr, T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        for (; *format != '\0'; ++format)
-        {
-            if (*format == '%')
-            {
-                ++format;
-                if (*format == '\0')
-                    break;
-                printFormat(*format, &args);
-            }
-            else
-            {
-                _logOutput->print(*format);
-            }
-        }
+        _log->printLevelLimited(limit, _tag, level, cr, msg, args...);
+#else
+        (void)limit;
+        (void)level;
+        (void)cr;
+        (void)msg;
+        ((void)args, ...);
 #endif
     }
 
-    void printFormat(const char format, va_list *args)
+    template <class T, typename... Args>
+    void printSampled(ThorLogSample &sample, int level, bool cr, T msg, Args... args)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        if (format == '%')
-        {
-            _logOutput->print('%');
-        }
-        else if (format == 's')
-        {
-            const char *s = va_arg(*args, const char *);
-            _logOutput->print(s);
-        }
-        else if (format == 'c')
-        {
-            int c = va_arg(*args, int);
-            _logOutput->print(static_cast<char>(c));
-        }
-        else if (format == 'C')
-        {
-            int c = va_arg(*args, int);
-            if (c >= 0x20 && c < 0x7F)
-            {
-                _logOutput->print(static_cast<char>(c));
-            }
-            else
-            {
-                _logOutput->print("0x");
-                if (c < 0x10)
-                {
-                    _logOutput->print('0');
-                }
-                _logOutput->print(static_cast<unsigned int>(c), THORLOG_HEX);
-            }
-        }
-        else if (format == 'd' || format == 'i')
-        {
-            int d = va_arg(*args, int);
-            _logOutput->print(d);
-        }
-        else if (format == 'l')
-        {
-            long l = va_arg(*args, long);
-            _logOutput->print(l);
-        }
-        else if (format == 'u')
-        {
-            unsigned long u = va_arg(*args, unsigned long);
-            _logOutput->print(u);
-        }
-        else if (format == 'x')
-        {
-            unsigned int x = va_arg(*args, unsigned int);
-            _logOutput->print(x, THORLOG_HEX);
-        }
-        else if (format == 'X')
-        {
-            unsigned long x = va_arg(*args, unsigned long);
-            _logOutput->print("0x");
-            // Print leading zeros for 8 hex digits (32-bit)
-            if (x < 0x10000000UL) _logOutput->print('0');
-            if (x < 0x1000000UL) _logOutput->print('0');
-            if (x < 0x100000UL) _logOutput->print('0');
-            if (x < 0x10000UL) _logOutput->print('0');
-            if (x < 0x1000UL) _logOutput->print('0');
-            if (x < 0x100UL) _logOutput->print('0');
-            if (x < 0x10UL) _logOutput->print('0');
-            _logOutput->print(x, THORLOG_HEX);
-        }
-        else if (format == 'b')
-        {
-            unsigned int b = va_arg(*args, unsigned int);
-            _logOutput->print(b, THORLOG_BIN);
-        }
-        else if (format == 'B')
-        {
-            unsigned int b = va_arg(*args, unsigned int);
-            _logOutput->print("0b");
-            _logOutput->print(b, THORLOG_BIN);
-        }
-        else if (format == 't')
-        {
-            int t = va_arg(*args, int);
-            _logOutput->print(t ? "t" : "f");
-        }
-        else if (format == 'T')
-        {
-            int t = va_arg(*args, int);
-            _logOutput->print(t ? "true" : "false");
-        }
-        else if (format == 'D' || format == 'F')
-        {
-            double d = va_arg(*args, double);
-            _logOutput->print(d);
-        }
-        else if (format == 'p')
-        {
-            // Print pointer address
-            void *p = va_arg(*args, void *);
-            uintptr_t addr = reinterpret_cast<uintptr_t>(p);
-            _logOutput->print("0x");
-            // Print as appropriate width for the platform
-            _logOutput->print(static_cast<unsigned long>(addr), THORLOG_HEX);
-        }
+        _log->printLevelSampled(sample, _tag, level, cr, msg, args...);
+#else
+        (void)sample;
+        (void)level;
+        (void)cr;
+        (void)msg;
+        ((void)args, ...);
+#endif
+    }
+
+    void hexdump(int level, const void *data, size_t size, const char *label = nullptr)
+    {
+#ifndef THORLOG_DISABLE_LOGGING
+        _log->printDump(_tag, level, data, size, label);
+#else
+        (void)level;
+        (void)data;
+        (void)size;
+        (void)label;
 #endif
     }
 
-    template <class T>
-    void printLevel(int level, bool cr, T msg, ...)
+private:
+    ThorLogging *_log;
+    uint8_t _tag;
+};
+
+/**
+ * ThorContext - Scoped key/value pairs on the records of one task
+ *
+ * While a guard lives, every text and JSON record its task logs carries
+ * its pairs, after those of the guards made before it:
+ *
+ *     ThorLog.setContextSource(thorlog_espidf_context);   // once
+ *
+ *     void handle(Connection &c) {
+ *         ThorContext context(thorlog_kv("conn", c.id));
+ *         ThorLog.infoln("request");     // I: conn=42 request
+ *     }                                  // {...,"msg":"request","conn":42}
+ *
+ * The values are rendered when the guard is made; later changes to them
+ * are not followed. Guards must be destroyed on the task that made them,
+ * in reverse order, which scoping them does. Keys must outlive the guard.
+ * Without a context source the guard does nothing.
+ */
+class ThorContext {
+public:
+    template <typename T, typename... Rest>
+    explicit ThorContext(const ThorField<T> &field, const ThorField<Rest> &...rest)
+        : ThorContext(ThorLog, field, rest...)
+    {
+    }
+
+    /**
+     * \param log - the ThorLogging instance whose context source is used
+     */
+    template <typename... T>
+    explicit ThorContext(ThorLogging &log, const ThorField<T> &...fields)
+        : _context(nullptr), _textLen(0), _jsonLen(0)
     {
 #ifndef THORLOG_DISABLE_LOGGING
-        if (level > _level)
+        taskcontextfunction source = log.getContextSource();
+        _context = (source != nullptr) ? source(true) : nullptr;
+        if (_context == nullptr)
         {
             return;
         }
-        if (level < THORLOG_LEVEL_SILENT)
-        {
-            level = THORLOG_LEVEL_SILENT;
-        }
+        _textLen = _context->textLen;
+        _jsonLen = _context->jsonLen;
+        (add(fields), ...);
+#else
+        (void)log;
+        ((void)fields, ...);
+#endif
+    }
 
-        if (_prefix != nullptr)
+    ~ThorContext()
+    {
+        if (_context != nullptr)
         {
-            _prefix(_logOutput, level);
+            _context->textLen = _textLen;
+            _context->jsonLen = _jsonLen;
         }
+    }
 
-        if (_showLevel)
-        {
-            static const char levels[] = "FEWITV";
-            _logOutput->print(levels[level - 1]);
-            _logOutput->print(": ");
-        }
+    ThorContext(const ThorContext &) = delete;
+    ThorContext &operator=(const ThorContext &) = delete;
 
-        va_list args;
-        va_start(args, msg);
-        print(msg, args);
-        va_end(args);
+private:
+    // Collects rendered bytes in the free part of a context buffer
+    class Span : public ThorWritePrint {
+    public:
+        Span(char *buffer, size_t room) : _buffer(buffer), _room(room), _len(0), _overflow(false) {}
 
-        if (_suffix != nullptr)
+        size_t write(const char *buffer, size_t size) override
         {
-            _suffix(_logOutput, level);
+            if (size > _room - _len)
+            {
+                _overflow = true;
+                return 0;
+            }
+            memcpy(_buffer + _len, buffer, size);
+            _len += size;
+            return size;
         }
-        if (cr)
+
+        // Bytes written, 0 if they did not all fit
+        size_t length() const { return _overflow ? 0 : _len; }
+
+    private:
+        char *_buffer;
+        size_t _room;
+        size_t _len;
+        bool _overflow;
+    };
+
+    // Renders "key=value " and ",\"key\":value"; a pair that does not fit
+    // into both buffers is left out of both
+    template <typename T>
+    void add(const ThorField<T> &field)
+    {
+        Span text(_context->text + _context->textLen, THORLOG_CONTEXT_SIZE - _context->textLen);
+        ThorRecord textRecord(&text);
+        textRecord.print(field.key);
+        textRecord.print('=');
+        thorlog_print_json_value(textRecord, thorlog_make_arg(field.value), std::is_same<T, bool>::value);
+        textRecord.print(' ');
+        textRecord.commit();
+
+        Span json(_context->json + _context->jsonLen, THORLOG_CONTEXT_SIZE - _context->jsonLen);
+        ThorRecord jsonRecord(&json);
+        thorlog_print_json_field(jsonRecord, field);
+        jsonRecord.commit();
+
+        if (text.length() != 0 && json.length() != 0)
         {
-            _logOutput->print(THORLOG_CR);
+            _context->textLen = static_cast<uint16_t>(_context->textLen + text.length());
+            _context->jsonLen = static_cast<uint16_t>(_context->jsonLen + json.length());
         }
-#endif
     }
 
-#ifndef THORLOG_DISABLE_LOGGING
-    int _level;
-    bool _showLevel;
-    ThorPrint* _logOutput;
+    ThorTaskContext *_context;
+    uint16_t _textLen;
+    uint16_t _jsonLen;
+};
+
+// *************************************************************************
+//  Level-filtered logging macros. Calls below THORLOG_MIN_LEVEL, or all calls
+//  with THORLOG_DISABLE_LOGGING, vanish before compilation: their arguments
+//  are not evaluated and their strings are not stored in flash.
+//
+//      THORLOG_VERBOSELN("Buffer state: %s", dumpState());
+//      THORLOG_WHEN(THORLOG_LEVEL_TRACE, wifiLog.traceln("rssi=%d", rssi()));
+// *************************************************************************
 
-    printfunction _prefix = nullptr;
-    printfunction _suffix = nullptr;
+#ifdef THORLOG_DISABLE_LOGGING
+#define THORLOG_ENABLED(level) 0
+#else
+#define THORLOG_ENABLED(level) ((level) <= THORLOG_MIN_LEVEL)
 #endif
-};
 
-inline ThorLogging ThorLog;
+#define THORLOG_WHEN(level, statement) \
+    do { \
+        if constexpr (THORLOG_ENABLED(level)) { \
+            statement; \
+        } \
+    } while (0)
+
+// With interning on, the format is wrapped in THORLOG_FMT() so that it gets
+// an ID; it must then be a string literal
+#if THORLOG_INTERN != THORLOG_INTERN_OFF
+#define THORLOG_MSG(msg, ...) THORLOG_FMT(msg), ##__VA_ARGS__
+#else
+#define THORLOG_MSG(...) __VA_ARGS__
+#endif
+
+#define THORLOG_FATAL(...)     THORLOG_WHEN(THORLOG_LEVEL_FATAL, ThorLog.fatal(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_FATALLN(...)   THORLOG_WHEN(THORLOG_LEVEL_FATAL, ThorLog.fatalln(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_ERROR(...)     THORLOG_WHEN(THORLOG_LEVEL_ERROR, ThorLog.error(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_ERRORLN(...)   THORLOG_WHEN(THORLOG_LEVEL_ERROR, ThorLog.errorln(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_WARNING(...)   THORLOG_WHEN(THORLOG_LEVEL_WARNING, ThorLog.warning(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_WARNINGLN(...) THORLOG_WHEN(THORLOG_LEVEL_WARNING, ThorLog.warningln(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_NOTICE(...)    THORLOG_WHEN(THORLOG_LEVEL_NOTICE, ThorLog.notice(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_NOTICELN(...)  THORLOG_WHEN(THORLOG_LEVEL_NOTICE, ThorLog.noticeln(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_INFO(...)      THORLOG_WHEN(THORLOG_LEVEL_INFO, ThorLog.info(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_INFOLN(...)    THORLOG_WHEN(THORLOG_LEVEL_INFO, ThorLog.infoln(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_TRACE(...)     THORLOG_WHEN(THORLOG_LEVEL_TRACE, ThorLog.trace(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_TRACELN(...)   THORLOG_WHEN(THORLOG_LEVEL_TRACE, ThorLog.traceln(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_VERBOSE(...)   THORLOG_WHEN(THORLOG_LEVEL_VERBOSE, ThorLog.verbose(THORLOG_MSG(__VA_ARGS__)))
+#define THORLOG_VERBOSELN(...) THORLOG_WHEN(THORLOG_LEVEL_VERBOSE, ThorLog.verboseln(THORLOG_MSG(__VA_ARGS__)))
+
+// Hex dump that vanishes, arguments and all, below THORLOG_MIN_LEVEL
+#define THORLOG_HEXDUMP(level, ...) THORLOG_WHEN(level, ThorLog.hexdump(level, __VA_ARGS__))
+
+// *************************************************************************
+//  Rate-limited lines. Each use holds its own static ThorLogLimit, so one
+//  noisy call site is limited without affecting any other. logger is
+//  ThorLog or a ThorLogger; level must be a constant.
+//
+//      THORLOG_EVERY_MS(ThorLog, 1000, THORLOG_LEVEL_WARNING, "Sensor %d timeout", id);
+//      THORLOG_COLLAPSE(ThorLog, THORLOG_LEVEL_INFO, "door=%s", open ? "open" : "shut");
+// *************************************************************************
+
+#define THORLOG_LIMITED(logger, interval, collapse, level, ...) \
+    do { \
+        if constexpr (THORLOG_ENABLED(level)) { \
+            static ThorLogLimit thorlogLimit_(interval, collapse); \
+            (logger).printLimited(thorlogLimit_, level, true, THORLOG_MSG(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+// At most one line per ms milliseconds
+#define THORLOG_EVERY_MS(logger, ms, level, ...) THORLOG_LIMITED(logger, ms, false, level, __VA_ARGS__)
+// Consecutive lines with the same arguments collapsed into one count
+#define THORLOG_COLLAPSE(logger, level, ...) THORLOG_LIMITED(logger, 0, true, level, __VA_ARGS__)
+// Collapsed, with the count reported at least every ms milliseconds
+#define THORLOG_COLLAPSE_MS(logger, ms, level, ...) THORLOG_LIMITED(logger, ms, true, level, __VA_ARGS__)
+
+// *************************************************************************
+//  Sampled lines, for trace points that fire too often to log every call.
+//  Each use holds its own static ThorLogSample; records that get through
+//  end in " (N skipped)", the calls dropped since the previous one.
+//
+//      THORLOG_SAMPLE_EVERY(ThorLog, 100, THORLOG_LEVEL_TRACE, "err=%d", err);
+//      THORLOG_SAMPLE_CHANCE(loopLog, 0.01, THORLOG_LEVEL_TRACE, "dt=%u", dt);
+// *************************************************************************
+
+#define THORLOG_SAMPLED(logger, sample, level, ...) \
+    do { \
+        if constexpr (THORLOG_ENABLED(level)) { \
+            static ThorLogSample thorlogSample_ = sample; \
+            (logger).printSampled(thorlogSample_, level, true, THORLOG_MSG(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+// One line in every n calls
+#define THORLOG_SAMPLE_EVERY(logger, n, level, ...) THORLOG_SAMPLED(logger, ThorLogSample::every(n), level, __VA_ARGS__)
+// Each call logged with probability p
+#define THORLOG_SAMPLE_CHANCE(logger, p, level, ...) \
+    THORLOG_SAMPLED(logger, ThorLogSample::chance(p, __LINE__), level, __VA_ARGS__)
 
 // *************************************************************************
 //  Arduino-Log compatibility aliases (always available for drop-in replacement)
@@ -0,0 +1,260 @@
+/*
+ * ThorLog Asynchronous Output for ESP-IDF
+ *
+ * ThorAsyncPrint sits between ThorLogging and a slow output such as a UART.
+ * Log calls copy their finished record into a lock-free ring and return;
+ * a FreeRTOS task drains the ring into the wrapped output. The cost of a
+ * log call is then bounded by a memcpy instead of the wire speed. The task
+ * is woken when the ring is half full or an error is queued, and otherwise
+ * drains every flush interval, so most log calls do not switch tasks.
+ *
+ * Nothing is allocated: the ring, the drain mutex and the flush task's
+ * stack and control block are members of the ThorAsyncPrint object.
+ *
+ * ============================================================================
+ * USAGE EXAMPLE:
+ * ============================================================================
+ *
+ * #include "thorlog.h"
+ * #include "thorlog_espidf.h"
+ * #include "thorlog_async_espidf.h"
+ *
+ * // 32 records of up to THORLOG_RECORD_SIZE bytes, oldest dropped when full
+ * static ThorAsyncPrint<32> asyncOutput(&EspIdfOutput, THORLOG_ASYNC_DROP_OLDEST);
+ *
+ * void app_main() {
+ *     asyncOutput.begin(tskIDLE_PRIORITY + 1);
+ *     ThorLog.begin(THORLOG_LEVEL_VERBOSE, &asyncOutput);
+ *     ThorLog.infoln("Returns as soon as the record is queued");
+ *
+ *     ThorLog.infoln("Dropped so far: %u", asyncOutput.getDropped());
+ * }
+ *
+ * ============================================================================
+ * OVERFLOW POLICIES:
+ * ============================================================================
+ *
+ * THORLOG_ASYNC_DROP_NEWEST  the record being logged is dropped (default)
+ * THORLOG_ASYNC_DROP_OLDEST  the oldest queued record is dropped to make room
+ * THORLOG_ASYNC_BLOCK        the caller waits up to the block timeout for
+ *                            room, then drops the record; interrupt
+ *                            handlers, the flush task itself and callers
+ *                            before the scheduler starts drop at once
+ *
+ * Every dropped record is counted in getDropped().
+ *
+ * ============================================================================
+ */
+
+#pragma once
+
+#include "thorlog.h"
+#include "thorlog_ring.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <atomic>
+
+#define THORLOG_ASYNC_DROP_NEWEST 0
+#define THORLOG_ASYNC_DROP_OLDEST 1
+#define THORLOG_ASYNC_BLOCK       2
+
+#ifndef THORLOG_ASYNC_SLOTS
+#define THORLOG_ASYNC_SLOTS 16
+#endif
+
+#ifndef THORLOG_ASYNC_STACK_SIZE
+#define THORLOG_ASYNC_STACK_SIZE 3072
+#endif
+
+/**
+ * @class ThorAsyncPrint
+ * @brief Queues records in a lock-free ring and writes them from a task
+ * @tparam Slots Number of records that can be queued (a power of two)
+ * @tparam SlotSize Maximum record size
+ * @tparam StackSize Stack size of the flush task in bytes
+ */
+template <size_t Slots = THORLOG_ASYNC_SLOTS, size_t SlotSize = THORLOG_RECORD_SIZE,
+          size_t StackSize = THORLOG_ASYNC_STACK_SIZE>
+class ThorAsyncPrint : public ThorWritePrint {
+public:
+    /**
+     * @brief Constructor
+     * @param output Output the flush task writes to
+     * @param overflow One of the THORLOG_ASYNC_* policies
+     * @param blockTimeoutMs Longest a caller waits with THORLOG_ASYNC_BLOCK
+     * @param flushIntervalMs Longest a record waits before it is written
+     */
+    explicit ThorAsyncPrint(ThorPrint* output, int overflow = THORLOG_ASYNC_DROP_NEWEST,
+                            uint32_t blockTimeoutMs = 10, uint32_t flushIntervalMs = 20)
+        : _output(output), _overflow(overflow), _blockTimeoutMs(blockTimeoutMs),
+          _flushIntervalMs(flushIntervalMs),
+          _dropped(0), _mutex(xSemaphoreCreateMutexStatic(&_mutexBuffer)), _task(nullptr)
+    {
+    }
+
+    ThorAsyncPrint(const ThorAsyncPrint&) = delete;
+    ThorAsyncPrint& operator=(const ThorAsyncPrint&) = delete;
+
+    /**
+     * @brief Start the flush task
+     * @param priority FreeRTOS priority of the flush task
+     * @param core Core to pin the task to, or tskNO_AFFINITY
+     * @return true if the task is running
+     *
+     * Until begin() is called, records are written to the output directly.
+     */
+    bool begin(UBaseType_t priority = tskIDLE_PRIORITY + 1, BaseType_t core = tskNO_AFFINITY) {
+        if (_task != nullptr) {
+            return true;
+        }
+        _task = xTaskCreateStaticPinnedToCore(flushTask, "thorlog", StackSize, this, priority,
+                                              _stack, &_taskBuffer, core);
+        return _task != nullptr;
+    }
+
+    /**
+     * @brief Queue a record
+     * @param buffer Record bytes
+     * @param size Record size; records longer than SlotSize are truncated
+     * @return size if the record was queued, 0 if it was dropped
+     */
+    size_t write(const char* buffer, size_t size) override {
+        return writeRecord(buffer, size, THORLOG_LEVEL_SILENT);
+    }
+
+    /**
+     * @brief Queue a record, keeping its level for the wrapped output
+     */
+    size_t writeRecord(const char* buffer, size_t size, int level) override {
+        if (_task == nullptr) {
+            return (_output != nullptr) ? _output->writeRecord(buffer, size, level) : 0;
+        }
+        if (!enqueue(buffer, size, static_cast<uint8_t>(level))) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        // Wake the task early only when waiting could cost records, or
+        // delay the ones that matter most
+        if ((level != THORLOG_LEVEL_SILENT && level <= THORLOG_LEVEL_ERROR) || _ring.size() >= Slots / 2) {
+            xTaskNotifyGive(_task);
+        }
+        return size;
+    }
+
+    /**
+     * @brief Write the queued records from the calling task, then flush the
+     *        wrapped output
+     *
+     * Waits for the record the flush task is writing, so the output gets
+     * every record in the order it was queued. Not for interrupt handlers.
+     */
+    bool flush() override {
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        drain();
+        bool ok = _output == nullptr || _output->flush();
+        xSemaphoreGive(_mutex);
+        return ok;
+    }
+
+    /**
+     * @brief Number of records dropped because the ring was full
+     */
+    uint32_t getDropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Most records that were queued at once
+     */
+    size_t getHighWater() const { return _ring.highWater(); }
+
+    /**
+     * @brief Drops and ring depth, for ThorLogging::getStats()
+     */
+    bool getStats(ThorSinkStats* stats) const override {
+        stats->dropped = getDropped();
+        stats->highWater = static_cast<uint32_t>(_ring.highWater());
+        stats->capacity = static_cast<uint32_t>(Slots);
+        return true;
+    }
+
+private:
+    bool enqueue(const char* buffer, size_t size, uint8_t level) {
+        if (_ring.push(buffer, size, level)) {
+            return true;
+        }
+        switch (_overflow) {
+            case THORLOG_ASYNC_DROP_OLDEST:
+                // Another producer may take the freed slot first; give up
+                // after a few rounds rather than spin
+                for (int attempt = 0; attempt < 4; ++attempt) {
+                    if (_ring.discard()) {
+                        _dropped.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    if (_ring.push(buffer, size, level)) {
+                        return true;
+                    }
+                }
+                return false;
+
+            case THORLOG_ASYNC_BLOCK: {
+                // Only the flush task makes room, and it can not run while
+                // the scheduler is stopped, under an interrupt handler or
+                // when it is the caller; drop the record instead
+                if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING || xPortInIsrContext() ||
+                    xTaskGetCurrentTaskHandle() == _task) {
+                    return false;
+                }
+                TickType_t start = xTaskGetTickCount();
+                TickType_t timeout = pdMS_TO_TICKS(_blockTimeoutMs);
+                while (xTaskGetTickCount() - start <= timeout) {
+                    xTaskNotifyGive(_task);
+                    vTaskDelay(1);
+                    if (_ring.push(buffer, size, level)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            default:
+                return false;
+        }
+    }
+
+    // The flush task and flush() both call this, under _mutex so that
+    // records leave in the order they were queued
+    void drain() {
+        while (_ring.pop([this](const char* data, size_t size, uint8_t level) {
+            if (_output != nullptr) {
+                _output->writeRecord(data, size, level);
+            }
+        })) {
+        }
+    }
+
+    static void flushTask(void* arg) {
+        ThorAsyncPrint* self = static_cast<ThorAsyncPrint*>(arg);
+        // At least one tick, so a short interval does not spin
+        TickType_t interval = pdMS_TO_TICKS(self->_flushIntervalMs);
+        interval = (interval > 0) ? interval : 1;
+        for (;;) {
+            ulTaskNotifyTake(pdTRUE, interval);
+            xSemaphoreTake(self->_mutex, portMAX_DELAY);
+            self->drain();
+            xSemaphoreGive(self->_mutex);
+        }
+    }
+
+    ThorRing<Slots, SlotSize> _ring;
+    ThorPrint* _output;
+    int _overflow;
+    uint32_t _blockTimeoutMs;
+    uint32_t _flushIntervalMs;
+    std::atomic<uint32_t> _dropped;
+    StaticSemaphore_t _mutexBuffer;
+    SemaphoreHandle_t _mutex;
+
+    TaskHandle_t _task;
+    StaticTask_t _taskBuffer;
+    StackType_t _stack[StackSize];
+};
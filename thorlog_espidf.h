@@ -2,7 +2,8 @@
  * ThorLog ESP-IDF Adapter
  *
  * This header provides an ESP-IDF compatible implementation of the ThorPrint
- * interface, allowing ThorLog to work with ESP-IDF's standard output (printf/stdout).
+ * interface, allowing ThorLog to work with ESP-IDF's standard output (stdout),
+ * or directly with a UART driver.
  *
  * This serves as both a working adapter AND documentation for how users can
  * create their own print adapters for different platforms.
@@ -52,6 +53,12 @@
  *         return my_puts(str);
  *     }
  *
+ *     // Optional, but recommended: ThorLog hands each finished record to
+ *     // write() in one call. The default falls back to print(char).
+ *     size_t write(const char* buffer, size_t size) override {
+ *         return my_write(buffer, size);
+ *     }
+ *
  *     size_t print(int num, int base = 10) override {
  *         // Handle decimal, hex, binary
  *         if (base == 10) return my_print_decimal(num);
@@ -71,19 +78,19 @@
  * SUPPORTED FORMAT SPECIFIERS (in ThorLog messages):
  * ============================================================================
  *
- * %s   - string (char*)
+ * %s   - string (char*, std::string_view or thorlog_str(data, len))
  * %c   - single character
  * %C   - character or hex if non-printable
  * %d   - integer (decimal)
  * %l   - long (decimal)
  * %u   - unsigned long (decimal)
  * %x   - hexadecimal (lowercase)
- * %X   - hexadecimal with 0x prefix
+ * %X   - hexadecimal with 0x prefix, zero-padded to 8 or 16 digits
  * %b   - binary
  * %B   - binary with 0b prefix
  * %t   - boolean "t"/"f"
  * %T   - boolean "true"/"false"
- * %D,%F - double/float
+ * %D,%F - double/float, optional precision such as %.4F
  * %p   - pointer address
  *
  * ============================================================================
@@ -96,23 +103,173 @@
 #include <cstdlib>
 #include <cstring>
 
+// *************************************************************************
+//  Define THORLOG_ESPIDF_UART to write straight to an installed UART driver
+//  (uart_driver_install) instead of going through newlib stdio.
+// *************************************************************************
+#ifdef THORLOG_ESPIDF_UART
+#include "driver/uart.h"
+#endif
+
+// Longest flush() waits for the UART to send what its driver buffers
+#ifndef THORLOG_ESPIDF_FLUSH_TIMEOUT_MS
+#define THORLOG_ESPIDF_FLUSH_TIMEOUT_MS 100
+#endif
+
+#include "esp_cpu.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#if defined(__XTENSA__)
+#include "esp_debug_helpers.h"
+#endif
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+/**
+ * @brief Time source for ThorLogging::setTimeSource()
+ * @return Microseconds since boot
+ */
+inline uint64_t thorlog_espidf_time_us() {
+    return static_cast<uint64_t>(esp_timer_get_time());
+}
+
+/**
+ * @brief Cycle counter for ThorLogging::setTimestamp(THORLOG_TIMESTAMP_CYCLES)
+ * @return CPU cycles of the calling core; wraps every few tens of seconds
+ */
+inline uint64_t thorlog_espidf_cycles() {
+    return static_cast<uint64_t>(esp_cpu_get_cycle_count());
+}
+
+/**
+ * @brief Task name for ThorLogging::setTaskInfo()
+ *
+ * FreeRTOS keeps the name in the task control block, so this is a pointer
+ * load rather than a lookup.
+ */
+inline const char* thorlog_espidf_task_name() {
+    return pcTaskGetName(nullptr);
+}
+
+/**
+ * @brief Core ID for ThorLogging::setTaskInfo()
+ */
+inline int thorlog_espidf_core_id() {
+    return static_cast<int>(esp_cpu_get_core_id());
+}
+
+/**
+ * @brief Wait step for ThorLogging::synchronize()
+ *
+ * Sleeps for a tick, so that tasks of any priority can finish their
+ * records meanwhile.
+ */
+inline void thorlog_espidf_yield() {
+    vTaskDelay(1);
+}
+
+// *************************************************************************
+//  FreeRTOS thread-local storage slot holding each task's ThorContext
+//  pairs. Slot 0 is taken by ESP-IDF's pthread keys, so the default needs
+//  CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS of at least 2.
+// *************************************************************************
+#ifndef THORLOG_CONTEXT_TLS_INDEX
+#define THORLOG_CONTEXT_TLS_INDEX 1
+#endif
+
+static_assert(THORLOG_CONTEXT_TLS_INDEX < configNUM_THREAD_LOCAL_STORAGE_POINTERS,
+              "THORLOG_CONTEXT_TLS_INDEX: raise CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS");
+
+/**
+ * @brief Context source for ThorLogging::setContextSource()
+ * @param create Allocate the context if the task has none yet
+ *
+ * The context is allocated the first time a task makes a ThorContext
+ * guard and freed when the task is deleted. Tasks that never make one
+ * cost nothing.
+ */
+inline ThorTaskContext* thorlog_espidf_context(bool create) {
+    void* context = pvTaskGetThreadLocalStoragePointer(nullptr, THORLOG_CONTEXT_TLS_INDEX);
+    if (context == nullptr && create) {
+        context = calloc(1, sizeof(ThorTaskContext));
+        if (context != nullptr) {
+            vTaskSetThreadLocalStoragePointerAndDelCallback(nullptr, THORLOG_CONTEXT_TLS_INDEX, context,
+                                                            [](int, void* p) { free(p); });
+        }
+    }
+    return static_cast<ThorTaskContext*>(context);
+}
+
+/**
+ * @brief Flush ThorLog's outputs whenever esp_restart() is called
+ * @return ESP_OK, or the error from esp_register_shutdown_handler()
+ *
+ * Shutdown handlers run in the task that called esp_restart(), before the
+ * reset, so records still buffered for the UART or flash get out. A panic
+ * does not run them; records at the sync level (ThorLogging::setSyncLevel,
+ * FATAL by default) are flushed while they are logged instead.
+ */
+inline esp_err_t thorlog_espidf_flush_on_restart() {
+    return esp_register_shutdown_handler([] { ThorLog.flush(); });
+}
+
+/**
+ * @brief Backtrace capture for ThorLogging::setBacktrace()
+ * @param frames Where the return addresses are stored
+ * @param max Most addresses to store
+ * @return Number of addresses stored
+ *
+ * Walks the calling task's stack with the ESP-IDF backtrace API, starting
+ * with the caller of this function, so the first frame or two are inside
+ * ThorLog. The addresses point into the call instructions, ready for
+ * addr2line. Only the Xtensa targets can walk their stack without frame
+ * pointers; on RISC-V nothing is captured.
+ */
+inline size_t thorlog_espidf_backtrace(uintptr_t* frames, size_t max) {
+#if defined(__XTENSA__)
+    esp_backtrace_frame_t frame;
+    esp_backtrace_get_start(&frame.pc, &frame.sp, &frame.next_pc);
+    frame.exc_frame = nullptr;
+    size_t depth = 0;
+    while (depth < max && frame.next_pc != 0 && esp_backtrace_get_next_frame(&frame)) {
+        // Strip the register window bits from the return address, as
+        // esp_cpu_process_stack_pc() does
+        uint32_t pc = frame.pc;
+        if (pc & 0x80000000) {
+            pc = (pc & 0x3FFFFFFF) | 0x40000000;
+        }
+        frames[depth++] = pc - 3;
+    }
+    return depth;
+#else
+    (void)frames;
+    (void)max;
+    return 0;
+#endif
+}
+
 /**
  * @class EspIdfPrint
- * @brief ESP-IDF implementation of ThorPrint using printf/stdout
+ * @brief ESP-IDF implementation of ThorPrint using stdout or a UART driver
  *
  * This class implements the ThorPrint interface using ESP-IDF's standard
- * output functions (printf). All output goes to the default UART console.
+ * output functions. All output goes to the default UART console.
  *
  * Features:
  * - Support for all numeric bases (decimal, hexadecimal, binary)
  * - Proper handling of signed and unsigned integers
- * - Float/double support
- * - Efficient implementation using printf where possible
+ * - Float/double support without printf
+ * - Bulk write() using a single fwrite() per log record, or a direct
+ *   uart_write_bytes() when THORLOG_ESPIDF_UART is defined
  *
  * Base Values:
- * - THORLOG_DEC (10): Decimal output using %d, %ld, %u, %lu
- * - THORLOG_HEX (16): Hexadecimal output using %x
- * - THORLOG_BIN (2):  Binary output via manual bit conversion
+ * - THORLOG_DEC (10): Decimal output
+ * - THORLOG_HEX (16): Hexadecimal output (lowercase)
+ * - THORLOG_BIN (2):  Binary output
+ *
+ * Integers are rendered by the table-driven kernels in thorlog.h, not by
+ * printf.
  */
 class EspIdfPrint : public ThorPrint {
 public:
@@ -121,6 +278,17 @@ public:
      */
     EspIdfPrint() = default;
 
+#ifdef THORLOG_ESPIDF_UART
+    /**
+     * @brief Construct an adapter that writes to a UART driver directly
+     * @param port UART port; the driver must already be installed
+     *
+     * Bypasses newlib stdio and its locking. stdout is used until a port
+     * is given.
+     */
+    explicit EspIdfPrint(uart_port_t port) : _uartPort(static_cast<int>(port)) {}
+#endif
+
     /**
      * @brief Virtual destructor for proper cleanup in derived classes
      */
@@ -136,8 +304,7 @@ public:
      * @return Number of bytes written (1 on success, 0 on failure)
      */
     size_t print(char c) override {
-        int result = printf("%c", c);
-        return (result > 0) ? static_cast<size_t>(result) : 0;
+        return write(&c, 1);
     }
 
     /**
@@ -149,8 +316,44 @@ public:
         if (str == nullptr) {
             return 0;
         }
-        int result = printf("%s", str);
-        return (result > 0) ? static_cast<size_t>(result) : 0;
+        return write(str, strlen(str));
+    }
+
+    /**
+     * @brief Write a block of characters
+     * @param buffer The characters to write
+     * @param size Number of characters
+     * @return Number of bytes written
+     *
+     * ThorLogging calls this once per log record. Uses uart_write_bytes()
+     * when a UART port was given, fwrite() to stdout otherwise.
+     */
+    size_t write(const char* buffer, size_t size) override {
+        if (size == 0) {
+            return 0;
+        }
+#ifdef THORLOG_ESPIDF_UART
+        if (_uartPort >= 0) {
+            int result = uart_write_bytes(static_cast<uart_port_t>(_uartPort), buffer, size);
+            return (result > 0) ? static_cast<size_t>(result) : 0;
+        }
+#endif
+        return fwrite(buffer, 1, size, stdout);
+    }
+
+    /**
+     * @brief Push out what stdio or the UART driver still buffers
+     * @return false if stdout failed, or the UART had not finished sending
+     *         after THORLOG_ESPIDF_FLUSH_TIMEOUT_MS
+     */
+    bool flush() override {
+#ifdef THORLOG_ESPIDF_UART
+        if (_uartPort >= 0) {
+            return uart_wait_tx_done(static_cast<uart_port_t>(_uartPort),
+                                     pdMS_TO_TICKS(THORLOG_ESPIDF_FLUSH_TIMEOUT_MS)) == ESP_OK;
+        }
+#endif
+        return fflush(stdout) == 0;
     }
 
     // ========================================================================
@@ -215,11 +418,12 @@ public:
      * @param num The number to print
      * @return Number of bytes written
      *
-     * Uses default precision of 2 decimal places.
+     * Uses default precision of 2 decimal places. Rendered by the float
+     * kernel in thorlog.h, so newlib's float printf is not linked in.
      */
     size_t print(double num) override {
-        int result = printf("%.2f", num);
-        return (result > 0) ? static_cast<size_t>(result) : 0;
+        char buffer[THORLOG_NUMBER_SIZE];
+        return write(buffer, thorlog_format_double(buffer, num));
     }
 
 private:
@@ -233,110 +437,104 @@ private:
      * @param base The numeric base
      * @return Number of bytes written
      *
-     * Implementation details:
-     * - base 10: Uses printf with %ld format
-     * - base 16: Uses printf with %lx format (handles negative as unsigned)
-     * - base 2:  Manual bit-by-bit conversion (loops through bits)
+     * Negative numbers print in hex and binary as their two's complement.
      */
     size_t printSignedLong(long num, int base) {
-        int result;
-
-        switch (base) {
-            case THORLOG_DEC:  // base 10: decimal
-                result = printf("%ld", num);
-                return (result > 0) ? static_cast<size_t>(result) : 0;
-
-            case THORLOG_HEX:  // base 16: hexadecimal
-                // For negative numbers in hex, print the two's complement representation
-                if (num < 0) {
-                    result = printf("%lx", static_cast<unsigned long>(num));
-                } else {
-                    result = printf("%lx", num);
-                }
-                return (result > 0) ? static_cast<size_t>(result) : 0;
-
-            case THORLOG_BIN:  // base 2: binary
-                // Manual conversion - loop through bits
-                return printBinary(static_cast<unsigned long>(num));
-
-            default:
-                // Unsupported base, fall back to decimal
-                result = printf("%ld", num);
-                return (result > 0) ? static_cast<size_t>(result) : 0;
+        if (base == THORLOG_HEX || base == THORLOG_BIN) {
+            return printUnsignedLong(static_cast<unsigned long>(num), base);
         }
+        char buffer[THORLOG_NUMBER_SIZE];
+        return write(buffer, thorlog_format_signed(buffer, num));
     }
 
     /**
      * @brief Print an unsigned long with specified base
      * @param num The number to print
-     * @param base The numeric base
+     * @param base The numeric base; unsupported bases fall back to decimal
      * @return Number of bytes written
      *
-     * Implementation details:
-     * - base 10: Uses printf with %lu format
-     * - base 16: Uses printf with %lx format
-     * - base 2:  Manual bit-by-bit conversion (loops through bits)
+     * Rendered by the shared integer kernels in thorlog.h, then written in
+     * one write() call.
      */
     size_t printUnsignedLong(unsigned long num, int base) {
-        int result;
+        char buffer[THORLOG_NUMBER_SIZE];
+        return write(buffer, thorlog_format_number(buffer, num, base));
+    }
+
+#ifdef THORLOG_ESPIDF_UART
+    int _uartPort = -1;
+#endif
+};
 
-        switch (base) {
-            case THORLOG_DEC:  // base 10: decimal
-                result = printf("%lu", num);
-                return (result > 0) ? static_cast<size_t>(result) : 0;
+/**
+ * @class ThorLockedPrint
+ * @brief Makes each write() to another output atomic
+ *
+ * ThorLogging hands every record to its output in a single write(). If that
+ * output's write() can be split up by other tasks (e.g. a custom adapter
+ * that sends a byte at a time), wrap it in a ThorLockedPrint: the record is
+ * still built without any lock, and only the final write() is serialized
+ * by a mutex. EspIdfPrint does not need this, as fwrite() and
+ * uart_write_bytes() already hold a lock for the whole call.
+ *
+ * Usage:
+ *   static ThorLockedPrint lockedOutput(&myOutput);
+ *   ThorLog.begin(THORLOG_LEVEL_VERBOSE, &lockedOutput);
+ */
+class ThorLockedPrint : public ThorWritePrint {
+public:
+    /**
+     * @brief Constructor
+     * @param output The output to serialize writes to
+     */
+    explicit ThorLockedPrint(ThorPrint* output)
+        : _output(output), _mutex(xSemaphoreCreateMutexStatic(&_mutexBuffer)) {}
 
-            case THORLOG_HEX:  // base 16: hexadecimal
-                result = printf("%lx", num);
-                return (result > 0) ? static_cast<size_t>(result) : 0;
+    ThorLockedPrint(const ThorLockedPrint&) = delete;
+    ThorLockedPrint& operator=(const ThorLockedPrint&) = delete;
 
-            case THORLOG_BIN:  // base 2: binary
-                // Manual conversion - loop through bits
-                return printBinary(num);
+    /**
+     * @brief Write a block to the wrapped output while holding the mutex
+     * @return Number of bytes written; 0 when called from an interrupt
+     */
+    size_t write(const char* buffer, size_t size) override {
+        return writeRecord(buffer, size, THORLOG_LEVEL_SILENT);
+    }
 
-            default:
-                // Unsupported base, fall back to decimal
-                result = printf("%lu", num);
-                return (result > 0) ? static_cast<size_t>(result) : 0;
+    size_t writeRecord(const char* buffer, size_t size, int level) override {
+        if (_output == nullptr || xPortInIsrContext()) {
+            return 0;
         }
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        size_t n = _output->writeRecord(buffer, size, level);
+        xSemaphoreGive(_mutex);
+        return n;
     }
 
     /**
-     * @brief Print a number in binary format
-     * @param num The number to print (treated as unsigned)
-     * @return Number of bytes written
-     *
-     * This method manually converts the number to binary by iterating through
-     * each bit from MSB to LSB. It skips leading zeros for cleaner output.
-     *
-     * Algorithm:
-     * 1. Handle zero as a special case
-     * 2. Build binary string by extracting bits (num & 1)
-     * 3. Right-shift to process next bit (num >>= 1)
-     * 4. Print result without leading zeros
+     * @brief Flush the wrapped output while holding the mutex
      */
-    size_t printBinary(unsigned long num) {
-        // Handle zero specially - just print "0"
-        if (num == 0) {
-            return print('0');
-        }
-
-        // Buffer to hold binary digits
-        // Max 64 bits for 64-bit platforms, +1 for null terminator
-        char buffer[65];
-        int pos = 64;
-        buffer[pos] = '\0';
-
-        // Convert to binary by extracting bits from LSB to MSB
-        // Each iteration: get lowest bit, then shift right
-        while (num > 0 && pos > 0) {
-            pos--;
-            buffer[pos] = (num & 1) ? '1' : '0';  // Extract LSB
-            num >>= 1;                             // Shift to next bit
+    bool flush() override {
+        if (_output == nullptr || xPortInIsrContext()) {
+            return false;
         }
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        bool ok = _output->flush();
+        xSemaphoreGive(_mutex);
+        return ok;
+    }
 
-        // Print from the first significant digit (skip leading zeros)
-        return print(&buffer[pos]);
+    /**
+     * @brief The wrapped output's statistics
+     */
+    bool getStats(ThorSinkStats* stats) const override {
+        return _output != nullptr && _output->getStats(stats);
     }
+
+private:
+    ThorPrint* _output;
+    StaticSemaphore_t _mutexBuffer;
+    SemaphoreHandle_t _mutex;
 };
 
 // ============================================================================
@@ -0,0 +1,224 @@
+/*
+ * ThorLog Interrupt Handler Support for ESP-IDF
+ *
+ * Logging from an interrupt handler through the normal output is unsafe:
+ * EspIdfPrint goes through newlib stdio, which takes locks. With an ISR
+ * output configured, ThorLogging detects interrupt context on every call
+ * and sends those records down a separate path instead:
+ *
+ *   1. The record is encoded in binary (format address plus raw arguments,
+ *      strings copied) on the interrupt's stack. No formatting happens.
+ *   2. ThorIsrPrint copies it into a lock-free ring in internal RAM and
+ *      wakes its drain task with vTaskNotifyGiveFromISR().
+ *   3. The drain task formats the record as text (or passes the binary
+ *      record through) and writes it to the normal output.
+ *
+ * The interrupt never blocks, never allocates and never touches stdio.
+ *
+ * ============================================================================
+ * USAGE EXAMPLE:
+ * ============================================================================
+ *
+ * #include "thorlog.h"
+ * #include "thorlog_espidf.h"
+ * #include "thorlog_isr_espidf.h"
+ *
+ * static ThorIsrPrint<32> isrOutput(&EspIdfOutput);
+ *
+ * static void IRAM_ATTR encoder_isr(void* arg) {
+ *     ThorLog.warningln("Encoder glitch on channel %d", (int)(intptr_t)arg);
+ * }
+ *
+ * void app_main() {
+ *     ThorLog.begin(THORLOG_LEVEL_VERBOSE, &EspIdfOutput);
+ *     isrOutput.begin();
+ *     ThorLog.setIsrOutput(&isrOutput, thorlog_espidf_in_isr);
+ * }
+ *
+ * ============================================================================
+ * LIMITATIONS:
+ * ============================================================================
+ *
+ * The logging code itself lives in flash. Interrupt handlers that must run
+ * while the flash cache is disabled (ESP_INTR_FLAG_IRAM) cannot log.
+ * Prefix and suffix functions are not called for records from interrupts.
+ *
+ * ============================================================================
+ */
+
+#pragma once
+
+#include "thorlog.h"
+#include "thorlog_ring.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <atomic>
+
+#ifndef THORLOG_ISR_SLOTS
+#define THORLOG_ISR_SLOTS 16
+#endif
+
+#ifndef THORLOG_ISR_STACK_SIZE
+#define THORLOG_ISR_STACK_SIZE 3072
+#endif
+
+/**
+ * @brief Context check for ThorLogging::setIsrOutput()
+ * @return true when called from an interrupt handler
+ */
+inline bool thorlog_espidf_in_isr() {
+    return xPortInIsrContext() != 0;
+}
+
+/**
+ * @class ThorIsrPrint
+ * @brief ISR-safe output that defers records to a drain task
+ * @tparam Slots Number of records that can be queued (a power of two)
+ * @tparam SlotSize Maximum size of one binary record
+ * @tparam StackSize Stack size of the drain task in bytes
+ */
+template <size_t Slots = THORLOG_ISR_SLOTS, size_t SlotSize = THORLOG_RECORD_SIZE,
+          size_t StackSize = THORLOG_ISR_STACK_SIZE>
+class ThorIsrPrint : public ThorWritePrint {
+public:
+    /**
+     * @brief Constructor
+     * @param output Output the drain task writes formatted records to
+     * @param decode true to format records as text, false to pass the
+     *               binary records through (for THORLOG_MODE_BINARY setups)
+     */
+    explicit ThorIsrPrint(ThorPrint* output, bool decode = true)
+        : _output(output), _decode(decode), _dropped(0), _mutex(xSemaphoreCreateMutexStatic(&_mutexBuffer)),
+          _task(nullptr)
+    {
+    }
+
+    ThorIsrPrint(const ThorIsrPrint&) = delete;
+    ThorIsrPrint& operator=(const ThorIsrPrint&) = delete;
+
+    /**
+     * @brief Start the drain task
+     * @param priority FreeRTOS priority of the drain task
+     * @param core Core to pin the task to, or tskNO_AFFINITY
+     * @return true if the task is running
+     *
+     * Records queued before begin() are kept until the task starts.
+     */
+    bool begin(UBaseType_t priority = tskIDLE_PRIORITY + 2, BaseType_t core = tskNO_AFFINITY) {
+        if (_task != nullptr) {
+            return true;
+        }
+        _task = xTaskCreateStaticPinnedToCore(drainTask, "thorlog_isr", StackSize, this, priority,
+                                              _stack, &_taskBuffer, core);
+        return _task != nullptr;
+    }
+
+    /**
+     * @brief Queue a record; safe to call from interrupt handlers
+     * @param buffer Record bytes
+     * @param size Record size
+     * @return size if the record was queued, 0 if the ring was full
+     */
+    size_t write(const char* buffer, size_t size) override {
+        return writeRecord(buffer, size, THORLOG_LEVEL_SILENT);
+    }
+
+    /**
+     * @brief Queue a record with its level; safe to call from interrupt handlers
+     */
+    size_t writeRecord(const char* buffer, size_t size, int level) override {
+        if (!_ring.push(buffer, size, static_cast<uint8_t>(level))) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        if (_task != nullptr) {
+            if (xPortInIsrContext()) {
+                BaseType_t woken = pdFALSE;
+                vTaskNotifyGiveFromISR(_task, &woken);
+                portYIELD_FROM_ISR(woken);
+            } else {
+                xTaskNotifyGive(_task);
+            }
+        }
+        return size;
+    }
+
+    /**
+     * @brief Write the queued records from the calling task, then flush the
+     *        wrapped output
+     *
+     * Waits for the record the drain task is writing, so the output gets
+     * every record in the order it was queued. Not for interrupt handlers.
+     */
+    bool flush() override {
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        drain();
+        bool ok = _output == nullptr || _output->flush();
+        xSemaphoreGive(_mutex);
+        return ok;
+    }
+
+    /**
+     * @brief Number of records dropped because the ring was full
+     */
+    uint32_t getDropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Most records that were queued at once
+     */
+    size_t getHighWater() const { return _ring.highWater(); }
+
+    /**
+     * @brief Drops and ring depth, for ThorLogging::getStats()
+     */
+    bool getStats(ThorSinkStats* stats) const override {
+        stats->dropped = getDropped();
+        stats->highWater = static_cast<uint32_t>(_ring.highWater());
+        stats->capacity = static_cast<uint32_t>(Slots);
+        return true;
+    }
+
+private:
+    void emit(const char* data, size_t size, uint8_t level) {
+        if (_output == nullptr) {
+            return;
+        }
+        if (!_decode) {
+            _output->writeRecord(data, size, level);
+            return;
+        }
+        ThorRecord record(_output, level);
+        if (ThorLogging::formatBinary(record, data, size) > 0) {
+            record.commit();
+        }
+    }
+
+    // The drain task and flush() both call this, under _mutex so that
+    // records leave in the order they were queued
+    void drain() {
+        while (_ring.pop([this](const char* data, size_t size, uint8_t level) { emit(data, size, level); })) {
+        }
+    }
+
+    static void drainTask(void* arg) {
+        ThorIsrPrint* self = static_cast<ThorIsrPrint*>(arg);
+        for (;;) {
+            xSemaphoreTake(self->_mutex, portMAX_DELAY);
+            self->drain();
+            xSemaphoreGive(self->_mutex);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+
+    ThorRing<Slots, SlotSize> _ring;
+    ThorPrint* _output;
+    bool _decode;
+    std::atomic<uint32_t> _dropped;
+    StaticSemaphore_t _mutexBuffer;
+    SemaphoreHandle_t _mutex;
+
+    TaskHandle_t _task;
+    StaticTask_t _taskBuffer;
+    StackType_t _stack[StackSize];
+};
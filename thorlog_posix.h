@@ -0,0 +1,293 @@
+/*
+ * ThorLog POSIX Adapter
+ *
+ * Runs ThorLog natively on Linux and macOS, for host-side simulations of
+ * firmware, the benchmarks and fuzzing. ThorPosixPrint collects records in
+ * a buffer and hands them to a file descriptor in batches, so a simulation
+ * logging millions of records pays for a system call every few hundred of
+ * them rather than for each one.
+ *
+ * ============================================================================
+ * USAGE EXAMPLE:
+ * ============================================================================
+ *
+ * #include "thorlog.h"
+ * #include "thorlog_posix.h"
+ *
+ * int main() {
+ *     // Option 1: the global instance, writing to stdout
+ *     ThorLog.begin(THORLOG_LEVEL_VERBOSE, &PosixOutput);
+ *     ThorLog.setTimeSource(thorlog_posix_time_us);
+ *     ThorLog.infoln("Simulation started");
+ *
+ *     // Option 2: a log file of its own
+ *     int fd = open("sim.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+ *     static ThorPosixPrint<> fileOutput(fd);
+ *     ThorLog.addOutput(&fileOutput);
+ * }
+ *
+ * With CMake, link the thorlog target from the CMakeLists.txt at the root
+ * of this repository:
+ *
+ *   add_subdirectory(thorlog)
+ *   target_link_libraries(simulation PRIVATE thorlog::thorlog)
+ *
+ * ============================================================================
+ * NOTES:
+ * ============================================================================
+ *
+ * Records are written when the buffer is full, when one at or above the
+ * sync level (default FATAL) is logged, on flush() and when the output is
+ * destroyed, which for PosixOutput is at exit. A terminal gets every record
+ * at once. A record that does not fit into the rest of the buffer is
+ * written together with the buffer by one writev(), without being copied.
+ *
+ * Writes to the descriptor are serialized by a mutex, so records from
+ * different threads never interleave. The descriptor is not closed.
+ *
+ * ============================================================================
+ */
+
+#pragma once
+
+#include "thorlog.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#endif
+
+#ifndef THORLOG_POSIX_BUFFER_SIZE
+#define THORLOG_POSIX_BUFFER_SIZE 65536
+#endif
+
+/**
+ * @brief Time source for ThorLogging::setTimeSource()
+ * @return Microseconds of CLOCK_MONOTONIC
+ */
+inline uint64_t thorlog_posix_time_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+/**
+ * @brief Thread name for ThorLogging::setTaskInfo()
+ *
+ * The name set with pthread_setname_np(), looked up once per thread.
+ */
+inline const char* thorlog_posix_task_name() {
+    thread_local char name[16] = {'\0'};
+    thread_local bool known = false;
+    if (!known) {
+        if (pthread_getname_np(pthread_self(), name, sizeof(name)) != 0) {
+            name[0] = '\0';
+        }
+        known = true;
+    }
+    return name;
+}
+
+/**
+ * @brief CPU for ThorLogging::setTaskInfo(); 0 where the system does not
+ *        tell
+ */
+inline int thorlog_posix_core_id() {
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    return (cpu >= 0) ? cpu : 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Wait step for ThorLogging::synchronize()
+ */
+inline void thorlog_posix_yield() {
+    sched_yield();
+}
+
+/**
+ * @brief Context source for ThorLogging::setContextSource()
+ *
+ * One context per thread, in thread-local storage.
+ */
+inline ThorTaskContext* thorlog_posix_context(bool create) {
+    (void)create;
+    thread_local ThorTaskContext context = {};
+    return &context;
+}
+
+/**
+ * @brief Backtrace capture for ThorLogging::setBacktrace()
+ * @param frames Where the return addresses are stored
+ * @param max Most addresses to store
+ * @return Number of addresses stored
+ *
+ * Uses backtrace() from glibc or macOS; elsewhere nothing is captured.
+ * Like thorlog_espidf_backtrace(), the first frames are inside ThorLog.
+ */
+inline size_t thorlog_posix_backtrace(uintptr_t* frames, size_t max) {
+#if defined(__GLIBC__) || defined(__APPLE__)
+    void* addresses[64];
+    int depth = backtrace(addresses, static_cast<int>((max < 63) ? max + 1 : 64));
+    // Leave out this function itself
+    size_t n = 0;
+    for (int i = 1; i < depth && n < max; ++i) {
+        frames[n++] = reinterpret_cast<uintptr_t>(addresses[i]);
+    }
+    return n;
+#else
+    (void)frames;
+    (void)max;
+    return 0;
+#endif
+}
+
+/**
+ * @class ThorPosixPrint
+ * @brief Output that writes records to a file descriptor in batches
+ * @tparam Size Bytes of records collected before they are written
+ */
+template <size_t Size = THORLOG_POSIX_BUFFER_SIZE>
+class ThorPosixPrint : public ThorWritePrint {
+    static_assert(Size >= THORLOG_RECORD_SIZE, "ThorPosixPrint: Size must hold at least one record");
+
+public:
+    /**
+     * @brief Constructor
+     * @param fd Descriptor to write to; stays open
+     * @param syncLevel Records at this level or more severe are written at
+     *                  once (THORLOG_LEVEL_SILENT: never)
+     */
+    explicit ThorPosixPrint(int fd = STDOUT_FILENO, int syncLevel = THORLOG_LEVEL_FATAL)
+        : _fd(fd), _syncLevel(syncLevel), _interactive(isatty(fd) == 1), _len(0), _records(0), _dropped(0)
+    {
+    }
+
+    ThorPosixPrint(const ThorPosixPrint&) = delete;
+    ThorPosixPrint& operator=(const ThorPosixPrint&) = delete;
+
+    ~ThorPosixPrint() override {
+        flush();
+    }
+
+    size_t write(const char* buffer, size_t size) override {
+        return writeRecord(buffer, size, THORLOG_LEVEL_SILENT);
+    }
+
+    /**
+     * @brief Add a record to the buffer; writes the buffer when the record
+     *        does not fit or is at or above the sync level
+     */
+    size_t writeRecord(const char* buffer, size_t size, int level) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_len + size <= Size) {
+            memcpy(_buffer + _len, buffer, size);
+            _len += size;
+            ++_records;
+        } else {
+            // Write the buffer and the record in one go
+            writeLocked(buffer, size);
+        }
+        if (_interactive || (level != THORLOG_LEVEL_SILENT && level <= _syncLevel)) {
+            writeLocked(nullptr, 0);
+        }
+        return size;
+    }
+
+    /**
+     * @brief Write the buffered records now
+     * @return false if the descriptor refused some of them
+     */
+    bool flush() override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return writeLocked(nullptr, 0);
+    }
+
+    /**
+     * @brief Records lost to errors of the descriptor
+     */
+    uint32_t getDropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+    bool getStats(ThorSinkStats* stats) const override {
+        stats->dropped = getDropped();
+        stats->highWater = 0;
+        stats->capacity = 0;
+        return true;
+    }
+
+private:
+    // Writes the buffer followed by extra, retrying short writes; on an
+    // error the whole batch counts as dropped
+    bool writeLocked(const char* extra, size_t extraLen) {
+        uint32_t records = _records + ((extraLen > 0) ? 1 : 0);
+        iovec iov[2];
+        iov[0].iov_base = _buffer;
+        iov[0].iov_len = _len;
+        iov[1].iov_base = const_cast<char*>(extra);
+        iov[1].iov_len = extraLen;
+        iovec* next = iov;
+        int count = 2;
+        _len = 0;
+        _records = 0;
+        while (count > 0) {
+            if (next->iov_len == 0) {
+                ++next;
+                --count;
+                continue;
+            }
+            ssize_t n = writev(_fd, next, count);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                _dropped.fetch_add(records, std::memory_order_relaxed);
+                return false;
+            }
+            size_t done = static_cast<size_t>(n);
+            while (count > 0 && done >= next->iov_len) {
+                done -= next->iov_len;
+                ++next;
+                --count;
+            }
+            if (count > 0) {
+                next->iov_base = static_cast<char*>(next->iov_base) + done;
+                next->iov_len -= done;
+            }
+        }
+        return true;
+    }
+
+    int _fd;
+    int _syncLevel;
+    bool _interactive;
+    size_t _len;
+    uint32_t _records;  // in the buffer
+    std::atomic<uint32_t> _dropped;
+    std::mutex _mutex;
+    char _buffer[Size];
+};
+
+// ============================================================================
+// Global Instance
+// ============================================================================
+
+/**
+ * @brief Global ThorPosixPrint instance writing to stdout
+ *
+ * Usage:
+ *   ThorLog.begin(THORLOG_LEVEL_VERBOSE, &PosixOutput);
+ */
+inline ThorPosixPrint<> PosixOutput;
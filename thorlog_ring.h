@@ -0,0 +1,168 @@
+/*
+ * ThorLog Record Ring
+ *
+ * A fixed-capacity, lock-free ring of log records shared by the sinks that
+ * decouple logging from output (async, network, ISR). Any number of tasks
+ * may push and pop at the same time; a push or pop is a couple of atomic
+ * operations plus a memcpy of the record, and never blocks.
+ *
+ * The ring is a bounded MPMC queue after Dmitry Vyukov: every slot carries
+ * a sequence number that tells producers and consumers whether the slot is
+ * free, being filled, or ready, so no lock is needed to hand a slot over.
+ *
+ * ============================================================================
+ * USAGE EXAMPLE:
+ * ============================================================================
+ *
+ * ThorRing<16, 128> ring;              // 16 records of up to 128 bytes
+ *
+ * ring.push(data, size);               // false when the ring is full
+ * ring.pop([](const char* data, size_t size) {
+ *     output->write(data, size);       // called with the oldest record
+ * });
+ *
+ * ============================================================================
+ */
+
+#pragma once
+
+#include "thorlog.h"
+#include <atomic>
+
+/**
+ * @class ThorRing
+ * @brief Lock-free bounded ring of records
+ * @tparam Slots Number of records the ring holds (a power of two)
+ * @tparam SlotSize Maximum size of one record; longer records are truncated
+ */
+template <size_t Slots, size_t SlotSize = THORLOG_RECORD_SIZE>
+class ThorRing {
+    static_assert(Slots >= 2 && (Slots & (Slots - 1)) == 0, "ThorRing: Slots must be a power of two");
+    static_assert(SlotSize <= 0xFFFF, "ThorRing: SlotSize must fit in 16 bits");
+
+public:
+    ThorRing() : _enqueue(0), _dequeue(0), _highWater(0) {
+        for (size_t i = 0; i < Slots; ++i) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ThorRing(const ThorRing&) = delete;
+    ThorRing& operator=(const ThorRing&) = delete;
+
+    /**
+     * @brief Copy a record into the ring
+     * @param data Record bytes
+     * @param size Record size, truncated to SlotSize
+     * @param tag Caller-defined byte stored with the record (e.g. its level)
+     * @return false if the ring is full
+     */
+    bool push(const char* data, size_t size, uint8_t tag = 0) {
+        Slot* slot;
+        size_t pos = _enqueue.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &_slots[pos & (Slots - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence - pos);
+            if (diff == 0) {
+                if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _enqueue.load(std::memory_order_relaxed);
+            }
+        }
+
+        size = (size < SlotSize) ? size : SlotSize;
+        memcpy(slot->data, data, size);
+        slot->size = static_cast<uint16_t>(size);
+        slot->tag = tag;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        // Track the deepest the ring has been; the value is approximate
+        // while other producers and consumers are running
+        size_t depth = pos + 1 - _dequeue.load(std::memory_order_relaxed);
+        size_t high = _highWater.load(std::memory_order_relaxed);
+        while (depth > high && depth <= Slots &&
+               !_highWater.compare_exchange_weak(high, depth, std::memory_order_relaxed)) {
+        }
+        return true;
+    }
+
+    /**
+     * @brief Take the oldest record out of the ring
+     * @param consume Called as consume(const char* data, size_t size, uint8_t tag)
+     *                or consume(const char* data, size_t size) while the
+     *                record is still in its slot
+     * @return false if the ring is empty
+     */
+    template <class F>
+    bool pop(F&& consume) {
+        Slot* slot;
+        size_t pos = _dequeue.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &_slots[pos & (Slots - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence - (pos + 1));
+            if (diff == 0) {
+                if (_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _dequeue.load(std::memory_order_relaxed);
+            }
+        }
+
+        if constexpr (std::is_invocable<F, const char*, size_t, uint8_t>::value) {
+            consume(static_cast<const char*>(slot->data), static_cast<size_t>(slot->size), slot->tag);
+        } else {
+            consume(static_cast<const char*>(slot->data), static_cast<size_t>(slot->size));
+        }
+        slot->sequence.store(pos + Slots, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Drop the oldest record
+     * @return false if the ring is empty
+     */
+    bool discard() {
+        return pop([](const char*, size_t) {});
+    }
+
+    /**
+     * @brief Number of records currently queued (approximate under contention)
+     */
+    size_t size() const {
+        size_t enqueue = _enqueue.load(std::memory_order_relaxed);
+        size_t dequeue = _dequeue.load(std::memory_order_relaxed);
+        size_t depth = enqueue - dequeue;
+        return (depth <= Slots) ? depth : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    static constexpr size_t capacity() { return Slots; }
+
+    /**
+     * @brief Deepest the ring has been since construction
+     */
+    size_t highWater() const { return _highWater.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        uint16_t size;
+        uint8_t tag;
+        char data[SlotSize];
+    };
+
+    Slot _slots[Slots];
+    std::atomic<size_t> _enqueue;
+    std::atomic<size_t> _dequeue;
+    std::atomic<size_t> _highWater;
+};
@@ -0,0 +1,330 @@
+/*
+ * ThorLog Crash Buffer for ESP-IDF
+ *
+ * ThorRtcPrint keeps the most recent records in a ring in RTC or .noinit
+ * RAM, which is not cleared by a panic, watchdog or software reset. On the
+ * next boot the ring is checked and whatever was logged right before the
+ * reset can be replayed to the normal output. Logging to it costs a short
+ * critical section and a memcpy.
+ *
+ * ============================================================================
+ * USAGE EXAMPLE:
+ * ============================================================================
+ *
+ * #include "thorlog.h"
+ * #include "thorlog_espidf.h"
+ * #include "thorlog_rtc_espidf.h"
+ *
+ * // Must not have a constructor run over it at boot: declare it noinit
+ * RTC_NOINIT_ATTR static ThorRtcBuffer<4096> crashBuffer;
+ * static ThorRtcPrint<4096> crashOutput(&crashBuffer);
+ *
+ * void app_main() {
+ *     if (crashOutput.begin()) {
+ *         EspIdfOutput.print("---- log before reset ----\n");
+ *         crashOutput.replay(&EspIdfOutput);
+ *     }
+ *     ThorLog.begin(THORLOG_LEVEL_VERBOSE, &EspIdfOutput);
+ *     ThorLog.addOutput(&crashOutput);
+ * }
+ *
+ * ============================================================================
+ * NOTES:
+ * ============================================================================
+ *
+ * RTC_NOINIT_ATTR memory also survives deep sleep; __NOINIT_ATTR (internal
+ * RAM) survives resets but not deep sleep and is not limited to the 8 KB of
+ * RTC slow memory. Both are undefined after power-on, which the header
+ * (magic, size and CRC) and esp_reset_reason() detect.
+ *
+ * With THORLOG_MODE_BINARY about three times as many records fit. Binary
+ * records only hold format string addresses, so replay(output, true) only
+ * formats them if the firmware image is the one that wrote them; after an
+ * update the raw records are written instead, for tools/thorlog_decode with
+ * the old ELF. Every address is checked before it is read, and a record
+ * that does not point at strings of this image is shown as a hex dump.
+ *
+ * Each record is marked as complete once it has been copied in, so that
+ * records cut short by the reset are skipped.
+ *
+ * ============================================================================
+ */
+
+#pragma once
+
+#include "thorlog.h"
+#include "esp_attr.h"
+#include "esp_app_desc.h"
+#include "esp_memory_utils.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include <atomic>
+
+#ifndef THORLOG_RTC_SIZE
+#define THORLOG_RTC_SIZE 2048
+#endif
+
+// Longest string replay() looks for at an address from a binary record
+#ifndef THORLOG_RTC_MAX_STRING
+#define THORLOG_RTC_MAX_STRING 256
+#endif
+
+#define THORLOG_RTC_MAGIC 0x43524C54UL  // "TLRC"
+
+// Each record in the ring starts with a 16-bit word: its size in the low
+// 12 bits, and in the top 4 whether it has been copied in completely
+#define THORLOG_RTC_HEADER_SIZE 2
+#define THORLOG_RTC_MAX_RECORD  0x0FFF
+#define THORLOG_RTC_RESERVED    0x5
+#define THORLOG_RTC_COMMITTED   0xA
+
+/**
+ * @struct ThorRtcBuffer
+ * @brief Storage for ThorRtcPrint; declare it RTC_NOINIT_ATTR or __NOINIT_ATTR
+ * @tparam Size Bytes of log kept (a power of two)
+ *
+ * Deliberately has no constructor, so that nothing initializes it at boot.
+ */
+template <size_t Size = THORLOG_RTC_SIZE>
+struct ThorRtcBuffer {
+    static_assert(Size >= 64 && (Size & (Size - 1)) == 0, "ThorRtcBuffer: Size must be a power of two");
+
+    uint32_t magic;
+    uint32_t size;
+    uint32_t image;  // CRC-32 of the firmware's ELF SHA-256
+    uint32_t crc;    // CRC-32 of the fields above
+    uint32_t head;   // bytes written since the buffer was reset, mod 2^32
+    uint32_t first;  // head at the start of the oldest record in the ring
+    uint32_t tail;   // head at the last replay()
+    alignas(2) char data[Size];
+};
+
+/**
+ * @class ThorRtcPrint
+ * @brief Output that keeps the last Size bytes of log across resets
+ * @tparam Size Bytes of log kept; must match the ThorRtcBuffer
+ */
+template <size_t Size = THORLOG_RTC_SIZE>
+class ThorRtcPrint : public ThorWritePrint {
+public:
+    /**
+     * @brief Constructor; does not touch the buffer
+     * @param buffer noinit storage for the ring
+     */
+    explicit ThorRtcPrint(ThorRtcBuffer<Size>* buffer)
+        : _buffer(buffer), _ready(false), _lock(portMUX_INITIALIZER_UNLOCKED)
+    {
+    }
+
+    ThorRtcPrint(const ThorRtcPrint&) = delete;
+    ThorRtcPrint& operator=(const ThorRtcPrint&) = delete;
+
+    /**
+     * @brief Check the buffer left by the previous boot; reset it if it is
+     *        not valid
+     * @return true if it holds records that have not been replayed yet
+     *
+     * Records written before begin() are dropped.
+     */
+    bool begin() {
+        uint32_t image = imageId();
+        bool valid = esp_reset_reason() != ESP_RST_POWERON && _buffer->magic == THORLOG_RTC_MAGIC &&
+                     _buffer->size == Size && _buffer->crc == headerCrc() &&
+                     _buffer->head - _buffer->first <= Size && ((_buffer->head | _buffer->first | _buffer->tail) & 1) == 0;
+        if (!valid) {
+            _buffer->magic = THORLOG_RTC_MAGIC;
+            _buffer->size = Size;
+            _buffer->image = image;
+            _buffer->head = 0;
+            _buffer->first = 0;
+            _buffer->tail = 0;
+            _buffer->crc = headerCrc();
+        }
+        _sameImage = (_buffer->image == image);
+        _ready = true;
+        return valid && pending() > 0;
+    }
+
+    size_t write(const char* buffer, size_t size) override {
+        return writeRecord(buffer, size, THORLOG_LEVEL_SILENT);
+    }
+
+    /**
+     * @brief Append a record, overwriting the oldest ones; safe to call
+     *        from interrupt handlers
+     */
+    size_t writeRecord(const char* buffer, size_t size, int level) override {
+        (void)level;
+        if (!_ready || size == 0) {
+            return 0;
+        }
+        size_t written = size;
+        constexpr size_t largest = (Size - THORLOG_RTC_HEADER_SIZE < THORLOG_RTC_MAX_RECORD)
+                                       ? Size - THORLOG_RTC_HEADER_SIZE : THORLOG_RTC_MAX_RECORD;
+        if (size > largest) {
+            buffer += size - largest;
+            size = largest;
+        }
+        // Atomic instructions do not work on RTC memory; reserve the space
+        // and drop the records it overwrites under a spinlock, copy outside
+        // it and only then mark the record complete
+        uint32_t space = recordSpace(size);
+        portENTER_CRITICAL_SAFE(&_lock);
+        uint32_t pos = _buffer->head;
+        while (pos + space - _buffer->first > Size) {
+            uint32_t oldest = recordSpace(headerAt(_buffer->first) & THORLOG_RTC_MAX_RECORD);
+            _buffer->first = (oldest <= pos - _buffer->first) ? _buffer->first + oldest : pos;
+        }
+        _buffer->head = pos + space;
+        headerAt(pos) = static_cast<uint16_t>(size | (THORLOG_RTC_RESERVED << 12));
+        portEXIT_CRITICAL_SAFE(&_lock);
+
+        size_t offset = (pos + THORLOG_RTC_HEADER_SIZE) & (Size - 1);
+        size_t first = (size < Size - offset) ? size : Size - offset;
+        memcpy(_buffer->data + offset, buffer, first);
+        memcpy(_buffer->data, buffer + first, size - first);
+        std::atomic_thread_fence(std::memory_order_release);
+        headerAt(pos) = static_cast<uint16_t>(size | (THORLOG_RTC_COMMITTED << 12));
+        return written;
+    }
+
+    /**
+     * @brief Bytes logged since the last replay() that are still in the
+     *        ring, record headers included
+     */
+    size_t pending() const {
+        if (!_ready) {
+            return 0;
+        }
+        return _buffer->head - oldest();
+    }
+
+    /**
+     * @brief Write the records logged since the last replay() to an output
+     * @param output Where to write them
+     * @param decode true if the records are binary (THORLOG_MODE_BINARY) and
+     *               should be formatted as text
+     * @return Number of bytes of the ring that were replayed
+     *
+     * Call before logging to this output again. Afterwards the records
+     * count as replayed and are not shown again on the next boot.
+     */
+    size_t replay(ThorPrint* output, bool decode = false) {
+        size_t count = pending();
+        uint32_t pos = _buffer->head - static_cast<uint32_t>(count);
+        while (pos != _buffer->head) {
+            uint16_t header = headerAt(pos);
+            size_t size = header & THORLOG_RTC_MAX_RECORD;
+            uint32_t space = recordSpace(size);
+            unsigned state = header >> 12;
+            if ((state != THORLOG_RTC_COMMITTED && state != THORLOG_RTC_RESERVED) || space > _buffer->head - pos) {
+                break;
+            }
+            if (state == THORLOG_RTC_COMMITTED) {
+                size_t offset = (pos + THORLOG_RTC_HEADER_SIZE) & (Size - 1);
+                size_t first = (size < Size - offset) ? size : Size - offset;
+                if (decode && _sameImage) {
+                    replayBinary(output, offset, first, size);
+                } else {
+                    output->write(_buffer->data + offset, first);
+                    if (size > first) {
+                        output->write(_buffer->data, size - first);
+                    }
+                }
+            }
+            pos += space;
+        }
+        _buffer->tail = _buffer->head;
+        return count;
+    }
+
+    /**
+     * @brief Forget all records in the ring
+     */
+    void clear() {
+        portENTER_CRITICAL_SAFE(&_lock);
+        _buffer->tail = _buffer->head;
+        portEXIT_CRITICAL_SAFE(&_lock);
+    }
+
+private:
+    uint32_t headerCrc() const {
+        return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(_buffer), offsetof(ThorRtcBuffer<Size>, crc));
+    }
+
+    static uint32_t imageId() {
+        const esp_app_desc_t* app = esp_app_get_description();
+        return esp_rom_crc32_le(0, app->app_elf_sha256, sizeof(app->app_elf_sha256));
+    }
+
+    static uint32_t recordSpace(size_t size) {
+        return static_cast<uint32_t>((THORLOG_RTC_HEADER_SIZE + size + 1) & ~static_cast<size_t>(1));
+    }
+
+    // Headers are 2-byte aligned, so they never wrap
+    uint16_t& headerAt(uint32_t pos) const {
+        return *reinterpret_cast<uint16_t*>(_buffer->data + (pos & (Size - 1)));
+    }
+
+    // Start of the oldest record not replayed yet
+    uint32_t oldest() const {
+        return (_buffer->head - _buffer->tail < _buffer->head - _buffer->first) ? _buffer->tail : _buffer->first;
+    }
+
+    // The string at an address from the previous boot, if the address is
+    // readable all the way to a terminator: a damaged record must not
+    // fault the boot that replays it
+    static const char* stringAt(uint64_t address) {
+        if (address == 0 || address > UINTPTR_MAX) {
+            return nullptr;
+        }
+        const char* s = reinterpret_cast<const char*>(static_cast<uintptr_t>(address));
+        for (size_t i = 0; i < THORLOG_RTC_MAX_STRING; ++i) {
+            if (!esp_ptr_in_drom(s + i) && !esp_ptr_byte_accessible(s + i)) {
+                return nullptr;
+            }
+            if (s[i] == '\0') {
+                return s;
+            }
+        }
+        return nullptr;
+    }
+
+    // Formats one binary record, copied out of the ring if it wraps; one
+    // that can not be formatted is dumped in hex
+    void replayBinary(ThorPrint* output, size_t offset, size_t first, size_t size) {
+        char window[THORLOG_RECORD_SIZE];
+        const char* data = _buffer->data + offset;
+        if (size > first) {
+            data = (size <= sizeof(window)) ? window : nullptr;
+            if (data != nullptr) {
+                memcpy(window, _buffer->data + offset, first);
+                memcpy(window + first, _buffer->data, size - first);
+            }
+        }
+        if (data != nullptr && size >= THORLOG_BINARY_HEADER_SIZE) {
+            ThorRecord record(output, data[1] & THORLOG_BINARY_LEVEL_MASK);
+            if (ThorLogging::formatBinary(record, data, size, true, stringAt) > 0) {
+                record.commit();
+                return;
+            }
+        }
+        char line[THORLOG_HEXDUMP_LINE_SIZE];
+        for (size_t i = 0; i < size; i += THORLOG_HEXDUMP_WIDTH) {
+            uint8_t bytes[THORLOG_HEXDUMP_WIDTH];
+            size_t n = (size - i < THORLOG_HEXDUMP_WIDTH) ? size - i : THORLOG_HEXDUMP_WIDTH;
+            for (size_t j = 0; j < n; ++j) {
+                bytes[j] = static_cast<uint8_t>(_buffer->data[(offset + i + j) & (Size - 1)]);
+            }
+            ThorRecord record(output);
+            record.write(line, thorlog_format_dump_line(line, i, 4, bytes, n));
+            record.commit(THORLOG_CR);
+        }
+    }
+
+    ThorRtcBuffer<Size>* _buffer;
+    bool _ready;
+    bool _sameImage = false;
+    portMUX_TYPE _lock;
+};
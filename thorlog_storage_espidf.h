@@ -0,0 +1,409 @@
+/*
+ * ThorLog Flash Storage for ESP-IDF
+ *
+ * ThorStoragePrint keeps the log in a raw data partition so that it
+ * survives a reboot. Records are collected in a RAM page and written to
+ * flash a page at a time; the partition is used as a ring of 4 KB segments,
+ * so every sector is erased in turn and wear is spread evenly.
+ *
+ * ============================================================================
+ * USAGE EXAMPLE:
+ * ============================================================================
+ *
+ * partitions.csv:
+ *   # Name,   Type, SubType, Offset, Size
+ *   thorlog,  data, 0x40,    ,       64K
+ *
+ * #include "thorlog.h"
+ * #include "thorlog_espidf.h"
+ * #include "thorlog_storage_espidf.h"
+ *
+ * // Flush at least once a second, and at once for ERROR and FATAL records
+ * static ThorStoragePrint<> flashLog("thorlog", 1000, THORLOG_LEVEL_ERROR);
+ *
+ * void app_main() {
+ *     flashLog.begin();
+ *     flashLog.replay(&EspIdfOutput);                  // what happened last time
+ *
+ *     ThorLog.begin(THORLOG_LEVEL_VERBOSE, &EspIdfOutput);
+ *     ThorLog.addOutput(&flashLog, THORLOG_LEVEL_WARNING);
+ * }
+ *
+ * ============================================================================
+ * LAYOUT:
+ * ============================================================================
+ *
+ * Each 4 KB segment starts with a 16 byte header (magic, sequence number,
+ * page size, CRC-32 of the header) followed by pages:
+ *
+ *   uint16  length of the data
+ *   uint16  ~length
+ *   uint32  CRC-32 of the data
+ *   data, padded with 0xFF to a multiple of 4 bytes
+ *
+ * A page's data is written before its header, so a page cut short by a
+ * reset or power loss has an erased or mismatching header and is reported
+ * and skipped when the log is read back. After a reboot, writing resumes in
+ * a fresh segment after the newest one, never behind a damaged page.
+ *
+ * Flash writes stall both cores while the cache is disabled. Log through a
+ * ThorAsyncPrint wrapping the storage output to keep that off the logging
+ * tasks; record levels are passed on, so sync-on-level still works.
+ *
+ * ============================================================================
+ */
+
+#pragma once
+
+#include "thorlog.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <atomic>
+
+#ifndef THORLOG_STORAGE_PAGE_SIZE
+#define THORLOG_STORAGE_PAGE_SIZE 1024
+#endif
+
+#ifndef THORLOG_STORAGE_STACK_SIZE
+#define THORLOG_STORAGE_STACK_SIZE 3072
+#endif
+
+#define THORLOG_STORAGE_SECTOR_SIZE 4096
+#define THORLOG_STORAGE_MAGIC       0x474F4C54UL  // "TLOG"
+
+/**
+ * @class ThorStoragePrint
+ * @brief Output that appends records to a ring of flash segments
+ * @tparam PageSize Bytes collected in RAM before they are written to flash
+ * @tparam StackSize Stack size of the flush task in bytes
+ */
+template <size_t PageSize = THORLOG_STORAGE_PAGE_SIZE, size_t StackSize = THORLOG_STORAGE_STACK_SIZE>
+class ThorStoragePrint : public ThorWritePrint {
+    static constexpr size_t SEGMENT_HEADER_SIZE = 16;
+    static constexpr size_t PAGE_HEADER_SIZE = 8;
+    static constexpr size_t PAGE_CAPACITY = (PageSize + 3) & ~static_cast<size_t>(3);
+
+    static_assert(PageSize >= 64, "ThorStoragePrint: PageSize is too small");
+    static_assert(SEGMENT_HEADER_SIZE + PAGE_HEADER_SIZE + PAGE_CAPACITY <= THORLOG_STORAGE_SECTOR_SIZE,
+                  "ThorStoragePrint: a page must fit into one segment");
+
+public:
+    /**
+     * @brief Constructor
+     * @param label Label of the data partition to use
+     * @param flushIntervalMs Longest a record stays in RAM; 0 to flush only
+     *                        when the page is full or on syncLevel
+     * @param syncLevel Records at this level or more severe are written to
+     *                  flash at once (THORLOG_LEVEL_SILENT: never)
+     */
+    explicit ThorStoragePrint(const char* label, uint32_t flushIntervalMs = 1000,
+                              int syncLevel = THORLOG_LEVEL_FATAL)
+        : _label(label), _flushIntervalMs(flushIntervalMs), _syncLevel(syncLevel),
+          _partition(nullptr), _segments(0), _segment(0), _sequence(0), _offset(0),
+          _pageLen(0), _dropped(0), _damaged(0), _task(nullptr),
+          _mutex(xSemaphoreCreateMutexStatic(&_mutexBuffer))
+    {
+    }
+
+    ThorStoragePrint(const ThorStoragePrint&) = delete;
+    ThorStoragePrint& operator=(const ThorStoragePrint&) = delete;
+
+    /**
+     * @brief Find the partition, open a new segment and start the flush task
+     * @param priority FreeRTOS priority of the flush task
+     * @param core Core to pin the task to, or tskNO_AFFINITY
+     * @return false if the partition is missing or smaller than two segments
+     *
+     * Records written before begin() are kept in the page until it is full.
+     */
+    bool begin(UBaseType_t priority = tskIDLE_PRIORITY + 1, BaseType_t core = tskNO_AFFINITY) {
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        bool ok = _partition != nullptr || open();
+        if (ok) {
+            flushLocked();
+        }
+        xSemaphoreGive(_mutex);
+        if (ok && _task == nullptr && _flushIntervalMs > 0) {
+            _task = xTaskCreateStaticPinnedToCore(flushTask, "thorlog_flash", StackSize, this, priority,
+                                                  _stack, &_taskBuffer, core);
+        }
+        return ok;
+    }
+
+    size_t write(const char* buffer, size_t size) override {
+        return writeRecord(buffer, size, THORLOG_LEVEL_SILENT);
+    }
+
+    /**
+     * @brief Append a record to the page; flushes when the page is full or
+     *        the level is at or above the sync level
+     * @return size, or 0 from an interrupt handler
+     */
+    size_t writeRecord(const char* buffer, size_t size, int level) override {
+        if (xPortInIsrContext()) {
+            return 0;
+        }
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        size_t written = 0;
+        while (written < size) {
+            if (_pageLen == PageSize && !flushLocked()) {
+                _dropped.fetch_add(static_cast<uint32_t>(size - written), std::memory_order_relaxed);
+                break;
+            }
+            size_t n = (size - written < PageSize - _pageLen) ? size - written : PageSize - _pageLen;
+            memcpy(_page + _pageLen, buffer + written, n);
+            _pageLen += n;
+            written += n;
+        }
+        if (level != THORLOG_LEVEL_SILENT && level <= _syncLevel) {
+            flushLocked();
+        }
+        xSemaphoreGive(_mutex);
+        return size;
+    }
+
+    /**
+     * @brief Write the pending page to flash now
+     * @return false if begin() has not succeeded or the flash write failed
+     */
+    bool flush() override {
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        bool ok = flushLocked();
+        xSemaphoreGive(_mutex);
+        return ok;
+    }
+
+    /**
+     * @brief Read the stored log back, oldest page first
+     * @param consume Called as consume(const char* data, size_t size) for
+     *                each intact page
+     * @return Number of bytes passed to consume
+     *
+     * Damaged pages end their segment and are counted in getDamaged().
+     * Logging to this output blocks while the log is read: consume must not
+     * log through a ThorLogging instance that writes here.
+     */
+    template <class F>
+    size_t read(F&& consume) {
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        size_t total = 0;
+        if (_partition != nullptr) {
+            flushLocked();
+            _damaged.store(0, std::memory_order_relaxed);
+            // The segment after the current one is the oldest
+            for (size_t i = 1; i <= _segments; ++i) {
+                total += readSegment((_segment + i) % _segments, consume);
+            }
+        }
+        xSemaphoreGive(_mutex);
+        return total;
+    }
+
+    /**
+     * @brief Write the stored log to another output
+     * @return Number of bytes written
+     */
+    size_t replay(ThorPrint* output) {
+        return read([output](const char* data, size_t size) { output->write(data, size); });
+    }
+
+    /**
+     * @brief Erase the stored log and start over in the first segment
+     * @return false if the partition could not be erased
+     */
+    bool erase() {
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        bool ok = _partition != nullptr &&
+                  esp_partition_erase_range(_partition, 0, _segments * THORLOG_STORAGE_SECTOR_SIZE) == ESP_OK &&
+                  openSegment(0);
+        xSemaphoreGive(_mutex);
+        return ok;
+    }
+
+    /**
+     * @brief Bytes lost because the page could not be flushed
+     */
+    uint32_t getDropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Damaged pages found by the last read()
+     */
+    uint32_t getDamaged() const { return _damaged.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Bytes dropped, for ThorLogging::getStats()
+     */
+    bool getStats(ThorSinkStats* stats) const override {
+        stats->dropped = getDropped();
+        stats->highWater = 0;
+        stats->capacity = 0;
+        return true;
+    }
+
+private:
+    struct SegmentHeader {
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t pageSize;
+        uint32_t crc;
+    };
+
+    struct PageHeader {
+        uint16_t length;
+        uint16_t check;
+        uint32_t crc;
+    };
+
+    static_assert(sizeof(SegmentHeader) == SEGMENT_HEADER_SIZE, "unexpected segment header size");
+    static_assert(sizeof(PageHeader) == PAGE_HEADER_SIZE, "unexpected page header size");
+
+    static uint32_t crc32(const void* data, size_t size) {
+        return esp_rom_crc32_le(0, static_cast<const uint8_t*>(data), static_cast<uint32_t>(size));
+    }
+
+    bool readSegmentHeader(size_t segment, SegmentHeader* header) const {
+        return esp_partition_read(_partition, segment * THORLOG_STORAGE_SECTOR_SIZE, header, sizeof(*header)) == ESP_OK &&
+               header->magic == THORLOG_STORAGE_MAGIC &&
+               header->crc == crc32(header, offsetof(SegmentHeader, crc));
+    }
+
+    // Locate the partition and resume after the newest valid segment
+    bool open() {
+        const esp_partition_t* partition =
+            esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, _label);
+        if (partition == nullptr || partition->size < 2 * THORLOG_STORAGE_SECTOR_SIZE) {
+            return false;
+        }
+        _partition = partition;
+        _segments = partition->size / THORLOG_STORAGE_SECTOR_SIZE;
+
+        size_t newest = _segments - 1;
+        uint32_t sequence = 0;
+        for (size_t i = 0; i < _segments; ++i) {
+            SegmentHeader header;
+            // Sequence numbers are compared as a difference so that they
+            // may wrap around
+            if (readSegmentHeader(i, &header) &&
+                (sequence == 0 || static_cast<int32_t>(header.sequence - sequence) > 0)) {
+                sequence = header.sequence;
+                newest = i;
+            }
+        }
+        _sequence = sequence;
+        return openSegment((newest + 1) % _segments);
+    }
+
+    bool openSegment(size_t segment) {
+        size_t base = segment * THORLOG_STORAGE_SECTOR_SIZE;
+        SegmentHeader header;
+        header.magic = THORLOG_STORAGE_MAGIC;
+        header.sequence = ++_sequence;
+        header.pageSize = PageSize;
+        header.crc = crc32(&header, offsetof(SegmentHeader, crc));
+        _segment = segment;
+        _offset = SEGMENT_HEADER_SIZE;
+        return esp_partition_erase_range(_partition, base, THORLOG_STORAGE_SECTOR_SIZE) == ESP_OK &&
+               esp_partition_write(_partition, base, &header, sizeof(header)) == ESP_OK;
+    }
+
+    bool flushLocked() {
+        if (_pageLen == 0) {
+            return true;
+        }
+        if (_partition == nullptr) {
+            return false;
+        }
+        size_t padded = (_pageLen + 3) & ~static_cast<size_t>(3);
+        if (_offset + PAGE_HEADER_SIZE + padded > THORLOG_STORAGE_SECTOR_SIZE &&
+            !openSegment((_segment + 1) % _segments)) {
+            return false;
+        }
+        memset(_page + _pageLen, 0xFF, padded - _pageLen);
+
+        PageHeader header;
+        header.length = static_cast<uint16_t>(_pageLen);
+        header.check = static_cast<uint16_t>(~_pageLen);
+        header.crc = crc32(_page, _pageLen);
+
+        // Data first: the header is what marks the page as complete
+        size_t base = _segment * THORLOG_STORAGE_SECTOR_SIZE + _offset;
+        bool ok = esp_partition_write(_partition, base + PAGE_HEADER_SIZE, _page, padded) == ESP_OK &&
+                  esp_partition_write(_partition, base, &header, sizeof(header)) == ESP_OK;
+        // A failed page still uses up its space; the next one goes after it
+        _offset += PAGE_HEADER_SIZE + padded;
+        if (!ok) {
+            _dropped.fetch_add(static_cast<uint32_t>(_pageLen), std::memory_order_relaxed);
+        }
+        _pageLen = 0;
+        return ok;
+    }
+
+    // Uses the page buffer, which is empty after the flush in read()
+    template <class F>
+    size_t readSegment(size_t segment, F& consume) {
+        SegmentHeader segmentHeader;
+        if (!readSegmentHeader(segment, &segmentHeader)) {
+            return 0;
+        }
+        size_t base = segment * THORLOG_STORAGE_SECTOR_SIZE;
+        size_t offset = SEGMENT_HEADER_SIZE;
+        size_t total = 0;
+        while (offset + PAGE_HEADER_SIZE <= THORLOG_STORAGE_SECTOR_SIZE) {
+            PageHeader header;
+            if (esp_partition_read(_partition, base + offset, &header, sizeof(header)) != ESP_OK) {
+                break;
+            }
+            if (header.length == 0xFFFF && header.check == 0xFFFF) {
+                break;  // erased: end of the segment
+            }
+            size_t padded = (static_cast<size_t>(header.length) + 3) & ~static_cast<size_t>(3);
+            bool intact = static_cast<uint16_t>(~header.length) == header.check && header.length > 0 &&
+                          header.length <= PAGE_CAPACITY &&
+                          offset + PAGE_HEADER_SIZE + padded <= THORLOG_STORAGE_SECTOR_SIZE &&
+                          esp_partition_read(_partition, base + offset + PAGE_HEADER_SIZE, _page, header.length) == ESP_OK &&
+                          crc32(_page, header.length) == header.crc;
+            if (!intact) {
+                _damaged.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            consume(static_cast<const char*>(_page), static_cast<size_t>(header.length));
+            total += header.length;
+            offset += PAGE_HEADER_SIZE + padded;
+        }
+        return total;
+    }
+
+    static void flushTask(void* arg) {
+        ThorStoragePrint* self = static_cast<ThorStoragePrint*>(arg);
+        for (;;) {
+            vTaskDelay(pdMS_TO_TICKS(self->_flushIntervalMs));
+            self->flush();
+        }
+    }
+
+    const char* _label;
+    uint32_t _flushIntervalMs;
+    int _syncLevel;
+
+    const esp_partition_t* _partition;
+    size_t _segments;
+    size_t _segment;
+    uint32_t _sequence;
+    size_t _offset;
+
+    char _page[PAGE_CAPACITY];
+    size_t _pageLen;
+
+    std::atomic<uint32_t> _dropped;
+    std::atomic<uint32_t> _damaged;
+
+    TaskHandle_t _task;
+    StaticTask_t _taskBuffer;
+    StackType_t _stack[StackSize];
+
+    StaticSemaphore_t _mutexBuffer;
+    SemaphoreHandle_t _mutex;
+};
@@ -0,0 +1,358 @@
+/*
+ * ThorLog UDP and Syslog Output for ESP-IDF
+ *
+ * ThorUdpPrint streams the log to a UDP collector. Log calls copy the
+ * finished record into a lock-free ring and return; a FreeRTOS task packs
+ * whole records into datagrams of up to THORLOG_UDP_MTU bytes and sends
+ * them every flush interval, or sooner when the ring fills up or an ERROR
+ * is logged. Records are never split across datagrams.
+ *
+ * With setSyslog() every record is sent as an RFC 5424 message instead
+ * (one message per datagram, as RFC 5426 requires), with its severity taken
+ * from the record's level.
+ *
+ * ============================================================================
+ * USAGE EXAMPLE:
+ * ============================================================================
+ *
+ * #include "thorlog.h"
+ * #include "thorlog_espidf.h"
+ * #include "thorlog_udp_espidf.h"
+ *
+ * static ThorUdpPrint<64> netOutput("192.168.1.10", 514);
+ *
+ * void app_main() {
+ *     ThorLog.begin(THORLOG_LEVEL_VERBOSE, &EspIdfOutput);
+ *     // ... connect Wi-Fi ...
+ *     netOutput.setSyslog("sensor-12", "thermostat");
+ *     netOutput.begin();
+ *     ThorLog.addOutput(&netOutput, THORLOG_LEVEL_INFO);
+ * }
+ *
+ * ============================================================================
+ * BACKPRESSURE:
+ * ============================================================================
+ *
+ * While the link is slow or down, records wait in the ring and a datagram
+ * that could not be sent is retried every flush interval. Once the ring is
+ * filled past THORLOG_UDP_RESERVE slots from the end, only records at the
+ * priority level (default WARNING) or more severe are queued; when it is
+ * completely full these push out the oldest record. Dropped records are
+ * counted, and reported in the stream once the link is back.
+ *
+ * ============================================================================
+ */
+
+#pragma once
+
+#include "thorlog.h"
+#include "thorlog_ring.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include <atomic>
+
+#ifndef THORLOG_UDP_SLOTS
+#define THORLOG_UDP_SLOTS 32
+#endif
+
+#ifndef THORLOG_UDP_STACK_SIZE
+#define THORLOG_UDP_STACK_SIZE 4096
+#endif
+
+#ifndef THORLOG_UDP_MTU
+#define THORLOG_UDP_MTU 1400
+#endif
+
+#ifndef THORLOG_UDP_RESERVE
+#define THORLOG_UDP_RESERVE (Slots / 4)
+#endif
+
+#define THORLOG_SYSLOG_USER   1
+#define THORLOG_SYSLOG_DAEMON 3
+#define THORLOG_SYSLOG_LOCAL0 16
+
+/**
+ * @class ThorUdpPrint
+ * @brief Sends records to a UDP or syslog collector from a background task
+ * @tparam Slots Number of records that can be queued (a power of two)
+ * @tparam StackSize Stack size of the send task in bytes
+ */
+template <size_t Slots = THORLOG_UDP_SLOTS, size_t StackSize = THORLOG_UDP_STACK_SIZE>
+class ThorUdpPrint : public ThorWritePrint {
+    static_assert(THORLOG_RECORD_SIZE + 128 <= THORLOG_UDP_MTU, "ThorUdpPrint: THORLOG_UDP_MTU is too small for a record");
+
+public:
+    /**
+     * @brief Constructor
+     * @param host IPv4 address of the collector
+     * @param port UDP port of the collector
+     * @param flushIntervalMs Longest a record waits before it is sent
+     */
+    ThorUdpPrint(const char* host, uint16_t port, uint32_t flushIntervalMs = 250)
+        : _host(host), _port(port), _flushIntervalMs(flushIntervalMs),
+          _priorityLevel(THORLOG_LEVEL_WARNING), _syslog(false), _facility(THORLOG_SYSLOG_LOCAL0),
+          _hostname("-"), _appName("-"), _dropped(0), _sendErrors(0), _linkUp(false),
+          _socket(-1), _batchSize(0), _carrySize(0), _reported(0), _task(nullptr)
+    {
+    }
+
+    ThorUdpPrint(const ThorUdpPrint&) = delete;
+    ThorUdpPrint& operator=(const ThorUdpPrint&) = delete;
+
+    /**
+     * @brief Send every record as an RFC 5424 syslog message
+     * @param hostname HOSTNAME field, or nullptr for none
+     * @param appName APP-NAME field, or nullptr for none
+     * @param facility Syslog facility, e.g. THORLOG_SYSLOG_LOCAL0
+     *
+     * Call before begin(). The strings must outlive the output.
+     */
+    void setSyslog(const char* hostname, const char* appName, uint8_t facility = THORLOG_SYSLOG_LOCAL0) {
+        _hostname = (hostname != nullptr && hostname[0] != '\0') ? hostname : "-";
+        _appName = (appName != nullptr && appName[0] != '\0') ? appName : "-";
+        _facility = facility;
+        _syslog = true;
+    }
+
+    /**
+     * @brief Set the least severe level that may use the reserved slots
+     */
+    void setPriorityLevel(int level) { _priorityLevel = level; }
+
+    /**
+     * @brief Start the send task
+     * @param priority FreeRTOS priority of the send task
+     * @param core Core to pin the task to, or tskNO_AFFINITY
+     * @return true if the task is running
+     *
+     * The network does not need to be up yet. Records queued before
+     * begin() are sent once the task starts.
+     */
+    bool begin(UBaseType_t priority = tskIDLE_PRIORITY + 1, BaseType_t core = tskNO_AFFINITY) {
+        if (_task != nullptr) {
+            return true;
+        }
+        memset(&_address, 0, sizeof(_address));
+        _address.sin_family = AF_INET;
+        _address.sin_port = htons(_port);
+        if (inet_pton(AF_INET, _host, &_address.sin_addr) != 1) {
+            return false;
+        }
+        _task = xTaskCreateStaticPinnedToCore(sendTask, "thorlog_udp", StackSize, this, priority,
+                                              _stack, &_taskBuffer, core);
+        return _task != nullptr;
+    }
+
+    size_t write(const char* buffer, size_t size) override {
+        return writeRecord(buffer, size, THORLOG_LEVEL_SILENT);
+    }
+
+    /**
+     * @brief Queue a record for sending
+     * @return size if the record was queued, 0 if it was dropped
+     */
+    size_t writeRecord(const char* buffer, size_t size, int level) override {
+        bool priority = (level != THORLOG_LEVEL_SILENT && level <= _priorityLevel);
+        size_t reserve = THORLOG_UDP_RESERVE;
+        if (!priority && _ring.size() + reserve >= Slots) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        if (!_ring.push(buffer, size, static_cast<uint8_t>(level))) {
+            if (!priority || !_ring.discard() || !_ring.push(buffer, size, static_cast<uint8_t>(level))) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return 0;
+            }
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        // Wake the task early only when waiting would cost records
+        if (_task != nullptr && ((priority && level <= THORLOG_LEVEL_ERROR) || _ring.size() >= Slots / 2)) {
+            xTaskNotifyGive(_task);
+        }
+        return size;
+    }
+
+    /**
+     * @brief Send the queued records now rather than at the next interval
+     * @return false if the last datagram failed to send
+     *
+     * Only wakes the send task; it does not wait for the datagrams, which
+     * UDP would not confirm anyway.
+     */
+    bool flush() override {
+        if (_task != nullptr) {
+            xTaskNotifyGive(_task);
+        }
+        return isLinkUp() || getSendErrors() == 0;
+    }
+
+    /**
+     * @brief Number of records dropped because the ring was full
+     */
+    uint32_t getDropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Number of datagrams that failed to send
+     */
+    uint32_t getSendErrors() const { return _sendErrors.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Drops and ring depth, for ThorLogging::getStats()
+     */
+    bool getStats(ThorSinkStats* stats) const override {
+        stats->dropped = getDropped();
+        stats->highWater = static_cast<uint32_t>(_ring.highWater());
+        stats->capacity = static_cast<uint32_t>(Slots);
+        return true;
+    }
+
+    /**
+     * @brief false after a send failed, until one succeeds again
+     */
+    bool isLinkUp() const { return _linkUp.load(std::memory_order_relaxed); }
+
+private:
+    static void sendTask(void* arg) {
+        ThorUdpPrint* self = static_cast<ThorUdpPrint*>(arg);
+        for (;;) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(self->_flushIntervalMs));
+            self->drain();
+        }
+    }
+
+    // Packs queued records into datagrams until the ring is empty or a send
+    // fails; an unsent datagram and the record that did not fit are kept
+    // for the next round
+    void drain() {
+        if (_socket < 0) {
+            _socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+            if (_socket < 0) {
+                _linkUp.store(false, std::memory_order_relaxed);
+                return;
+            }
+        }
+        for (;;) {
+            if (_carrySize == 0 && !_ring.pop([this](const char* data, size_t size, uint8_t level) {
+                    memcpy(_carry, data, size);
+                    _carrySize = size;
+                    _carryLevel = level;
+                })) {
+                break;
+            }
+            if (_batchSize > 0 && (_syslog || _batchSize + _carrySize > THORLOG_UDP_MTU)) {
+                if (!send()) {
+                    return;
+                }
+            }
+            if (_batchSize == 0 && !reportDropped()) {
+                return;
+            }
+            if (_syslog) {
+                appendSyslog(_carry, _carrySize, _carryLevel);
+            } else {
+                memcpy(_batch + _batchSize, _carry, _carrySize);
+                _batchSize += _carrySize;
+            }
+            _carrySize = 0;
+        }
+        if (_batchSize > 0) {
+            send();
+        }
+    }
+
+    bool send() {
+        if (sendto(_socket, _batch, _batchSize, 0, reinterpret_cast<const struct sockaddr*>(&_address),
+                   sizeof(_address)) < 0) {
+            _sendErrors.fetch_add(1, std::memory_order_relaxed);
+            _linkUp.store(false, std::memory_order_relaxed);
+            return false;
+        }
+        _linkUp.store(true, std::memory_order_relaxed);
+        _batchSize = 0;
+        return true;
+    }
+
+    // Starts a datagram with a note of the records dropped since the last
+    // one; false if the note is a syslog message that could not be sent
+    bool reportDropped() {
+        uint32_t dropped = _dropped.load(std::memory_order_relaxed);
+        if (dropped == _reported) {
+            return true;
+        }
+        char note[64];
+        size_t len = 0;
+        static const char text[] = "thorlog: dropped ";
+        memcpy(note, text, sizeof(text) - 1);
+        len += sizeof(text) - 1;
+        len += thorlog_format_unsigned(note + len, dropped - _reported);
+        memcpy(note + len, " records" THORLOG_CR, sizeof(" records" THORLOG_CR) - 1);
+        len += sizeof(" records" THORLOG_CR) - 1;
+        _reported = dropped;
+        if (_syslog) {
+            appendSyslog(note, len, THORLOG_LEVEL_WARNING);
+            return send();
+        }
+        memcpy(_batch, note, len);
+        _batchSize = len;
+        return true;
+    }
+
+    // <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD MSG, leaving the
+    // timestamp to the collector
+    void appendSyslog(const char* data, size_t size, uint8_t level) {
+        // FATAL..VERBOSE to crit, err, warning, info, debug, debug
+        static const uint8_t severity[] = {6, 2, 3, 4, 6, 7, 7};
+        while (size > 0 && (data[size - 1] == '\r' || data[size - 1] == '\n')) {
+            --size;
+        }
+        char* out = _batch + _batchSize;
+        *out++ = '<';
+        out += thorlog_format_unsigned(out, _facility * 8u + severity[(level < sizeof(severity)) ? level : 0]);
+        memcpy(out, ">1 - ", 5);
+        out += 5;
+        out = appendField(out, _hostname);
+        out = appendField(out, _appName);
+        memcpy(out, "- - - ", 6);
+        out += 6;
+        size_t room = THORLOG_UDP_MTU - static_cast<size_t>(out - _batch);
+        size = (size < room) ? size : room;
+        memcpy(out, data, size);
+        _batchSize = static_cast<size_t>(out - _batch) + size;
+    }
+
+    static char* appendField(char* out, const char* field) {
+        for (size_t i = 0; field[i] != '\0' && i < 48; ++i) {
+            *out++ = field[i];
+        }
+        *out++ = ' ';
+        return out;
+    }
+
+    ThorRing<Slots, THORLOG_RECORD_SIZE> _ring;
+    const char* _host;
+    uint16_t _port;
+    uint32_t _flushIntervalMs;
+    int _priorityLevel;
+    bool _syslog;
+    uint8_t _facility;
+    const char* _hostname;
+    const char* _appName;
+    std::atomic<uint32_t> _dropped;
+    std::atomic<uint32_t> _sendErrors;
+    std::atomic<bool> _linkUp;
+
+    // Only used by the send task
+    int _socket;
+    struct sockaddr_in _address;
+    char _batch[THORLOG_UDP_MTU];
+    size_t _batchSize;
+    char _carry[THORLOG_RECORD_SIZE];
+    size_t _carrySize;
+    uint8_t _carryLevel = 0;
+    uint32_t _reported;
+
+    TaskHandle_t _task;
+    StaticTask_t _taskBuffer;
+    StackType_t _stack[StackSize];
+};
@@ -0,0 +1,79 @@
+/*
+ * ThorLog host benchmark
+ *
+ * Runs the cases in thorlog_bench.h against null outputs, then
+ * ThorPosixPrint writing to /dev/null, and prints the results. On x86 the counter is the time stamp counter, elsewhere
+ * nanoseconds from steady_clock. Compare runs from the same machine only;
+ * examples/espidf-bench gives the numbers that matter on the device.
+ *
+ * ============================================================================
+ * BUILD AND USAGE:
+ * ============================================================================
+ *
+ *   g++ -std=c++17 -O2 -I.. thorlog_bench.cpp -o thorlog_bench -pthread
+ *   ./thorlog_bench
+ *
+ * ============================================================================
+ */
+
+#include "thorlog.h"
+#include "thorlog_bench.h"
+#include "thorlog_posix.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define THORLOG_BENCH_UNIT "cycles"
+#else
+#define THORLOG_BENCH_UNIT "ns"
+#endif
+
+/**
+ * StdoutPrint - Writes records to stdout
+ */
+class StdoutPrint : public ThorWritePrint {
+public:
+    size_t write(const char* buffer, size_t size) override {
+        return fwrite(buffer, 1, size, stdout);
+    }
+};
+
+static uint64_t benchCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+static uint64_t benchClock() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Sink cases: the batched POSIX output against a write per record, both
+// into /dev/null so that only the system call overhead is measured
+static void benchSinks(ThorBench& bench) {
+    static ThorLogging log;
+    static int fd = open("/dev/null", O_WRONLY);
+    static ThorPosixPrint<> batched(fd);
+    static ThorPosixPrint<> direct(fd, THORLOG_LEVEL_VERBOSE);
+
+    bench.header("Sinks (\"v=%d\", ln)");
+    log.begin(THORLOG_LEVEL_VERBOSE, &batched);
+    bench.run("ThorPosixPrint", nullptr, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.begin(THORLOG_LEVEL_VERBOSE, &direct);
+    bench.run("ThorPosixPrint (write each)", nullptr, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+}
+
+int main() {
+    static StdoutPrint output;
+    ThorBench bench(&output, benchCounter, THORLOG_BENCH_UNIT);
+    thorlog_bench_core(bench, benchClock);
+    benchSinks(bench);
+    return 0;
+}
@@ -0,0 +1,315 @@
+/*
+ * ThorLog benchmark suite
+ *
+ * Measures what a log call costs: cycles (or nanoseconds on hosts without
+ * a cycle counter) and output bytes per call, for filtered-out calls,
+ * literal-only records, every format specifier, the ln variants with
+ * prefix and suffix, and the other record features. The sinks are null
+ * outputs, so the numbers are the cost of ThorLog itself; platform
+ * drivers add their own sink cases with ThorBench::run().
+ *
+ * Shared by tools/thorlog_bench.cpp (host) and examples/espidf-bench
+ * (ESP32), so both report the same cases.
+ *
+ * ============================================================================
+ * OUTPUT:
+ * ============================================================================
+ *
+ *   case                               cycles/call   bytes/call
+ *   filtered (runtime level)                     3            0
+ *   literal ln                                  57           19
+ *   ...
+ *
+ * Each case runs in batches of THORLOG_BENCH_BATCH calls and reports the
+ * cheapest batch, which keeps interrupts and task switches out of the
+ * result. The cost of reading the counter is measured first and taken off.
+ *
+ * ============================================================================
+ */
+
+#pragma once
+
+#include "thorlog.h"
+
+#include <cstdio>
+
+#ifndef THORLOG_BENCH_BATCH
+#define THORLOG_BENCH_BATCH 16
+#endif
+
+#ifndef THORLOG_BENCH_ITERATIONS
+#define THORLOG_BENCH_ITERATIONS 2048
+#endif
+
+/**
+ * ThorNullPrint - Output that counts records and bytes and throws them away
+ */
+class ThorNullPrint : public ThorWritePrint {
+public:
+    size_t write(const char* buffer, size_t size) override {
+        return writeRecord(buffer, size, THORLOG_LEVEL_SILENT);
+    }
+
+    size_t writeRecord(const char* buffer, size_t size, int level) override {
+        (void)level;
+        // Touch the data so that the copy into the record is not optimized out
+        _last = (size > 0) ? buffer[size - 1] : 0;
+        _bytes += size;
+        ++_records;
+        return size;
+    }
+
+    uint64_t bytes() const { return _bytes; }
+    uint64_t records() const { return _records; }
+
+private:
+    volatile uint64_t _bytes = 0;
+    volatile uint64_t _records = 0;
+    volatile char _last = 0;
+};
+
+/**
+ * ThorBench - Runs benchmark cases and prints one result line per case
+ */
+class ThorBench {
+public:
+    /**
+     * \param report - where the results are printed
+     * \param counter - cycle counter or clock to measure with
+     * \param unit - what the counter counts, for the column heading
+     * \param counterBits - width of the counter; 32 for the ESP32 cycle
+     *                      count, so that a wrap inside a batch is handled
+     */
+    ThorBench(ThorPrint* report, timefunction counter, const char* unit = "cycles", unsigned counterBits = 64)
+        : _report(report), _counter(counter), _unit(unit),
+          _mask((counterBits >= 64) ? ~0ULL : ((1ULL << counterBits) - 1)), _overhead(0)
+    {
+        _overhead = measure([](unsigned) {});
+    }
+
+    /**
+     * Print the column headings.
+     */
+    void header(const char* title) {
+        ThorRecord record(_report);
+        record.print("\n");
+        record.print(title);
+        record.print("\n");
+        char unit[24];
+        snprintf(unit, sizeof(unit), "%s/call", _unit);
+        pad(record, "case", 32);
+        pad(record, unit, 14, true);
+        pad(record, "bytes/call", 13, true);
+        record.print("\n");
+        record.commit();
+    }
+
+    /**
+     * Run a case and print its result.
+     *
+     * \param name - case name
+     * \param sink - the null output the case logs to, for the byte count;
+     *               nullptr if it logs somewhere else
+     * \param body - called as body(i) for THORLOG_BENCH_ITERATIONS values
+     *               of i; should make one log call
+     */
+    template <typename F>
+    void run(const char* name, const ThorNullPrint* sink, F body) {
+        uint64_t bytes = (sink != nullptr) ? sink->bytes() : 0;
+        uint64_t cost = measure(body);
+        uint64_t calls = static_cast<uint64_t>(THORLOG_BENCH_ITERATIONS / THORLOG_BENCH_BATCH) * THORLOG_BENCH_BATCH;
+        bytes = (sink != nullptr) ? (sink->bytes() - bytes) / calls : 0;
+
+        ThorRecord record(_report);
+        pad(record, name, 32);
+        number(record, (cost > _overhead) ? (cost - _overhead) / THORLOG_BENCH_BATCH : 0, 14);
+        number(record, bytes, 13);
+        record.print("\n");
+        record.commit();
+    }
+
+    /**
+     * Print a line for a case that could not run.
+     */
+    void skip(const char* name, const char* reason) {
+        ThorRecord record(_report);
+        pad(record, name, 32);
+        record.print("skipped: ");
+        record.print(reason);
+        record.print("\n");
+        record.commit();
+    }
+
+private:
+    // Cheapest batch of THORLOG_BENCH_BATCH calls, in counter ticks
+    template <typename F>
+    uint64_t measure(F body) {
+        uint64_t best = ~0ULL;
+        unsigned i = 0;
+        for (unsigned batch = 0; batch < THORLOG_BENCH_ITERATIONS / THORLOG_BENCH_BATCH; ++batch) {
+            uint64_t start = _counter();
+            for (unsigned j = 0; j < THORLOG_BENCH_BATCH; ++j) {
+                body(i++);
+            }
+            uint64_t cost = (_counter() - start) & _mask;
+            if (cost < best) {
+                best = cost;
+            }
+        }
+        return best;
+    }
+
+    static void pad(ThorRecord& record, const char* text, size_t width, bool right = false) {
+        size_t len = strlen(text);
+        if (right) {
+            spaces(record, len, width);
+        }
+        record.print(text);
+        if (!right) {
+            spaces(record, len, width);
+        }
+    }
+
+    static void number(ThorRecord& record, uint64_t value, size_t width) {
+        char digits[THORLOG_NUMBER_SIZE];
+        size_t len = thorlog_format_unsigned(digits, value);
+        spaces(record, len, width);
+        record.write(digits, len);
+    }
+
+    static void spaces(ThorRecord& record, size_t len, size_t width) {
+        for (; len < width; ++len) {
+            record.print(' ');
+        }
+    }
+
+    ThorPrint* _report;
+    timefunction _counter;
+    const char* _unit;
+    uint64_t _mask;
+    uint64_t _overhead;
+};
+
+// ============================================================================
+// The common cases
+// ============================================================================
+
+inline void thorlog_bench_prefix(ThorPrint* output, int level) {
+    (void)level;
+    output->print("[main] ");
+}
+
+inline void thorlog_bench_suffix(ThorPrint* output, int level) {
+    (void)level;
+    output->print(" <");
+}
+
+// The benchmark logs from one task, so one context does for all
+inline ThorTaskContext* thorlog_bench_context(bool create) {
+    (void)create;
+    static ThorTaskContext context;
+    return &context;
+}
+
+/**
+ * Run the cases that only need ThorLog and a null output.
+ *
+ * \param bench - where the results go
+ * \param clock - time source for the timestamp cases, in microseconds
+ */
+inline void thorlog_bench_core(ThorBench& bench, timefunction clock) {
+    static ThorNullPrint sink;
+    static ThorNullPrint second;
+    static ThorLogging log;
+    static ThorLogger tagged("bench", log);
+    static const char* text = "sensor";
+
+    log.begin(THORLOG_LEVEL_WARNING, &sink);
+
+    bench.header("Filtered out");
+    bench.run("filtered (runtime level)", &sink, [](unsigned i) { log.verboseln("value %d", static_cast<int>(i)); });
+    bench.run("filtered (tag level)", &sink, [](unsigned i) { tagged.verboseln("value %d", static_cast<int>(i)); });
+
+    log.setLevel(THORLOG_LEVEL_VERBOSE);
+
+    bench.header("Records");
+    bench.run("literal", &sink, [](unsigned) { log.info("Literal message"); });
+    bench.run("literal ln", &sink, [](unsigned) { log.infoln("Literal message"); });
+    bench.run("THORLOG_FMT literal ln", &sink, [](unsigned) { log.infoln(THORLOG_FMT("Literal message")); });
+    bench.run("tagged literal ln", &sink, [](unsigned) { tagged.infoln("Literal message"); });
+
+    bench.header("Specifiers (one argument, ln)");
+    bench.run("%s", &sink, [](unsigned) { log.infoln("v=%s", text); });
+    bench.run("%s string_view", &sink, [](unsigned) { log.infoln("v=%s", std::string_view(text, 6)); });
+    bench.run("%c", &sink, [](unsigned i) { log.infoln("v=%c", static_cast<char>('a' + (i & 15))); });
+    bench.run("%C", &sink, [](unsigned i) { log.infoln("v=%C", static_cast<char>(i & 31)); });
+    bench.run("%d", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i * 7919)); });
+    bench.run("%i", &sink, [](unsigned i) { log.infoln("v=%i", -static_cast<int>(i * 7919)); });
+    bench.run("%l", &sink, [](unsigned i) { log.infoln("v=%l", static_cast<long>(i) * 1000003L); });
+    bench.run("%u", &sink, [](unsigned i) { log.infoln("v=%u", static_cast<unsigned long>(i) * 4000037UL); });
+    bench.run("%x", &sink, [](unsigned i) { log.infoln("v=%x", i * 0x9E3779B9U); });
+    bench.run("%X", &sink, [](unsigned i) { log.infoln("v=%X", i * 0x9E3779B9U); });
+    bench.run("%b", &sink, [](unsigned i) { log.infoln("v=%b", i & 0xFFFF); });
+    bench.run("%B", &sink, [](unsigned i) { log.infoln("v=%B", i & 0xFFFF); });
+    bench.run("%t", &sink, [](unsigned i) { log.infoln("v=%t", (i & 1) != 0); });
+    bench.run("%T", &sink, [](unsigned i) { log.infoln("v=%T", (i & 1) != 0); });
+    bench.run("%D", &sink, [](unsigned i) { log.infoln("v=%D", i * 1.25); });
+    bench.run("%.4F", &sink, [](unsigned i) { log.infoln("v=%.4F", static_cast<float>(i) * 0.125f); });
+    bench.run("%p", &sink, [](unsigned) { log.infoln("v=%p", text); });
+    bench.run("%d %s %x %D", &sink, [](unsigned i) {
+        log.infoln("%d %s %x %D", static_cast<int>(i), text, i, i * 0.5);
+    });
+
+    bench.header("Prefix, suffix and context (\"v=%d\", ln)");
+    log.setPrefix(thorlog_bench_prefix);
+    bench.run("prefix", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.setSuffix(thorlog_bench_suffix);
+    bench.run("prefix and suffix", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.clearPrefix();
+    log.clearSuffix();
+    log.setShowLevel(false);
+    bench.run("no level", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.setShowLevel(true);
+    log.setTimestamp(THORLOG_TIMESTAMP_US, clock);
+    bench.run("timestamp", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.setTimestamp(THORLOG_TIMESTAMP_NONE);
+    log.setContextSource(thorlog_bench_context);
+    {
+        ThorContext context(log, thorlog_kv("conn", 42), thorlog_kv("sensor", 3));
+        bench.run("scoped context", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    }
+    log.setContextSource(nullptr);
+    bench.run("tagged", &sink, [](unsigned i) { tagged.infoln("v=%d", static_cast<int>(i)); });
+
+    bench.header("Other record types");
+    bench.run("kv (int, double)", &sink, [](unsigned i) {
+        log.infoln("reading", thorlog_kv("raw", static_cast<int>(i)), thorlog_kv("temp", i * 0.25));
+    });
+    static uint8_t block[64];
+    bench.run("hexdump 64 bytes", &sink, [](unsigned i) {
+        block[0] = static_cast<uint8_t>(i);
+        log.hexdump(THORLOG_LEVEL_INFO, block, sizeof(block));
+    });
+
+    bench.run("sampled 1 in 16", &sink, [](unsigned i) {
+        THORLOG_SAMPLE_EVERY(log, 16, THORLOG_LEVEL_INFO, "v=%d", static_cast<int>(i));
+    });
+
+    log.addOutput(&second);
+    bench.run("two outputs", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i)); });
+    log.removeOutput(&second);
+
+    log.setMode(THORLOG_MODE_BINARY);
+    log.setTimeSource(clock);
+    bench.header("Binary mode");
+    bench.run("literal ln", &sink, [](unsigned) { log.infoln("Literal message"); });
+    bench.run("%d", &sink, [](unsigned i) { log.infoln("v=%d", static_cast<int>(i * 7919)); });
+    bench.run("%s", &sink, [](unsigned) { log.infoln("v=%s", text); });
+    bench.run("%d %s %x %D", &sink, [](unsigned i) {
+        log.infoln("%d %s %x %D", static_cast<int>(i), text, i, i * 0.5);
+    });
+    bench.run("kv (int, double)", &sink, [](unsigned i) {
+        log.infoln("reading", thorlog_kv("raw", static_cast<int>(i)), thorlog_kv("temp", i * 0.25));
+    });
+    log.setMode(THORLOG_MODE_TEXT);
+}
@@ -0,0 +1,811 @@
+/*
+ * ThorLog binary record decoder
+ *
+ * Turns captures of THORLOG_MODE_BINARY output back into text or JSON
+ * lines. Binary records only carry the address of their format string, so
+ * the firmware ELF the capture came from is needed to look the strings up.
+ * Bytes that are not part of a binary record (bootloader output, plain
+ * printf) are passed through unchanged in text output. Structured (kv)
+ * records are printed as JSON lines.
+ *
+ * Records with an interned format ID (THORLOG_INTERN) are looked up in the
+ * ELF's .thorlog_dict section, or in a dictionary file written from it with
+ * --dict, which is all that is needed to decode them.
+ *
+ * Backtraces (ThorLogging::setBacktrace) are printed one frame per line
+ * below their record, with the function each address falls in according to
+ * the ELF's symbol table.
+ *
+ * Captures can be UART logs, dumps of a ThorStoragePrint partition
+ * (--flash) or the datagrams of a ThorUdpPrint (--udp). Files are memory
+ * mapped and decoded in place, so their size does not matter.
+ *
+ * ============================================================================
+ * BUILD AND USAGE:
+ * ============================================================================
+ *
+ *   g++ -std=c++17 -O2 -I.. thorlog_decode.cpp -o thorlog_decode
+ *
+ *   thorlog_decode build/app.elf capture.bin
+ *   cat /dev/ttyUSB0 | thorlog_decode build/app.elf -
+ *   thorlog_decode --level warning --tag wifi build/app.elf capture.bin
+ *   thorlog_decode --json build/app.elf capture.bin > capture.jsonl
+ *
+ *   parttool.py read_partition --partition-name thorlog --output flash.bin
+ *   thorlog_decode --flash build/app.elf flash.bin
+ *
+ *   thorlog_decode --udp 5140 build/app.elf
+ *
+ *   thorlog_decode --dict build/app.elf > app.dict
+ *   thorlog_decode app.dict capture.bin
+ *
+ * Options:
+ *   --level L   only records at level L or more severe (fatal, error,
+ *               warning, info, trace, verbose, or 1 to 6)
+ *   --tag T     only records of tagged logger T
+ *   --json      one JSON line per record; other bytes are dropped
+ *   --flash     the capture is a ThorStoragePrint partition dump
+ *   --udp P     listen for ThorUdpPrint datagrams on UDP port P
+ *
+ * With --level or --tag, bytes outside binary records are dropped too.
+ *
+ * Dictionary files have one "<hex id><TAB><format>" line per string, with
+ * backslash, newline and tab escaped as \\, \n and \t.
+ *
+ * ============================================================================
+ */
+
+#include "thorlog.h"
+#include "thorlog_storage_dump.h"
+
+#include <algorithm>
+#include <cxxabi.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Arguments beyond this many are decoded but not printed
+#define THORLOG_DECODE_MAX_ARGS 32
+
+/**
+ * ElfImage - Minimal ELF reader resolving addresses to strings
+ *
+ * Supports 32 and 64 bit little-endian ELF files, which covers the Xtensa
+ * and RISC-V ESP32 targets as well as host builds. Also holds the interned
+ * format strings, read from the ELF or from a dictionary file.
+ */
+class ElfImage {
+public:
+    /**
+     * Load an ELF file, or a dictionary file written by --dict.
+     */
+    bool load(const char* path) {
+        FILE* f = fopen(path, "rb");
+        if (f == nullptr) {
+            return false;
+        }
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        _data.resize(size > 0 ? static_cast<size_t>(size) : 0);
+        bool ok = !_data.empty() && fread(_data.data(), 1, _data.size(), f) == _data.size();
+        fclose(f);
+        if (ok && _data.size() >= 4 && memcmp(_data.data(), "\x7f" "ELF", 4) != 0) {
+            return parseDictionary();
+        }
+        return ok && parseSections();
+    }
+
+    /**
+     * The interned format string with this ID, or nullptr.
+     */
+    const char* formatFor(uint64_t id) const {
+        auto it = _dictionary.find(id);
+        return (it != _dictionary.end()) ? it->second.c_str() : nullptr;
+    }
+
+    /**
+     * Write the interned format strings as a dictionary file.
+     */
+    void writeDictionary(FILE* out) const {
+        for (const auto& entry : _dictionary) {
+            fprintf(out, "%llx\t", static_cast<unsigned long long>(entry.first));
+            for (char c : entry.second) {
+                switch (c) {
+                    case '\\': fputs("\\\\", out); break;
+                    case '\n': fputs("\\n", out); break;
+                    case '\t': fputs("\\t", out); break;
+                    default: fputc(c, out); break;
+                }
+            }
+            fputc('\n', out);
+        }
+    }
+
+    size_t dictionarySize() const { return _dictionary.size(); }
+
+    /**
+     * The demangled name of the function containing address, with the
+     * offset into it ("app_main+0x1c"), or an empty string.
+     */
+    std::string symbolFor(uint64_t address) const {
+        auto it = std::upper_bound(_symbols.begin(), _symbols.end(), address,
+                                   [](uint64_t a, const Symbol& sym) { return a < sym.address; });
+        if (it == _symbols.begin()) {
+            return std::string();
+        }
+        --it;
+        if (address >= it->address + it->size) {
+            return std::string();
+        }
+        const char* name = reinterpret_cast<const char*>(_data.data() + it->name);
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        std::string result = (status == 0 && demangled != nullptr) ? demangled : name;
+        free(demangled);
+        char offset[24];
+        snprintf(offset, sizeof(offset), "+0x%llx", static_cast<unsigned long long>(address - it->address));
+        return result + offset;
+    }
+
+    /**
+     * The NUL-terminated string at a load address, or nullptr if the
+     * address is not inside an allocated section that has file contents.
+     */
+    const char* stringAt(uint64_t address) const {
+        for (const Section& s : _sections) {
+            if (address >= s.address && address < s.address + s.size) {
+                uint64_t offset = s.offset + (address - s.address);
+                const char* str = reinterpret_cast<const char*>(_data.data() + offset);
+                // Refuse strings that run off the end of the section
+                if (memchr(str, '\0', static_cast<size_t>(s.address + s.size - address)) == nullptr) {
+                    return nullptr;
+                }
+                return str;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    struct Section {
+        uint64_t address;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Symbol {
+        uint64_t address;
+        uint64_t size;
+        size_t name;  // offset of the name in _data
+    };
+
+    static const uint32_t SHT_SYMTAB = 2;
+    static const uint32_t SHT_NOBITS = 8;
+    static const uint8_t STT_FUNC = 2;
+    static const uint64_t SHF_ALLOC = 0x2;
+    static constexpr const char* DICTIONARY_SECTION = ".thorlog_dict";
+
+    uint64_t read(size_t offset, size_t size) const {
+        uint64_t v = 0;
+        if (offset + size > _data.size()) {
+            return 0;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            v |= static_cast<uint64_t>(_data[offset + i]) << (8 * i);
+        }
+        return v;
+    }
+
+    bool parseSections() {
+        if (_data.size() < 52 || memcmp(_data.data(), "\x7f" "ELF", 4) != 0 || _data[5] != 1) {
+            return false;
+        }
+        bool is64 = (_data[4] == 2);
+        size_t word = is64 ? 8 : 4;
+        uint64_t shoff = read(is64 ? 0x28 : 0x20, word);
+        size_t shentsize = static_cast<size_t>(read(is64 ? 0x3A : 0x2E, 2));
+        size_t shnum = static_cast<size_t>(read(is64 ? 0x3C : 0x30, 2));
+        size_t shstrndx = static_cast<size_t>(read(is64 ? 0x3E : 0x32, 2));
+        uint64_t names = read(static_cast<size_t>(shoff) + shstrndx * shentsize + 8 + 2 * word, word);
+        for (size_t i = 0; i < shnum; ++i) {
+            size_t sh = static_cast<size_t>(shoff) + i * shentsize;
+            uint32_t name = static_cast<uint32_t>(read(sh, 4));
+            uint32_t type = static_cast<uint32_t>(read(sh + 4, 4));
+            uint64_t flags = read(sh + 8, word);
+            Section s;
+            s.address = read(sh + 8 + word, word);
+            s.offset = read(sh + 8 + 2 * word, word);
+            s.size = read(sh + 8 + 3 * word, word);
+            if (type == SHT_NOBITS || s.size == 0 || s.offset + s.size > _data.size()) {
+                continue;
+            }
+            if (type == SHT_SYMTAB) {
+                size_t link = static_cast<size_t>(read(sh + 8 + 4 * word, 4));
+                uint64_t strtab = read(static_cast<size_t>(shoff) + link * shentsize + 8 + 2 * word, word);
+                uint64_t strsize = read(static_cast<size_t>(shoff) + link * shentsize + 8 + 3 * word, word);
+                parseSymbols(s, is64, strtab, strsize);
+            } else if (flags & SHF_ALLOC) {
+                _sections.push_back(s);
+            } else if (names + name + sizeof(".thorlog_dict") <= _data.size() &&
+                       strcmp(reinterpret_cast<const char*>(_data.data() + names + name), DICTIONARY_SECTION) == 0) {
+                parseEntries(s);
+            }
+        }
+        std::sort(_symbols.begin(), _symbols.end(),
+                  [](const Symbol& a, const Symbol& b) { return a.address < b.address; });
+        return true;
+    }
+
+    // Function symbols only; the names stay in _data
+    void parseSymbols(const Section& s, bool is64, uint64_t strtab, uint64_t strsize) {
+        size_t entsize = is64 ? 24 : 16;
+        if (strtab + strsize > _data.size()) {
+            return;
+        }
+        for (size_t pos = static_cast<size_t>(s.offset); pos + entsize <= s.offset + s.size; pos += entsize) {
+            uint32_t name = static_cast<uint32_t>(read(pos, 4));
+            uint8_t info = static_cast<uint8_t>(read(pos + (is64 ? 4 : 12), 1));
+            Symbol sym;
+            sym.address = is64 ? read(pos + 8, 8) : read(pos + 4, 4);
+            sym.size = is64 ? read(pos + 16, 8) : read(pos + 8, 4);
+            sym.name = static_cast<size_t>(strtab + name);
+            if ((info & 0x0F) == STT_FUNC && sym.size > 0 && name < strsize &&
+                memchr(_data.data() + sym.name, '\0', static_cast<size_t>(strsize - name)) != nullptr) {
+                _symbols.push_back(sym);
+            }
+        }
+    }
+
+    // Entries are a byte holding THORLOG_INTERN_BITS followed by the
+    // NUL-terminated text; the ID is recomputed from the text
+    void parseEntries(const Section& s) {
+        size_t pos = static_cast<size_t>(s.offset);
+        size_t end = static_cast<size_t>(s.offset + s.size);
+        while (pos + 1 < end) {
+            unsigned bits = _data[pos++];
+            const char* text = reinterpret_cast<const char*>(_data.data() + pos);
+            const void* nul = memchr(text, '\0', end - pos);
+            if (nul == nullptr || bits < 16 || bits > 32) {
+                fprintf(stderr, "thorlog_decode: damaged %s section\n", DICTIONARY_SECTION);
+                return;
+            }
+            size_t len = static_cast<size_t>(static_cast<const char*>(nul) - text);
+            addEntry(thorlog_intern_id(text, len, bits), std::string(text, len));
+            pos += len + 1;
+        }
+    }
+
+    bool parseDictionary() {
+        std::string line;
+        for (size_t i = 0; i <= _data.size(); ++i) {
+            if (i < _data.size() && _data[i] != '\n') {
+                line += static_cast<char>(_data[i]);
+                continue;
+            }
+            char* rest = nullptr;
+            unsigned long long id = strtoull(line.c_str(), &rest, 16);
+            if (!line.empty() && (rest == line.c_str() || *rest != '\t')) {
+                return false;
+            }
+            if (!line.empty()) {
+                std::string text;
+                for (++rest; *rest != '\0'; ++rest) {
+                    if (*rest == '\\' && rest[1] != '\0') {
+                        ++rest;
+                        text += (*rest == 'n') ? '\n' : (*rest == 't') ? '\t' : *rest;
+                    } else {
+                        text += *rest;
+                    }
+                }
+                addEntry(id, text);
+            }
+            line.clear();
+        }
+        _data.clear();
+        return true;
+    }
+
+    // The same literal is usually stored once per call site; different
+    // literals with one ID can not be told apart in a capture
+    void addEntry(uint64_t id, const std::string& text) {
+        auto it = _dictionary.find(id);
+        if (it == _dictionary.end()) {
+            _dictionary.emplace(id, text);
+        } else if (it->second != text) {
+            fprintf(stderr, "thorlog_decode: interned ID %llx collides: \"%s\" and \"%s\"\n",
+                    static_cast<unsigned long long>(id), it->second.c_str(), text.c_str());
+        }
+    }
+
+    std::vector<uint8_t> _data;
+    std::vector<Section> _sections;
+    std::map<uint64_t, std::string> _dictionary;
+    std::vector<Symbol> _symbols;
+};
+
+/**
+ * FilePrint - ThorPrint writing to a stdio stream
+ */
+class FilePrint : public ThorWritePrint {
+public:
+    explicit FilePrint(FILE* file) : _file(file) {}
+
+    size_t write(const char* buffer, size_t size) override {
+        return fwrite(buffer, 1, size, _file);
+    }
+
+private:
+    FILE* _file;
+};
+
+/**
+ * StringPrint - ThorPrint collecting the text in a string
+ */
+class StringPrint : public ThorWritePrint {
+public:
+    size_t write(const char* buffer, size_t size) override {
+        text.append(buffer, size);
+        return size;
+    }
+
+    std::string text;
+};
+
+/**
+ * DecodeOptions - What to print, from the command line
+ */
+struct DecodeOptions {
+    int level = THORLOG_LEVEL_VERBOSE;  // least severe level printed
+    const char* tag = nullptr;          // only this tag, if set
+    bool json = false;
+    bool flash = false;
+    int udpPort = 0;
+
+    // Bytes outside records only make sense in unfiltered text output
+    bool passText() const { return !json && tag == nullptr && level == THORLOG_LEVEL_VERBOSE; }
+};
+
+/**
+ * Decoder - Splits a byte stream into binary records and prints them
+ */
+class Decoder {
+public:
+    Decoder(const ElfImage& elf, const DecodeOptions& options, FILE* out)
+        : _elf(elf), _options(options), _file(out), _out(out) {}
+
+    /**
+     * Decode the records in data. Returns the number of bytes used; unless
+     * final is set, a record cut off at the end is left for the next call.
+     */
+    size_t feed(const uint8_t* data, size_t size, bool final) {
+        bool passText = _options.passText();
+        size_t pos = 0;
+        while (pos < size) {
+            ThorBinaryRecordInfo info;
+            ThorArg args[THORLOG_DECODE_MAX_ARGS];
+            long used = thorlog_decode_binary(data + pos, size - pos, &info, args, THORLOG_DECODE_MAX_ARGS);
+            if (used > 0) {
+                if (selected(info)) {
+                    printRecord(info, args);
+                }
+                pos += static_cast<size_t>(used);
+            } else if (used == 0 && !final) {
+                break;  // wait for the rest of the record
+            } else {
+                // Not a record: everything up to the next sync byte is text
+                const void* sync = memchr(data + pos + 1, THORLOG_BINARY_SYNC, size - pos - 1);
+                size_t end = (sync != nullptr) ? static_cast<size_t>(static_cast<const uint8_t*>(sync) - data) : size;
+                if (passText) {
+                    fwrite(data + pos, 1, end - pos, _file);
+                }
+                pos = end;
+            }
+        }
+        return pos;
+    }
+
+private:
+    bool selected(const ThorBinaryRecordInfo& info) const {
+        if (info.level > _options.level) {
+            return false;
+        }
+        if (_options.tag != nullptr) {
+            const char* tag = (info.tag != 0) ? _elf.stringAt(info.tag) : nullptr;
+            return tag != nullptr && strcmp(tag, _options.tag) == 0;
+        }
+        return true;
+    }
+
+    void printRecord(const ThorBinaryRecordInfo& info, const ThorArg* args) {
+        if (info.fields != nullptr) {
+            printFields(info);
+        } else if (_options.json) {
+            printJson(info, args);
+        } else {
+            printText(info, args);
+        }
+    }
+
+    const char* tagName(const ThorBinaryRecordInfo& info) const {
+        if (info.tag == 0) {
+            return nullptr;
+        }
+        const char* tag = _elf.stringAt(info.tag);
+        return (tag != nullptr) ? tag : "?";
+    }
+
+    // The message with its arguments filled in
+    void printMessage(ThorRecord& record, const ThorBinaryRecordInfo& info, const ThorArg* args) const {
+        const char* format = info.interned ? _elf.formatFor(info.format) : _elf.stringAt(info.format);
+        if (format != nullptr) {
+            size_t argc = (info.argc < THORLOG_DECODE_MAX_ARGS) ? info.argc : THORLOG_DECODE_MAX_ARGS;
+            ThorLogging::format(record, format, args, argc);
+        } else {
+            char unknown[48];
+            snprintf(unknown, sizeof(unknown), info.interned ? "<unknown format #%llx>" : "<unknown format 0x%llx>",
+                     static_cast<unsigned long long>(info.format));
+            record.print(unknown);
+        }
+    }
+
+    // The "skipped", "truncated" and "backtrace" members of a JSON line
+    void printJsonExtras(ThorRecord& record, const ThorBinaryRecordInfo& info) const {
+        if (info.skipped != 0) {
+            record.print(",\"skipped\":");
+            record.printUnsigned(info.skipped);
+        }
+        if (info.truncated) {
+            record.print(",\"truncated\":true");
+        }
+        if (info.depth > 0) {
+            std::vector<uint64_t> frames(info.depth);
+            thorlog_get_backtrace(&info, frames.data(), frames.size());
+            record.print(",\"backtrace\":[");
+            for (size_t i = 0; i < frames.size(); ++i) {
+                std::string symbol = _elf.symbolFor(frames[i]);
+                char frame[32];
+                snprintf(frame, sizeof(frame), "%s\"0x%llx", (i > 0) ? "," : "", static_cast<unsigned long long>(frames[i]));
+                record.print(frame);
+                if (!symbol.empty()) {
+                    record.print(' ');
+                    record.write(symbol.data(), symbol.size());
+                }
+                record.print('"');
+            }
+            record.print(']');
+        }
+    }
+
+    // Structured records become JSON lines, with keys looked up in the ELF
+    void printFields(const ThorBinaryRecordInfo& info) {
+        ThorRecord record(&_out);
+        const char* msg = _elf.stringAt(info.format);
+        thorlog_print_json_header(record, info.timestamp != 0, info.timestamp, info.level, tagName(info),
+                                  (msg != nullptr) ? msg : "?");
+        const ElfImage& elf = _elf;
+        if (!thorlog_print_fields(record, info.fields, info.fieldsSize, [&elf](uint64_t key) { return elf.stringAt(key); })) {
+            record.print(",\"damaged\":true");
+        }
+        printJsonExtras(record, info);
+        record.print('}');
+        record.commit((info.cr || _options.json) ? "\n" : nullptr);
+    }
+
+    // Text records as JSON lines, with the formatted message as "msg"
+    void printJson(const ThorBinaryRecordInfo& info, const ThorArg* args) {
+        StringPrint message;
+        ThorRecord text(&message);
+        printMessage(text, info, args);
+        text.commit();
+
+        ThorRecord record(&_out);
+        thorlog_print_json_header(record, info.timestamp != 0, info.timestamp, info.level, tagName(info),
+                                  message.text.c_str());
+        printJsonExtras(record, info);
+        record.print('}');
+        record.commit("\n");
+    }
+
+    void printText(const ThorBinaryRecordInfo& info, const ThorArg* args) {
+        static const char levels[] = "?FEWITV";
+        ThorRecord record(&_out);
+        if (info.timestamp != 0) {
+            char stamp[32];
+            snprintf(stamp, sizeof(stamp), "[%6llu.%06llu] ",
+                     static_cast<unsigned long long>(info.timestamp / 1000000),
+                     static_cast<unsigned long long>(info.timestamp % 1000000));
+            record.print(stamp);
+        }
+        record.print(levels[info.level < 7 ? info.level : 0]);
+        record.print(": ");
+        const char* tag = tagName(info);
+        if (tag != nullptr) {
+            record.print(tag);
+            record.print(": ");
+        }
+        printMessage(record, info, args);
+        if (info.skipped != 0) {
+            record.print(" (");
+            record.printUnsigned(info.skipped);
+            record.print(" skipped)");
+        }
+        if (info.truncated) {
+            record.print('~');
+        }
+        // The frames go on lines of their own, so end this one
+        record.commit((info.cr || info.depth > 0) ? "\n" : nullptr);
+        printBacktrace(info);
+    }
+
+    // One line per frame, below the record
+    void printBacktrace(const ThorBinaryRecordInfo& info) {
+        if (info.depth == 0) {
+            return;
+        }
+        std::vector<uint64_t> frames(info.depth);
+        thorlog_get_backtrace(&info, frames.data(), frames.size());
+        for (size_t i = 0; i < frames.size(); ++i) {
+            ThorRecord record(&_out);
+            char frame[48];
+            snprintf(frame, sizeof(frame), "    #%u 0x%08llx", static_cast<unsigned>(i),
+                     static_cast<unsigned long long>(frames[i]));
+            record.print(frame);
+            std::string symbol = _elf.symbolFor(frames[i]);
+            if (!symbol.empty()) {
+                record.print(' ');
+                record.write(symbol.data(), symbol.size());
+            }
+            record.commit("\n");
+        }
+    }
+
+    const ElfImage& _elf;
+    const DecodeOptions& _options;
+    FILE* _file;
+    FilePrint _out;
+};
+
+/**
+ * MappedFile - A capture file, memory mapped where that is available
+ */
+class MappedFile {
+public:
+    ~MappedFile() {
+#ifndef _WIN32
+        if (_map != nullptr) {
+            munmap(_map, _size);
+        }
+#endif
+    }
+
+    bool open(const char* path) {
+#ifndef _WIN32
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        if (ok && st.st_size > 0) {
+            _size = static_cast<size_t>(st.st_size);
+            void* map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, _size, MADV_SEQUENTIAL);
+                _map = map;
+            } else {
+                ok = false;
+            }
+        }
+        close(fd);
+        return ok;
+#else
+        FILE* file = fopen(path, "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        uint8_t chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            _copy.insert(_copy.end(), chunk, chunk + n);
+        }
+        fclose(file);
+        _size = _copy.size();
+        return true;
+#endif
+    }
+
+    const uint8_t* data() const {
+#ifndef _WIN32
+        return static_cast<const uint8_t*>(_map);
+#else
+        return _copy.data();
+#endif
+    }
+
+    size_t size() const { return _size; }
+
+private:
+#ifndef _WIN32
+    void* _map = nullptr;
+#else
+    std::vector<uint8_t> _copy;
+#endif
+    size_t _size = 0;
+};
+
+// Decode a live stream (a serial port, a pipe) as it arrives
+static void decodeStream(Decoder& decoder, FILE* in)
+{
+    std::vector<uint8_t> pending;
+    uint8_t chunk[4096];
+    bool done = false;
+    while (!done) {
+#ifndef _WIN32
+        // read() returns what has arrived instead of waiting for a full chunk
+        ssize_t got = read(fileno(in), chunk, sizeof(chunk));
+        size_t n = (got > 0) ? static_cast<size_t>(got) : 0;
+#else
+        size_t n = fread(chunk, 1, sizeof(chunk), in);
+#endif
+        done = (n == 0);
+        pending.insert(pending.end(), chunk, chunk + n);
+        size_t used = decoder.feed(pending.data(), pending.size(), done);
+        pending.erase(pending.begin(), pending.begin() + static_cast<long>(used));
+        fflush(stdout);
+    }
+}
+
+// ThorUdpPrint never splits a record across datagrams
+static bool decodeUdp(Decoder& decoder, int port)
+{
+#ifndef _WIN32
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    std::vector<uint8_t> datagram(65536);
+    for (;;) {
+        ssize_t n = recv(fd, datagram.data(), datagram.size(), 0);
+        if (n > 0) {
+            decoder.feed(datagram.data(), static_cast<size_t>(n), true);
+            fflush(stdout);
+        }
+    }
+#else
+    (void)decoder;
+    (void)port;
+    return false;
+#endif
+}
+
+static int parseLevel(const char* text)
+{
+    static const char* const names[] = {"silent", "fatal", "error", "warning", "info", "trace", "verbose"};
+    if (text[0] >= '1' && text[0] <= '6' && text[1] == '\0') {
+        return text[0] - '0';
+    }
+    for (int level = THORLOG_LEVEL_FATAL; level <= THORLOG_LEVEL_VERBOSE; ++level) {
+        // A full name or its first letter, as in the text output
+        if (strcmp(text, names[level]) == 0 || (text[1] == '\0' && (text[0] | 0x20) == names[level][0])) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+static int usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [--level L] [--tag T] [--json] [--flash] <firmware.elf | app.dict> <capture.bin | ->\n"
+                    "       %s [--level L] [--tag T] [--json] --udp <port> <firmware.elf | app.dict>\n"
+                    "       %s --dict <firmware.elf>\n", name, name, name);
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    DecodeOptions options;
+    bool dict = false;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; ++arg) {
+        const char* option = argv[arg];
+        bool hasValue = arg + 1 < argc;
+        if (strcmp(option, "--dict") == 0) {
+            dict = true;
+        } else if (strcmp(option, "--json") == 0) {
+            options.json = true;
+        } else if (strcmp(option, "--flash") == 0) {
+            options.flash = true;
+        } else if (strcmp(option, "--level") == 0 && hasValue) {
+            options.level = parseLevel(argv[++arg]);
+            if (options.level < 0) {
+                fprintf(stderr, "%s: unknown level %s\n", argv[0], argv[arg]);
+                return 2;
+            }
+        } else if (strcmp(option, "--tag") == 0 && hasValue) {
+            options.tag = argv[++arg];
+        } else if (strcmp(option, "--udp") == 0 && hasValue) {
+            options.udpPort = atoi(argv[++arg]);
+            if (options.udpPort <= 0 || options.udpPort > 65535) {
+                fprintf(stderr, "%s: bad port %s\n", argv[0], argv[arg]);
+                return 2;
+            }
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    int operands = (dict || options.udpPort != 0) ? 1 : 2;
+    if (argc - arg != operands) {
+        return usage(argv[0]);
+    }
+
+    ElfImage elf;
+    const char* image = argv[arg];
+    if (!elf.load(image)) {
+        fprintf(stderr, "%s: cannot read ELF or dictionary file %s\n", argv[0], image);
+        return 1;
+    }
+    if (dict) {
+        if (elf.dictionarySize() == 0) {
+            fprintf(stderr, "%s: %s has no interned format strings\n", argv[0], image);
+            return 1;
+        }
+        elf.writeDictionary(stdout);
+        return 0;
+    }
+
+    static char outBuffer[1 << 20];
+    setvbuf(stdout, outBuffer, _IOFBF, sizeof(outBuffer));
+    Decoder decoder(elf, options, stdout);
+
+    if (options.udpPort != 0) {
+        if (!decodeUdp(decoder, options.udpPort)) {
+            fprintf(stderr, "%s: cannot listen on UDP port %d\n", argv[0], options.udpPort);
+            return 1;
+        }
+        return 0;
+    }
+
+    const char* capture = argv[arg + 1];
+    if (strcmp(capture, "-") == 0 && !options.flash) {
+        decodeStream(decoder, stdin);
+        return 0;
+    }
+
+    MappedFile file;
+    if (!file.open(capture)) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], capture);
+        return 1;
+    }
+    if (options.flash) {
+        size_t damaged;
+        std::vector<uint8_t> log = readStorage(file.data(), file.size(), &damaged);
+        if (damaged > 0) {
+            fprintf(stderr, "%s: %zu damaged page(s) skipped\n", argv[0], damaged);
+        }
+        decoder.feed(log.data(), log.size(), true);
+    } else {
+        decoder.feed(file.data(), file.size(), true);
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * ThorLog fuzz target
+ *
+ * Feeds arbitrary format strings and argument lists to the formatter that
+ * print() and the level methods use, and arbitrary bytes to the
+ * binary record decoder that ThorRtcPrint::replay() and thorlog_decode
+ * run on data they did not write themselves.
+ *
+ * Input layout: one byte selecting the argument types (two bits each, for
+ * up to four arguments), one byte with the argument count, eight bytes of
+ * argument value, then the format string. The whole input is also decoded
+ * as a binary record.
+ *
+ * ============================================================================
+ * BUILD AND USAGE:
+ * ============================================================================
+ *
+ *   cmake -S . -B build-fuzz -DCMAKE_CXX_COMPILER=clang++ -DTHORLOG_BUILD_FUZZ=ON
+ *   cmake --build build-fuzz --target thorlog_fuzz
+ *   ./build-fuzz/thorlog_fuzz -max_total_time=60
+ *
+ * ============================================================================
+ */
+
+#include "thorlog.h"
+
+#include <cstring>
+#include <string>
+
+/**
+ * DiscardPrint - Output that drops everything
+ */
+class DiscardPrint : public ThorWritePrint {
+public:
+    size_t write(const char* buffer, size_t size) override {
+        (void)buffer;
+        return size;
+    }
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    static DiscardPrint output;
+
+    ThorBinaryRecordInfo info;
+    ThorArg decoded[8];
+    thorlog_decode_binary(data, size, &info, decoded, 8);
+
+    if (size < 10) {
+        return 0;
+    }
+    uint8_t types = data[0];
+    size_t argc = data[1] % 5;
+    uint64_t value;
+    memcpy(&value, data + 2, sizeof(value));
+    // The format and the one string argument are NUL-terminated copies
+    std::string format(reinterpret_cast<const char*>(data + 10), size - 10);
+    std::string text = format.substr(0, format.size() / 2);
+
+    ThorArg args[4];
+    for (size_t i = 0; i < 4; ++i) {
+        switch ((types >> (2 * i)) & 3) {
+        case 0: args[i] = thorlog_make_arg(static_cast<int>(value)); break;
+        case 1: args[i] = thorlog_make_arg(value); break;
+        case 2: {
+            double d;
+            memcpy(&d, &value, sizeof(d));
+            args[i] = thorlog_make_arg(d);
+            break;
+        }
+        default: args[i] = thorlog_make_arg(text.c_str()); break;
+        }
+    }
+
+    ThorRecord record(&output);
+    ThorLogging::format(record, format.c_str(), args, argc);
+    record.commit("\n");
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * ThorLog flash partition reader
+ *
+ * Pulls the log out of a dump of a ThorStoragePrint partition on the host.
+ * Shared by tools/thorlog_decode.cpp (--flash) and tools/thorlog_test.cpp.
+ *
+ *   parttool.py read_partition --partition-name thorlog --output flash.bin
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The partition layout of thorlog_storage_espidf.h
+#define THORLOG_DECODE_SECTOR_SIZE 4096
+#define THORLOG_DECODE_STORAGE_MAGIC 0x474F4C54UL  // "TLOG"
+
+inline uint32_t crc32(const uint8_t* data, size_t size)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320UL : (c >> 1);
+            }
+            table[i] = c;
+        }
+    }
+    uint32_t crc = 0xFFFFFFFFUL;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFUL;
+}
+
+inline uint32_t readLe32(const uint8_t* p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+/**
+ * Pull the log out of a ThorStoragePrint partition dump, oldest segment
+ * first. Damaged pages end their segment, as they do on the device.
+ */
+inline std::vector<uint8_t> readStorage(const uint8_t* data, size_t size, size_t* damaged)
+{
+    struct Segment {
+        uint32_t sequence;
+        size_t offset;
+    };
+    std::vector<Segment> segments;
+    for (size_t offset = 0; offset + THORLOG_DECODE_SECTOR_SIZE <= size; offset += THORLOG_DECODE_SECTOR_SIZE) {
+        const uint8_t* header = data + offset;
+        if (readLe32(header) == THORLOG_DECODE_STORAGE_MAGIC && readLe32(header + 12) == crc32(header, 12)) {
+            segments.push_back({readLe32(header + 4), offset});
+        }
+    }
+    // Sequence numbers wrap around; compare them as a difference
+    std::sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) {
+        return static_cast<int32_t>(a.sequence - b.sequence) < 0;
+    });
+
+    std::vector<uint8_t> log;
+    *damaged = 0;
+    for (const Segment& segment : segments) {
+        const uint8_t* base = data + segment.offset;
+        size_t offset = 16;
+        while (offset + 8 <= THORLOG_DECODE_SECTOR_SIZE) {
+            uint16_t length = static_cast<uint16_t>(base[offset] | (base[offset + 1] << 8));
+            uint16_t check = static_cast<uint16_t>(base[offset + 2] | (base[offset + 3] << 8));
+            if (length == 0xFFFF && check == 0xFFFF) {
+                break;  // erased: end of the segment
+            }
+            size_t padded = (static_cast<size_t>(length) + 3) & ~static_cast<size_t>(3);
+            const uint8_t* page = base + offset + 8;
+            if (static_cast<uint16_t>(~length) != check || length == 0 ||
+                offset + 8 + padded > THORLOG_DECODE_SECTOR_SIZE || crc32(page, length) != readLe32(base + offset + 4)) {
+                ++*damaged;
+                break;
+            }
+            log.insert(log.end(), page, page + length);
+            offset += 8 + padded;
+        }
+    }
+    return log;
+}
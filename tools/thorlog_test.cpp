@@ -0,0 +1,289 @@
+/*
+ * ThorLog host tests
+ *
+ * Logs into an in-memory output and checks what comes out: text records,
+ * binary records decoded with thorlog_decode_binary() (level, tag,
+ * arguments, the sample and backtrace trailers, interned format IDs),
+ * binary records formatted back into text with formatBinary(), and the
+ * ThorStoragePrint partition layout as read by thorlog_decode --flash.
+ * Prints each failed check and exits non-zero if there was one.
+ *
+ * ============================================================================
+ * BUILD AND USAGE:
+ * ============================================================================
+ *
+ *   g++ -std=c++17 -O2 -I.. thorlog_test.cpp -o thorlog_test -pthread
+ *   ./thorlog_test
+ *
+ * or from the top-level build: ctest --test-dir build
+ *
+ * ============================================================================
+ */
+
+// Calls wrapped in THORLOG_FMT() carry an ID, others the format's address
+#define THORLOG_INTERN THORLOG_INTERN_ID
+
+#include "thorlog.h"
+#include "thorlog_storage_dump.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define THORLOG_TEST_CHECK(cond)                                                     \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                              \
+        }                                                                            \
+    } while (0)
+
+/**
+ * CapturePrint - Keeps everything written to it
+ */
+class CapturePrint : public ThorWritePrint {
+public:
+    size_t write(const char* buffer, size_t size) override {
+        data.append(buffer, size);
+        return size;
+    }
+
+    std::string data;
+};
+
+/**
+ * DecodedRecord - One binary record taken apart
+ */
+struct DecodedRecord {
+    ThorBinaryRecordInfo info;
+    std::vector<ThorArg> args;
+    std::vector<uint64_t> frames;
+    std::string raw;
+};
+
+// Splits a capture of binary records; an invalid record fails the check
+// and ends the list
+static std::vector<DecodedRecord> decodeAll(const std::string& capture) {
+    std::vector<DecodedRecord> records;
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(capture.data());
+    size_t pos = 0;
+    while (pos < capture.size()) {
+        DecodedRecord record;
+        ThorArg args[THORLOG_BINARY_MAX_ARGS];
+        long used = thorlog_decode_binary(data + pos, capture.size() - pos, &record.info, args, THORLOG_BINARY_MAX_ARGS);
+        THORLOG_TEST_CHECK(used > 0);
+        if (used <= 0) {
+            break;
+        }
+        record.args.assign(args, args + record.info.argc);
+        record.frames.resize(record.info.depth);
+        record.frames.resize(thorlog_get_backtrace(&record.info, record.frames.data(), record.frames.size()));
+        record.raw = capture.substr(pos, static_cast<size_t>(used));
+        records.push_back(record);
+        pos += static_cast<size_t>(used);
+    }
+    return records;
+}
+
+static void testText() {
+    static ThorLogging log;
+    CapturePrint out;
+    log.begin(THORLOG_LEVEL_INFO, &out);
+    log.infoln("v=%d %s %x", 42, "abc", 0xBEEFu);
+    log.traceln("filtered");
+    log.warning("no newline %T", true);
+    THORLOG_TEST_CHECK(out.data == "I: v=42 abc beef" THORLOG_CR "W: no newline true");
+}
+
+static void testBinary() {
+    static ThorLogging log;
+    static const char tagName[] = "wifi";
+    static const char* format = "v=%d %s %u";
+    CapturePrint out;
+    log.begin(THORLOG_LEVEL_VERBOSE, &out);
+    log.setMode(THORLOG_MODE_BINARY);
+    ThorLogger wifi(tagName, log);
+
+    log.infoln(format, -5, "abc", 7u);
+    wifi.warning("tagged");
+    std::vector<DecodedRecord> records = decodeAll(out.data);
+    THORLOG_TEST_CHECK(records.size() == 2);
+    if (records.size() != 2) {
+        return;
+    }
+
+    const ThorBinaryRecordInfo& info = records[0].info;
+    THORLOG_TEST_CHECK(info.level == THORLOG_LEVEL_INFO);
+    THORLOG_TEST_CHECK(info.cr);
+    THORLOG_TEST_CHECK(!info.truncated && !info.interned);
+    THORLOG_TEST_CHECK(info.format == reinterpret_cast<uintptr_t>(format));
+    THORLOG_TEST_CHECK(info.tag == 0);
+    THORLOG_TEST_CHECK(info.skipped == 0 && info.depth == 0);
+    THORLOG_TEST_CHECK(info.argc == 3);
+    if (records[0].args.size() == 3) {
+        const std::vector<ThorArg>& args = records[0].args;
+        THORLOG_TEST_CHECK(args[0].type == ThorArg::INT && args[0].i == -5 && args[0].size == sizeof(int));
+        THORLOG_TEST_CHECK(args[1].type == ThorArg::STRING && args[1].len == 3 && memcmp(args[1].s, "abc", 3) == 0);
+        THORLOG_TEST_CHECK(args[2].type == ThorArg::UINT && args[2].u == 7);
+    }
+
+    THORLOG_TEST_CHECK(records[1].info.level == THORLOG_LEVEL_WARNING);
+    THORLOG_TEST_CHECK(!records[1].info.cr);
+    THORLOG_TEST_CHECK(records[1].info.tag == reinterpret_cast<uintptr_t>(tagName));
+    THORLOG_TEST_CHECK(records[1].info.argc == 0);
+
+    // Formatted back on the device, binary records read as in text mode
+    CapturePrint text;
+    for (const DecodedRecord& record : records) {
+        ThorRecord line(&text, record.info.level);
+        THORLOG_TEST_CHECK(ThorLogging::formatBinary(line, record.raw.data(), record.raw.size()) == record.raw.size());
+        line.commit();
+    }
+    THORLOG_TEST_CHECK(text.data == "I: v=-5 abc 7" THORLOG_CR "W: wifi: tagged");
+}
+
+static void testSampled() {
+    static ThorLogging log;
+    static ThorLogSample sample = ThorLogSample::every(3);
+    CapturePrint out;
+    log.begin(THORLOG_LEVEL_VERBOSE, &out);
+    log.setMode(THORLOG_MODE_BINARY);
+    for (int i = 0; i < 7; ++i) {
+        log.printSampled(sample, THORLOG_LEVEL_INFO, true, "n=%d", i);
+    }
+    std::vector<DecodedRecord> records = decodeAll(out.data);
+    THORLOG_TEST_CHECK(records.size() == 2);
+    for (const DecodedRecord& record : records) {
+        THORLOG_TEST_CHECK(record.info.skipped == 2);
+        THORLOG_TEST_CHECK(record.info.argc == 1);
+    }
+    if (records.size() == 2) {
+        THORLOG_TEST_CHECK(records[0].args[0].i == 2 && records[1].args[0].i == 5);
+    }
+    THORLOG_TEST_CHECK(sample.getSkipped() == 1);
+}
+
+static size_t fakeBacktrace(uintptr_t* frames, size_t max) {
+    static const uintptr_t stack[] = {0x400D1234, 0x42001000, 0x1};
+    size_t n = (max < 3) ? max : 3;
+    memcpy(frames, stack, n * sizeof(stack[0]));
+    return n;
+}
+
+static void testBacktrace() {
+    static ThorLogging log;
+    static ThorLogSample sample = ThorLogSample::every(2);
+    CapturePrint out;
+    log.begin(THORLOG_LEVEL_VERBOSE, &out);
+    log.setMode(THORLOG_MODE_BINARY);
+    log.setBacktrace(fakeBacktrace, THORLOG_LEVEL_ERROR);
+    log.errorln("failed %d", 1);
+    log.warningln("no backtrace");
+    // Both trailers on one record: the sample count comes first
+    log.printSampled(sample, THORLOG_LEVEL_FATAL, true, "x");
+    log.printSampled(sample, THORLOG_LEVEL_FATAL, true, "x");
+
+    std::vector<DecodedRecord> records = decodeAll(out.data);
+    THORLOG_TEST_CHECK(records.size() == 3);
+    if (records.size() != 3) {
+        return;
+    }
+    const std::vector<uint64_t> expected = {0x400D1234, 0x42001000, 0x1};
+    THORLOG_TEST_CHECK(records[0].frames == expected);
+    THORLOG_TEST_CHECK(records[0].info.argc == 1 && records[0].args[0].i == 1);
+    THORLOG_TEST_CHECK(records[1].info.depth == 0);
+    THORLOG_TEST_CHECK(records[2].info.skipped == 1);
+    THORLOG_TEST_CHECK(records[2].frames == expected);
+    THORLOG_TEST_CHECK(records[2].info.argc == 0);
+}
+
+static void testInterned() {
+    static ThorLogging log;
+    CapturePrint out;
+    log.begin(THORLOG_LEVEL_VERBOSE, &out);
+    log.setMode(THORLOG_MODE_BINARY);
+    log.infoln(THORLOG_FMT("id=%u"), 9u);
+    std::vector<DecodedRecord> records = decodeAll(out.data);
+    THORLOG_TEST_CHECK(records.size() == 1);
+    if (records.size() == 1) {
+        THORLOG_TEST_CHECK(records[0].info.interned);
+        THORLOG_TEST_CHECK(records[0].info.format == thorlog_intern_id("id=%u", 5));
+        THORLOG_TEST_CHECK(records[0].info.argc == 1 && records[0].args[0].u == 9);
+    }
+}
+
+// Builds a partition image as ThorStoragePrint writes it
+class StorageImage {
+public:
+    explicit StorageImage(size_t segments) : data(segments * THORLOG_DECODE_SECTOR_SIZE, 0xFF) {}
+
+    void segment(size_t index, uint32_t sequence) {
+        _offset = index * THORLOG_DECODE_SECTOR_SIZE;
+        uint8_t* header = &data[_offset];
+        putLe32(header, THORLOG_DECODE_STORAGE_MAGIC);
+        putLe32(header + 4, sequence);
+        putLe32(header + 8, 1024);
+        putLe32(header + 12, crc32(header, 12));
+        _offset += 16;
+    }
+
+    void page(const char* text, bool damaged = false) {
+        size_t length = strlen(text);
+        uint8_t* header = &data[_offset];
+        header[0] = static_cast<uint8_t>(length);
+        header[1] = static_cast<uint8_t>(length >> 8);
+        header[2] = static_cast<uint8_t>(~length);
+        header[3] = static_cast<uint8_t>(~length >> 8);
+        memcpy(header + 8, text, length);
+        putLe32(header + 4, crc32(header + 8, length) ^ (damaged ? 1 : 0));
+        _offset += 8 + ((length + 3) & ~static_cast<size_t>(3));
+    }
+
+    std::vector<uint8_t> data;
+
+private:
+    static void putLe32(uint8_t* p, uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            p[i] = static_cast<uint8_t>(v >> (8 * i));
+        }
+    }
+
+    size_t _offset = 0;
+};
+
+static void testStorage() {
+    StorageImage image(4);
+    // The sequence numbers wrap between the two oldest segments
+    image.segment(2, 0xFFFFFFFEUL);
+    image.page("one ");
+    image.page("two ");
+    image.segment(3, 0xFFFFFFFFUL);
+    image.page("three ");
+    image.page("lost", true);
+    image.page("after the damage");
+    image.segment(0, 0);
+    image.page("four");
+
+    size_t damaged = 0;
+    std::vector<uint8_t> log = readStorage(image.data.data(), image.data.size(), &damaged);
+    THORLOG_TEST_CHECK(std::string(log.begin(), log.end()) == "one two three four");
+    THORLOG_TEST_CHECK(damaged == 1);
+}
+
+int main() {
+    testText();
+    testBinary();
+    testSampled();
+    testBacktrace();
+    testInterned();
+    testStorage();
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}